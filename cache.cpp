@@ -29,6 +29,7 @@
 #include <QSaveFile>
 
 #include "juktag.h"
+#include "collectionlist.h"
 #include "searchplaylist.h"
 #include "historyplaylist.h"
 #include "upcomingplaylist.h"
@@ -40,8 +41,8 @@
 
 using namespace ActionCollection;
 
-const int Cache::playlistListCacheVersion = 3;
-const int Cache::playlistItemsCacheVersion = 2;
+const int Cache::playlistListCacheVersion = 5;
+const int Cache::playlistItemsCacheVersion;
 
 enum PlaylistType
 {
@@ -52,6 +53,174 @@ enum PlaylistType
     Folder   = 4
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// PlaylistDataStream
+////////////////////////////////////////////////////////////////////////////////
+
+PlaylistDataStream::PlaylistDataStream(QByteArray *data, QIODevice::OpenMode mode) :
+    QDataStream(data, mode),
+    m_cacheVersion(Cache::playlistListCacheVersion)
+{
+    setVersion(QDataStream::Qt_4_3);
+}
+
+void PlaylistDataStream::writeTrack(const FileHandle &file)
+{
+    const QString path = file.absFilePath();
+    auto it = m_trackIndices.constFind(path);
+
+    if(it == m_trackIndices.constEnd()) {
+        it = m_trackIndices.insert(path, quint32(m_trackKeys.size()));
+        m_trackIds.append(file.persistentId());
+        m_trackKeys.append(trackKey(path));
+        m_trackPaths.append(path);
+    }
+
+    // Variable length, 7 bits at a time
+    quint32 index = it.value();
+    char bytes[5];
+    int count = 0;
+
+    do {
+        bytes[count] = char(index & 0x7f);
+        index >>= 7;
+        if(index)
+            bytes[count] |= char(0x80);
+        ++count;
+    } while(index);
+
+    writeRawData(bytes, count);
+}
+
+FileHandle PlaylistDataStream::readTrack()
+{
+    if(m_cacheVersion < 4) {
+        QString path;
+        *this >> path;
+
+        if(path.isEmpty())
+            throw BICStreamException();
+
+        return FileHandle(path);
+    }
+
+    quint32 index = 0;
+
+    for(int shift = 0; ; shift += 7) {
+        quint8 byte;
+        *this >> byte;
+
+        if(status() != QDataStream::Ok || shift > 28)
+            throw BICStreamException();
+
+        index |= quint32(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            break;
+    }
+
+    if(index >= quint32(m_trackKeys.size()))
+        throw BICStreamException();
+
+    return resolveTrack(index);
+}
+
+FileHandle PlaylistDataStream::resolveTrack(quint32 index)
+{
+    FileHandle &resolved = m_resolvedTracks[int(index)];
+    if(!resolved.isNull())
+        return resolved;
+
+    const quint64 key = m_trackKeys[int(index)];
+
+    if(m_cacheVersion >= 5) {
+        // The key of the path guards against IDs that were handed out again
+        // after the collection cache was lost.
+        const CollectionListItem *item = CollectionList::instance()->lookup(m_trackIds[int(index)]);
+        if(item && trackKey(item->file().absFilePath()) == key)
+            resolved = item->file();
+    }
+    else {
+        if(m_collectionTracks.isEmpty()) {
+            const PlaylistItemList items = CollectionList::instance()->items();
+            m_collectionTracks.reserve(items.count());
+
+            for(const PlaylistItem *item : items) {
+                const FileHandle file = item->file();
+                m_collectionTracks.insert(trackKey(file.absFilePath()), file);
+            }
+        }
+
+        resolved = m_collectionTracks.value(key);
+    }
+
+    if(resolved.isNull()) {
+        // Not in the collection (anymore), fall back to the path.
+        if(m_trackPaths.isEmpty()) {
+            QDataStream s(&m_trackPathData, QIODevice::ReadOnly);
+            s.setVersion(QDataStream::Qt_4_3);
+            s >> m_trackPaths;
+
+            if(m_trackPaths.count() != m_trackKeys.count())
+                throw BICStreamException();
+        }
+
+        const QString &path = m_trackPaths[int(index)];
+        if(path.isEmpty())
+            throw BICStreamException();
+
+        resolved = FileHandle(path);
+    }
+
+    return resolved;
+}
+
+void PlaylistDataStream::writeTrackTable(QDataStream &s) const
+{
+    QByteArray pathData;
+    QDataStream ps(&pathData, QIODevice::WriteOnly);
+    ps.setVersion(QDataStream::Qt_4_3);
+    ps << m_trackPaths;
+
+    s << m_trackIds
+      << m_trackKeys
+      << pathData;
+}
+
+void PlaylistDataStream::readTrackTable()
+{
+    if(m_cacheVersion < 4)
+        return;
+
+    if(m_cacheVersion >= 5)
+        *this >> m_trackIds;
+
+    *this >> m_trackKeys
+          >> m_trackPathData;
+
+    if(status() != QDataStream::Ok ||
+       (m_cacheVersion >= 5 && m_trackIds.size() != m_trackKeys.size()))
+    {
+        throw BICStreamException();
+    }
+
+    m_trackPaths.clear();
+    m_resolvedTracks.clear();
+    m_resolvedTracks.resize(m_trackKeys.size());
+}
+
+quint64 PlaylistDataStream::trackKey(const QString &canonicalPath) // static
+{
+    // 64-bit FNV-1a over the UTF-16 code units
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+
+    for(const QChar c : canonicalPath) {
+        hash ^= c.unicode();
+        hash *= Q_UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // public methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -62,7 +231,7 @@ Cache *Cache::instance()
     return &cache;
 }
 
-static void parsePlaylistStream(QDataStream &s, PlaylistCollection *collection)
+static void parsePlaylistStream(PlaylistDataStream &s, PlaylistCollection *collection)
 {
     while(!s.atEnd()) {
         qint32 playlistType;
@@ -74,7 +243,7 @@ static void parsePlaylistStream(QDataStream &s, PlaylistCollection *collection)
         case Search:
         {
             SearchPlaylist *p = new SearchPlaylist(collection, *(new PlaylistSearch(JuK::JuKInstance())));
-            s >> *p;
+            static_cast<QDataStream &>(s) >> *p; // No tracks to resolve
             playlist = p;
             break;
         }
@@ -100,7 +269,7 @@ static void parsePlaylistStream(QDataStream &s, PlaylistCollection *collection)
         case Folder:
         {
             FolderPlaylist *p = new FolderPlaylist(collection);
-            s >> *p;
+            static_cast<QDataStream &>(s) >> *p; // No tracks to resolve
             playlist = p;
             break;
         }
@@ -139,7 +308,7 @@ void Cache::loadPlaylists(PlaylistCollection *collection) // static
     qint32 version;
     fs >> version;
 
-    if(version != 3 || fs.status() != QDataStream::Ok) {
+    if(version < 3 || version > playlistListCacheVersion || fs.status() != QDataStream::Ok) {
         // Either the file is corrupt or is from a truly ancient version
         // of JuK.
         qCWarning(JUK_LOG) << "Found the playlist cache but it was clearly corrupt.";
@@ -156,10 +325,11 @@ void Cache::loadPlaylists(PlaylistCollection *collection) // static
     if(fs.status() != QDataStream::Ok || checksum != qChecksum(data.data(), data.size()))
         return;
 
-    QDataStream s(&data, QIODevice::ReadOnly);
-    s.setVersion(QDataStream::Qt_4_3);
+    PlaylistDataStream s(&data, QIODevice::ReadOnly);
+    s.setCacheVersion(version);
 
     try { // Loading failures are indicated by an exception
+        s.readTrackTable();
         parsePlaylistStream(s, collection);
     }
     catch(BICStreamException &) {
@@ -180,9 +350,11 @@ void Cache::savePlaylists(const PlaylistList &playlists)
         return;
     }
 
-    QByteArray data;
-    QDataStream s(&data, QIODevice::WriteOnly);
-    s.setVersion(QDataStream::Qt_4_3);
+    QByteArray playlistData;
+    PlaylistDataStream s(&playlistData, QIODevice::WriteOnly);
+
+    // The stream operators for the playlists are only found on the
+    // PlaylistDataStream, so don't chain them after the type.
 
     for(const auto &it : playlists) {
         if(!(it)) {
@@ -190,8 +362,8 @@ void Cache::savePlaylists(const PlaylistList &playlists)
         }
         // TODO back serialization type into Playlist itself
         if(dynamic_cast<HistoryPlaylist *>(it)) {
-            s << qint32(History)
-                << *static_cast<HistoryPlaylist *>(it);
+            s << qint32(History);
+            s << *static_cast<HistoryPlaylist *>(it);
         }
         else if(dynamic_cast<SearchPlaylist *>(it)) {
             s << qint32(Search)
@@ -200,20 +372,27 @@ void Cache::savePlaylists(const PlaylistList &playlists)
         else if(dynamic_cast<UpcomingPlaylist *>(it)) {
             if(!action<KToggleAction>("saveUpcomingTracks")->isChecked())
                 continue;
-            s << qint32(Upcoming)
-                << *static_cast<UpcomingPlaylist *>(it);
+            s << qint32(Upcoming);
+            s << *static_cast<UpcomingPlaylist *>(it);
         }
         else if(dynamic_cast<FolderPlaylist *>(it)) {
             s << qint32(Folder)
                 << *static_cast<FolderPlaylist *>(it);
         }
         else {
-            s << qint32(Normal)
-                << *(it);
+            s << qint32(Normal);
+            s << *(it);
         }
         s << qint32(it->sortColumn());
     }
 
+    QByteArray data;
+    QDataStream ds(&data, QIODevice::WriteOnly);
+    ds.setVersion(QDataStream::Qt_4_3);
+
+    s.writeTrackTable(ds);
+    ds.writeRawData(playlistData.constData(), playlistData.size());
+
     QDataStream fs(&f);
     fs << qint32(playlistListCacheVersion);
     fs << qChecksum(data.data(), data.size());
@@ -250,16 +429,88 @@ QString Cache::playlistsCacheFileName() // static
     return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/playlists";
 }
 
+QStringList Cache::takeDamagedPaths()
+{
+    QStringList paths;
+    paths.swap(m_damagedPaths);
+    return paths;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // private methods
 ////////////////////////////////////////////////////////////////////////////////
 
-Cache::Cache()
+Cache::Cache() :
+    m_nextTrack(0),
+    m_rereadTracks(0),
+    m_lostTracks(0),
+    m_needsRewrite(false),
+    m_itemsLost(false),
+    m_loadingFromFile(false)
 {
 
 }
 
 bool Cache::prepareToLoadCachedItems()
+{
+    m_needsRewrite = false;
+    m_loadingFromFile = false;
+    m_journalEntries = m_journal.replay();
+
+    QFile f(fileHandleCacheFileName());
+    if(f.open(QIODevice::ReadOnly)) {
+        if(CacheFileView::hasMagic(f.peek(sizeof(CacheFileHeader::magic)))) {
+            m_loadingFromFile = prepareToLoadMappedItems();
+        }
+        else {
+            m_needsRewrite = true;
+            m_loadingFromFile = prepareToLoadLegacyItems();
+        }
+    }
+
+    m_itemsLost = !m_loadingFromFile;
+
+    return m_loadingFromFile || !m_journalEntries.isEmpty();
+}
+
+bool Cache::prepareToLoadMappedItems()
+{
+    m_mappedFile.setFileName(fileHandleCacheFileName());
+    if(!m_mappedFile.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = m_mappedFile.size();
+    const uchar *data = nullptr;
+
+#ifdef Q_OS_WIN
+    // Windows won't let the cache be replaced while it is mapped, so use a
+    // private copy there.
+    m_mappedCopy = m_mappedFile.readAll();
+    m_mappedFile.close();
+    data = reinterpret_cast<const uchar *>(m_mappedCopy.constData());
+#else
+    data = m_mappedFile.map(0, size);
+#endif
+
+    m_nextTrack = 0;
+    m_rereadTracks = 0;
+    m_damagedPaths.clear();
+    m_lostTracks = 0;
+
+    if(!m_cacheView.open(data, size)) {
+        KMessageBox::sorry(0, i18n("The music data cache has been corrupted. JuK "
+                                   "needs to rescan it now. This may take some time."));
+        return false;
+    }
+
+    // Older versions are read as well, but rewritten right away.
+    if(m_cacheView.version() != quint32(playlistItemsCacheVersion))
+        m_needsRewrite = true;
+
+    return true;
+}
+
+bool Cache::prepareToLoadLegacyItems()
 {
     m_loadFile.setFileName(fileHandleCacheFileName());
     if(!m_loadFile.open(QIODevice::ReadOnly))
@@ -322,6 +573,82 @@ bool Cache::prepareToLoadCachedItems()
 }
 
 FileHandle Cache::loadNextCachedItem()
+{
+    while(m_loadingFromFile) {
+        const FileHandle file = m_cacheView.isOpen()
+            ? loadNextMappedItem()
+            : loadNextLegacyItem();
+
+        if(file.isNull()) {
+            m_loadingFromFile = false;
+            break;
+        }
+
+        const auto it = m_journalEntries.find(file.absFilePath());
+        if(it == m_journalEntries.end())
+            return file;
+
+        // Changed or removed since the cache was written
+        const FileHandle journaled = it.value();
+        m_journalEntries.erase(it);
+
+        if(!journaled.isNull())
+            return journaled;
+    }
+
+    // Whatever is left in the journal was added since the cache was written.
+    while(!m_journalEntries.isEmpty()) {
+        const auto it = m_journalEntries.begin();
+        const FileHandle journaled = it.value();
+        m_journalEntries.erase(it);
+
+        if(!journaled.isNull())
+            return journaled;
+    }
+
+    return FileHandle();
+}
+
+FileHandle Cache::loadNextMappedItem()
+{
+    while(m_nextTrack < m_cacheView.trackCount()) {
+        const quint32 index = m_nextTrack++;
+        const QString path = m_cacheView.trackPath(index);
+
+        if(path.isEmpty()) {
+            // Can't even tell which file this was, the folder scan will have
+            // to find it again.
+            ++m_lostTracks;
+            continue;
+        }
+
+        if(m_cacheView.isTrackIntact(index)) {
+            const CacheTrackRecord &record = m_cacheView.track(index);
+            FileHandle file(path, record, m_cacheView.strings());
+            file.setPersistentId(record.id);
+            return file;
+        }
+
+        // Only the cached tag is damaged, so the file has to be read again.
+        // That is left to the GUI thread, as reading a tag shares its strings.
+        m_damagedPaths.append(path);
+        ++m_rereadTracks;
+    }
+
+    if(m_cacheView.damagedBlockCount() > 0) {
+        qCWarning(JUK_LOG) << m_cacheView.damagedBlockCount() << "blocks of the music cache were corrupt,"
+                           << m_rereadTracks << "tracks are read again and"
+                           << m_lostTracks << "were dropped";
+        m_needsRewrite = true;
+    }
+
+    if(m_lostTracks > 0)
+        m_itemsLost = true;
+
+    return FileHandle();
+}
+
+FileHandle Cache::loadNextLegacyItem()
 {
     if(!m_loadFile.isOpen() || !m_loadDataStream.device()) {
         qCWarning(JUK_LOG) << "Already completed reading cache file.";
@@ -21,14 +21,17 @@
 #include <QDataStream>
 #include <QFile>
 #include <QBuffer>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+#include "cachefile.h"
+#include "cachejournal.h"
 
 class Playlist;
 class PlaylistCollection;
 class FileHandle;
 
-template<class T>
-class QVector;
-
 typedef QVector<Playlist *> PlaylistList;
 
 /**
@@ -49,6 +52,57 @@ private:
     int m_cacheVersion;
 };
 
+/**
+ * Stream used for the saved playlists.  Rather than the full path of every
+ * item, playlists store a varint index into a table of the tracks used by
+ * any playlist, written once before the playlists.  The table holds the
+ * persistent ID of each track, which is looked up in the CollectionList on
+ * loading, and a 64-bit key of its path that tells whether the ID still
+ * refers to the same file.  The paths are stored as well, but are only
+ * parsed if a track can't be found in the collection.
+ *
+ * Streams from playlist cache version 4 have no IDs and find the tracks by
+ * their key, those from version 3 store a path for each item instead.
+ */
+class PlaylistDataStream : public QDataStream
+{
+public:
+    PlaylistDataStream(QByteArray *data, QIODevice::OpenMode mode);
+
+    int cacheVersion() const { return m_cacheVersion; }
+    void setCacheVersion(int v) { m_cacheVersion = v; }
+
+    void writeTrack(const FileHandle &file);
+
+    /**
+     * Returns the next track, throws BICStreamException if the stream is
+     * damaged.
+     */
+    FileHandle readTrack();
+
+    void writeTrackTable(QDataStream &s) const;
+    void readTrackTable();
+
+    /**
+     * The key of the path @p canonicalPath.
+     */
+    static quint64 trackKey(const QString &canonicalPath);
+
+private:
+    FileHandle resolveTrack(quint32 index);
+
+    int m_cacheVersion;
+
+    QVector<quint64> m_trackIds;
+    QVector<quint64> m_trackKeys;
+    QHash<QString, quint32> m_trackIndices;   ///< For writing
+    QStringList m_trackPaths;
+
+    QByteArray m_trackPathData;               ///< Parsed into m_trackPaths if needed
+    QVector<FileHandle> m_resolvedTracks;
+    QHash<quint64, FileHandle> m_collectionTracks; ///< For version 4
+};
+
 
 class Cache
 {
@@ -67,10 +121,38 @@ public:
     bool prepareToLoadCachedItems();
     FileHandle loadNextCachedItem();
 
+    /**
+     * Returns true if the items were loaded from a cache file in an older
+     * format or one that was partly corrupt, which should be rewritten once
+     * loading has completed.
+     */
+    bool cacheNeedsRewrite() const { return m_needsRewrite; }
+
+    /**
+     * Returns true if there was no usable cache or tracks had to be dropped
+     * from it, i.e. the loaded collection may be missing files.
+     */
+    bool cachedItemsLost() const { return m_itemsLost; }
+
+    /**
+     * Returns the paths of the tracks whose cached data was damaged, and
+     * forgets them.  These have to be read from disk again, which has to
+     * happen on the GUI thread.
+     */
+    QStringList takeDamagedPaths();
+
+    /**
+     * Changes to the collection made after the cache was loaded are recorded
+     * here rather than by rewriting the cache.
+     */
+    CacheJournal *journal() { return &m_journal; }
+
     /**
      * QDataStream version for serialized list of playlists
      * 1, 2: Who knows?
-     * 3: Current.
+     * 3: Full path of every item.
+     * 4: Items refer to a shared track table, see PlaylistDataStream.
+     * 5: The track table has the persistent ID of each track.
      */
     static const int playlistListCacheVersion;
 
@@ -78,17 +160,49 @@ public:
      * QDataStream version for serialized list of playlist items in a playlist
      * 1: Original cache version
      * 2: KDE 4.0.1+, explicitly sets QDataStream encoding.
+     * 3: Memory mapped columnar format with a shared string table and a
+     *    single checksum.  No longer uses QDataStream.  Not read anymore.
+     * 4: Split into blocks with a digest each, see cachefile.h.
+     * 5: Records have the size and inode of the file.
+     * 6: Records have the persistent ID of the track.
+     * 7: Records tell whether the audio properties were read, and the type
+     *    of the file.
      */
-    static const int playlistItemsCacheVersion;
+    static const int playlistItemsCacheVersion = 7;
 
 private:
     // private to force access through instance()
     Cache();
 
+    bool prepareToLoadMappedItems();
+    bool prepareToLoadLegacyItems();
+
+    FileHandle loadNextMappedItem();
+    FileHandle loadNextLegacyItem();
+
 private:
+    // Current format.  The strings of the loaded items point into the
+    // mapping, so it stays around for the lifetime of the process.
+    QFile m_mappedFile;
+    QByteArray m_mappedCopy;
+    CacheFileView m_cacheView;
+    quint32 m_nextTrack;
+    int m_rereadTracks;
+    int m_lostTracks;
+    QStringList m_damagedPaths;
+
+    // Formats up to version 2
     QFile m_loadFile;
     QBuffer m_loadFileBuffer;
     CacheDataStream m_loadDataStream;
+
+    bool m_needsRewrite;
+    bool m_itemsLost;
+
+    // Entries from the journal override the items from the cache file.
+    CacheJournal m_journal;
+    QHash<QString, FileHandle> m_journalEntries;
+    bool m_loadingFromFile;
 };
 
 #endif
@@ -0,0 +1,500 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachefile.h"
+
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QSaveFile>
+
+#include <cstring>
+#include <type_traits>
+
+#include "cache.h"
+#include "mediafiles.h"
+#include "juk_debug.h"
+
+static const char cacheMagic[] = { 'J', 'u', 'K', 'C', 'a', 'c', 'h', 'e' };
+static const quint32 cacheByteOrder = 0x01020304;
+
+static_assert(sizeof(cacheMagic) == sizeof(CacheFileHeader::magic), "Cache magic must fill the header field");
+static_assert(std::is_trivially_copyable<CacheTrackRecord>::value, "Cache records are used in place");
+static_assert(sizeof(CacheTrackRecord) % 8 == 0, "Cache records must stay 8-byte aligned");
+
+static const quint32 cacheBlockSize = 64 * 1024;
+static const int digestSize = 16;
+
+static_assert(sizeof(CacheFileHeader::headerDigest) == digestSize, "Digests are MD5");
+
+static quint64 alignedTo8(quint64 offset)
+{
+    return (offset + 7) & ~quint64(7);
+}
+
+static QByteArray digest(const uchar *data, quint64 size)
+{
+    return QCryptographicHash::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size)),
+        QCryptographicHash::Md5);
+}
+
+static QByteArray headerDigest(const CacheFileHeader &header)
+{
+    CacheFileHeader copy = header;
+    std::memset(copy.headerDigest, 0, sizeof(copy.headerDigest));
+
+    return digest(reinterpret_cast<const uchar *>(&copy), sizeof(copy));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheStringTable
+////////////////////////////////////////////////////////////////////////////////
+
+CacheStringTable::CacheStringTable() :
+    m_index(nullptr),
+    m_data(nullptr),
+    m_count(0),
+    m_dataLength(0)
+{
+}
+
+void CacheStringTable::reset(const uchar *index, const uchar *data, quint32 count, quint64 dataSize)
+{
+    m_index = reinterpret_cast<const CacheStringEntry *>(index);
+    m_data = reinterpret_cast<const QChar *>(data);
+    m_count = count;
+    m_dataLength = dataSize / sizeof(QChar);
+
+    m_resolved.clear();
+    m_resolved.resize(count);
+}
+
+QString CacheStringTable::string(quint32 id) const
+{
+    if(Q_UNLIKELY(id >= m_count))
+        return QString();
+
+    QString &resolved = m_resolved[id];
+    if(resolved.isNull())
+        resolved = unsharedString(id);
+
+    return resolved;
+}
+
+QString CacheStringTable::unsharedString(quint32 id) const
+{
+    if(Q_UNLIKELY(id >= m_count))
+        return QString();
+
+    const CacheStringEntry &entry = m_index[id];
+
+    if(entry.length == 0 ||
+       quint64(entry.offset) + entry.length > m_dataLength)
+    {
+        return QString();
+    }
+
+    return QString::fromRawData(m_data + entry.offset, int(entry.length));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheFileView
+////////////////////////////////////////////////////////////////////////////////
+
+CacheFileView::CacheFileView() :
+    m_data(nullptr),
+    m_header(nullptr),
+    m_paths(nullptr),
+    m_records(nullptr),
+    m_recordSize(0),
+    m_damagedBlocks(0)
+{
+}
+
+bool CacheFileView::open(const uchar *data, qint64 size)
+{
+    close();
+
+    if(!data || size < qint64(sizeof(CacheFileHeader)))
+        return false;
+
+    const auto header = reinterpret_cast<const CacheFileHeader *>(data);
+    const quint64 fileSize = quint64(size);
+
+    if(std::memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+       header->byteOrder != cacheByteOrder ||
+       header->headerSize < sizeof(CacheFileHeader) ||
+       recordSize(header->version) == 0 ||
+       header->recordSize != recordSize(header->version))
+    {
+        qCWarning(JUK_LOG) << "Cache file header is not from a compatible version";
+        return false;
+    }
+
+    if(headerDigest(*header) != QByteArray::fromRawData(header->headerDigest, digestSize)) {
+        qCCritical(JUK_LOG) << "Cache file header is corrupt";
+        return false;
+    }
+
+    const quint64 indexEnd = header->stringIndexOffset +
+        quint64(header->stringCount) * sizeof(CacheStringEntry);
+    const quint64 dataEnd = header->stringDataOffset + header->stringDataSize;
+    const quint64 pathsEnd = header->pathsOffset +
+        quint64(header->trackCount) * sizeof(quint32);
+    const quint64 recordsEnd = header->recordsOffset +
+        quint64(header->trackCount) * header->recordSize;
+    const quint64 digestsEnd = header->blockDigestsOffset +
+        quint64(header->blockCount) * digestSize;
+    const quint64 bodySize = header->blockDigestsOffset - header->headerSize;
+
+    if(header->stringCount == 0 || header->blockSize == 0 ||
+       header->stringIndexOffset < header->headerSize || indexEnd > header->blockDigestsOffset ||
+       header->stringDataOffset < header->headerSize || dataEnd > header->blockDigestsOffset ||
+       header->pathsOffset < header->headerSize || pathsEnd > header->blockDigestsOffset ||
+       header->recordsOffset < header->headerSize || recordsEnd > header->blockDigestsOffset ||
+       header->blockDigestsOffset < header->headerSize || digestsEnd > fileSize ||
+       header->stringDataOffset % 8 != 0 || header->pathsOffset % 8 != 0 ||
+       header->recordsOffset % 8 != 0 ||
+       (bodySize + header->blockSize - 1) / header->blockSize != header->blockCount)
+    {
+        qCCritical(JUK_LOG) << "Cache file is truncated or its offsets are corrupt";
+        return false;
+    }
+
+    // Without the digests nothing else can be trusted
+    if(digest(data + header->blockDigestsOffset, quint64(header->blockCount) * digestSize) !=
+       QByteArray::fromRawData(header->blockDigestsDigest, digestSize))
+    {
+        qCCritical(JUK_LOG) << "Cache file block digests are corrupt";
+        return false;
+    }
+
+    m_data = data;
+    m_header = header;
+    m_paths = reinterpret_cast<const quint32 *>(data + header->pathsOffset);
+    m_records = data + header->recordsOffset;
+    m_recordSize = header->recordSize;
+
+    if(header->version != quint32(Cache::playlistItemsCacheVersion)) {
+        // Older records are a prefix of the current one, so copy them over
+        // once instead of checking the version on every access.  Damaged
+        // records are copied as well; isTrackIntact() still checks the file.
+        CacheTrackRecord blank;
+        std::memset(&blank, 0, sizeof(blank));
+        blank.size = -1;
+
+        m_upgradedRecords.fill(blank, int(header->trackCount));
+        for(quint32 i = 0; i < header->trackCount; ++i) {
+            CacheTrackRecord &record = m_upgradedRecords[int(i)];
+            std::memcpy(&record, m_records + quint64(i) * m_recordSize, m_recordSize);
+
+            // Used to be reserved.  A length or bitrate of 0 was all that
+            // told that the audio properties were not read yet.
+            record.flags = record.seconds != 0 || record.bitrate != 0
+                ? CacheTrackRecord::AudioPropertiesRead : 0;
+            record.fileType = MediaFiles::UnknownFile;
+        }
+
+        m_records = reinterpret_cast<const uchar *>(m_upgradedRecords.constData());
+    }
+
+    m_strings.reset(data + header->stringIndexOffset, data + header->stringDataOffset,
+                    header->stringCount, header->stringDataSize);
+
+    m_blockState.fill(0, int(header->blockCount));
+    m_damagedBlocks = 0;
+
+    return true;
+}
+
+void CacheFileView::close()
+{
+    m_data = nullptr;
+    m_header = nullptr;
+    m_paths = nullptr;
+    m_records = nullptr;
+    m_recordSize = 0;
+    m_upgradedRecords.clear();
+    m_strings.reset(nullptr, nullptr, 0, 0);
+    m_blockState.clear();
+    m_damagedBlocks = 0;
+}
+
+quint32 CacheFileView::version() const
+{
+    return m_header ? m_header->version : 0;
+}
+
+quint32 CacheFileView::trackCount() const
+{
+    return m_header ? m_header->trackCount : 0;
+}
+
+QString CacheFileView::trackPath(quint32 index) const
+{
+    if(!isRangeIntact(m_header->pathsOffset + quint64(index) * sizeof(quint32), sizeof(quint32)))
+        return QString();
+
+    const quint32 id = m_paths[index];
+    if(id == 0 || !isStringIntact(id))
+        return QString();
+
+    // Paths are unique, so there's nothing to gain from sharing them
+    return m_strings.unsharedString(id);
+}
+
+bool CacheFileView::isTrackIntact(quint32 index) const
+{
+    if(!isRangeIntact(m_header->recordsOffset + quint64(index) * m_recordSize, m_recordSize))
+        return false;
+
+    const CacheTrackRecord &record = track(index);
+
+    return isStringIntact(record.title) && isStringIntact(record.artist) &&
+           isStringIntact(record.album) && isStringIntact(record.genre) &&
+           isStringIntact(record.comment);
+}
+
+quint32 CacheFileView::recordSize(quint32 version)
+{
+    // Each version has to be listed here with the size of its records, even
+    // if only their meaning changed.
+    switch(version) {
+    case 4:
+        return offsetof(CacheTrackRecord, size);
+    case 5:
+        return offsetof(CacheTrackRecord, id);
+    case 6:
+    case 7:
+        return sizeof(CacheTrackRecord);
+    default:
+        return 0;
+    }
+}
+
+bool CacheFileView::isStringIntact(quint32 id) const
+{
+    if(id == 0)
+        return true;
+    if(id >= m_header->stringCount)
+        return false;
+
+    const quint64 entryOffset = m_header->stringIndexOffset + quint64(id) * sizeof(CacheStringEntry);
+    if(!isRangeIntact(entryOffset, sizeof(CacheStringEntry)))
+        return false;
+
+    const auto entry = reinterpret_cast<const CacheStringEntry *>(m_data + entryOffset);
+    const quint64 dataOffset = m_header->stringDataOffset + quint64(entry->offset) * sizeof(QChar);
+    const quint64 dataSize = quint64(entry->length) * sizeof(QChar);
+
+    return dataOffset + dataSize <= m_header->stringDataOffset + m_header->stringDataSize &&
+           isRangeIntact(dataOffset, dataSize);
+}
+
+bool CacheFileView::isRangeIntact(quint64 offset, quint64 size) const
+{
+    if(size == 0)
+        return true;
+
+    const quint32 first = quint32((offset - m_header->headerSize) / m_header->blockSize);
+    const quint32 last = quint32((offset + size - 1 - m_header->headerSize) / m_header->blockSize);
+
+    for(quint32 block = first; block <= last; ++block) {
+        if(!isBlockIntact(block))
+            return false;
+    }
+
+    return true;
+}
+
+bool CacheFileView::isBlockIntact(quint32 block) const
+{
+    if(block >= m_header->blockCount)
+        return false;
+
+    qint8 &state = m_blockState[block];
+
+    if(state == 0) {
+        const quint64 start = m_header->headerSize + quint64(block) * m_header->blockSize;
+        const quint64 size = qMin<quint64>(m_header->blockSize, m_header->blockDigestsOffset - start);
+        const auto expected = reinterpret_cast<const char *>(
+                m_data + m_header->blockDigestsOffset + quint64(block) * digestSize);
+
+        if(digest(m_data + start, size) == QByteArray::fromRawData(expected, digestSize)) {
+            state = 1;
+        }
+        else {
+            qCWarning(JUK_LOG) << "Block" << block << "of the music cache is corrupt";
+            state = -1;
+            ++m_damagedBlocks;
+        }
+    }
+
+    return state > 0;
+}
+
+bool CacheFileView::hasMagic(const QByteArray &data) // static
+{
+    return data.size() >= int(sizeof(cacheMagic)) &&
+        std::memcmp(data.constData(), cacheMagic, sizeof(cacheMagic)) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheFileWriter
+////////////////////////////////////////////////////////////////////////////////
+
+CacheFileWriter::CacheFileWriter()
+{
+    // Index 0 is reserved for the empty string.
+    m_stringIndex.append(CacheStringEntry { 0, 0 });
+    m_stringIds.insert(QString(), 0);
+}
+
+void CacheFileWriter::reserve(int trackCount)
+{
+    m_paths.reserve(trackCount);
+    m_records.reserve(trackCount);
+    m_stringIds.reserve(trackCount * 2);
+    m_stringIndex.reserve(trackCount * 2);
+}
+
+void CacheFileWriter::addTrack(const QString &path, const CacheTrackRecord &record,
+                               const QString &title, const QString &artist, const QString &album,
+                               const QString &genre, const QString &comment)
+{
+    CacheTrackRecord stored = record;
+
+    stored.title   = addString(title);
+    stored.artist  = addString(artist);
+    stored.album   = addString(album);
+    stored.genre   = addString(genre);
+    stored.comment = addString(comment);
+
+    m_paths.append(addString(path));
+    m_records.append(stored);
+}
+
+quint32 CacheFileWriter::addString(const QString &value)
+{
+    if(value.isEmpty())
+        return 0;
+
+    const auto it = m_stringIds.constFind(value);
+    if(it != m_stringIds.constEnd())
+        return it.value();
+
+    const quint32 id = quint32(m_stringIndex.size());
+    const quint32 offset = quint32(m_stringData.size() / sizeof(QChar));
+
+    m_stringIndex.append(CacheStringEntry { offset, quint32(value.size()) });
+    m_stringData.append(reinterpret_cast<const char *>(value.constData()),
+                        value.size() * int(sizeof(QChar)));
+    m_stringIds.insert(value, id);
+
+    return id;
+}
+
+bool CacheFileWriter::write(QIODevice *device) const
+{
+    CacheFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version     = quint32(Cache::playlistItemsCacheVersion);
+    header.byteOrder   = cacheByteOrder;
+    header.headerSize  = quint32(alignedTo8(sizeof(CacheFileHeader)));
+    header.recordSize  = sizeof(CacheTrackRecord);
+    header.trackCount  = quint32(m_records.size());
+    header.stringCount = quint32(m_stringIndex.size());
+    header.blockSize   = cacheBlockSize;
+
+    header.stringIndexOffset = header.headerSize;
+    header.stringDataOffset  = alignedTo8(header.stringIndexOffset +
+                                          quint64(m_stringIndex.size()) * sizeof(CacheStringEntry));
+    header.stringDataSize    = quint64(m_stringData.size());
+    header.pathsOffset       = alignedTo8(header.stringDataOffset + header.stringDataSize);
+    header.recordsOffset     = alignedTo8(header.pathsOffset +
+                                          quint64(m_paths.size()) * sizeof(quint32));
+    header.blockDigestsOffset = header.recordsOffset +
+        quint64(m_records.size()) * sizeof(CacheTrackRecord);
+
+    const quint64 bodySize = header.blockDigestsOffset - header.headerSize;
+    header.blockCount = quint32((bodySize + cacheBlockSize - 1) / cacheBlockSize);
+
+    // Everything after the header is assembled in one zero-filled buffer so
+    // that alignment padding is deterministic for the digests.
+
+    QByteArray payload(int(bodySize + quint64(header.blockCount) * digestSize), '\0');
+    const auto at = [&](quint64 fileOffset) {
+        return payload.data() + (fileOffset - header.headerSize);
+    };
+
+    std::memcpy(at(header.stringIndexOffset), m_stringIndex.constData(),
+                m_stringIndex.size() * sizeof(CacheStringEntry));
+    std::memcpy(at(header.stringDataOffset), m_stringData.constData(),
+                m_stringData.size());
+    std::memcpy(at(header.pathsOffset), m_paths.constData(),
+                m_paths.size() * sizeof(quint32));
+    std::memcpy(at(header.recordsOffset), m_records.constData(),
+                m_records.size() * sizeof(CacheTrackRecord));
+
+    const auto body = reinterpret_cast<const uchar *>(payload.constData());
+    char *digests = at(header.blockDigestsOffset);
+
+    for(quint32 block = 0; block < header.blockCount; ++block) {
+        const quint64 start = quint64(block) * cacheBlockSize;
+        const QByteArray blockDigest = digest(body + start, qMin<quint64>(cacheBlockSize, bodySize - start));
+        std::memcpy(digests + quint64(block) * digestSize, blockDigest.constData(), digestSize);
+    }
+
+    const QByteArray digestsDigest = digest(reinterpret_cast<const uchar *>(digests),
+                                            quint64(header.blockCount) * digestSize);
+    std::memcpy(header.blockDigestsDigest, digestsDigest.constData(), digestSize);
+
+    const QByteArray ownDigest = headerDigest(header);
+    std::memcpy(header.headerDigest, ownDigest.constData(), digestSize);
+
+    QByteArray headerBytes(int(header.headerSize), '\0');
+    std::memcpy(headerBytes.data(), &header, sizeof(header));
+
+    return device->write(headerBytes) == headerBytes.size() &&
+           device->write(payload) == payload.size();
+}
+
+bool CacheFileWriter::save(const QString &fileName) const
+{
+    QSaveFile f(fileName);
+
+    if(!f.open(QIODevice::WriteOnly)) {
+        qCCritical(JUK_LOG) << "Error saving cache:" << f.errorString();
+        return false;
+    }
+
+    if(!write(&f)) {
+        qCCritical(JUK_LOG) << "Error saving cache:" << f.errorString();
+        f.cancelWriting();
+        return false;
+    }
+
+    if(!f.commit()) {
+        qCCritical(JUK_LOG) << "Error saving cache:" << f.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,252 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHEFILE_H
+#define JUK_CACHEFILE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <cstddef>
+
+class QIODevice;
+
+/**
+ * On-disk layout of the collection cache (see Cache::playlistItemsCacheVersion).
+ *
+ * The file is a fixed size header followed by a string index, the string data,
+ * the path of each track, an array of fixed width track records and finally
+ * a table of block digests.  Every tag string is stored exactly once as native
+ * endian UTF-16 and referred to by its index, so the whole file can be mapped
+ * and used in place.
+ *
+ * Everything between the header and the digest table is split into blocks of
+ * blockSize bytes, each with its own MD5 digest.  A damaged block only costs
+ * the tracks that have data in it: if their path is intact they are read from
+ * disk again, otherwise they are dropped (and found again by the folder scan).
+ * Paths are kept apart from the records so that a damaged record block still
+ * leaves the paths of its tracks usable.
+ */
+
+struct CacheFileHeader
+{
+    char    magic[8];          ///< "JuKCache"
+    quint32 version;           ///< Cache::playlistItemsCacheVersion
+    quint32 byteOrder;         ///< 0x01020304 as written by the saving host
+    quint32 headerSize;
+    quint32 recordSize;        ///< sizeof(CacheTrackRecord) when it was written
+    quint32 trackCount;
+    quint32 stringCount;
+    quint64 stringIndexOffset; ///< stringCount CacheStringEntry items
+    quint64 stringDataOffset;
+    quint64 stringDataSize;    ///< In bytes
+    quint64 pathsOffset;       ///< trackCount string indices
+    quint64 recordsOffset;     ///< trackCount CacheTrackRecord items
+    quint64 blockDigestsOffset; ///< blockCount MD5 digests
+    quint32 blockSize;
+    quint32 blockCount;
+    char    blockDigestsDigest[16]; ///< MD5 of the digest table
+    char    headerDigest[16];  ///< MD5 of the header with this field zeroed
+};
+
+struct CacheStringEntry
+{
+    quint32 offset;            ///< In QChar units from the start of the string data
+    quint32 length;            ///< In QChar units
+};
+
+/**
+ * One track in the collection.  String members are indices into the string
+ * table, index 0 is always the empty string.
+ */
+struct CacheTrackRecord
+{
+    enum Flags {
+        AudioPropertiesRead = 0x1  ///< seconds and bitrate are known
+    };
+
+    quint32 title;
+    quint32 artist;
+    quint32 album;
+    quint32 genre;
+    quint32 comment;
+    qint32  track;
+    qint32  year;
+    qint32  seconds;
+    qint32  bitrate;
+    quint16 flags;             ///< Flags, since version 7
+    quint16 fileType;          ///< MediaFiles::FileType, since version 7
+    qint64  modificationTime;  ///< msecs since the epoch (UTC), -1 if unknown
+    qint64  size;              ///< In bytes, -1 if unknown, since version 5
+    quint64 inode;             ///< 0 if unknown, since version 5
+    quint64 id;                ///< FileHandle::persistentId(), since version 6
+};
+
+/**
+ * Read-only view of the string table of a mapped cache file.  Strings are
+ * handed out with QString::fromRawData() so the character data is never
+ * copied, which means the mapping must outlive every string returned.
+ * Each string is only wrapped once, so repeated artist, album and genre
+ * names share a single QString.  Tags loaded from the cache keep referring
+ * to the table, see Tag.
+ */
+class CacheStringTable
+{
+public:
+    CacheStringTable();
+
+    void reset(const uchar *index, const uchar *data, quint32 count, quint64 dataSize);
+
+    quint32 count() const { return m_count; }
+
+    /**
+     * Returns string @p id, wrapping it only the first time.  Not thread-safe.
+     */
+    QString string(quint32 id) const;
+
+    /**
+     * Like string(), but does not remember the result, so it may be used
+     * from the loading thread while the GUI thread uses string().
+     */
+    QString unsharedString(quint32 id) const;
+
+private:
+    const CacheStringEntry *m_index;
+    const QChar *m_data;
+    quint32 m_count;
+    quint64 m_dataLength;
+    mutable QVector<QString> m_resolved;
+};
+
+/**
+ * Validates and provides access to a memory-mapped cache file.  No data is
+ * copied out of the mapping.  The header is checked up front, the blocks
+ * holding the tracks are checked as the tracks are accessed.
+ */
+class CacheFileView
+{
+public:
+    CacheFileView();
+
+    /**
+     * Checks the header and the layout of the @p size bytes at @p data.
+     * Returns false (and leaves the view empty) if anything is wrong.
+     */
+    bool open(const uchar *data, qint64 size);
+    void close();
+
+    bool isOpen() const { return m_header != nullptr; }
+    quint32 version() const;
+    quint32 trackCount() const;
+
+    /**
+     * Returns the path of the track at @p index, or a null string if it was
+     * damaged.
+     */
+    QString trackPath(quint32 index) const;
+
+    /**
+     * Returns true if the record of the track at @p index and every string
+     * it refers to are undamaged.
+     */
+    bool isTrackIntact(quint32 index) const;
+
+    /**
+     * Returns the record of the track at @p index.  Members that the version
+     * of the file did not have yet are set to their "unknown" value, and the
+     * flags are guessed from the other members.
+     */
+    const CacheTrackRecord &track(quint32 index) const
+    {
+        return *reinterpret_cast<const CacheTrackRecord *>(m_records + quint64(index) * sizeof(CacheTrackRecord));
+    }
+
+    const CacheStringTable &strings() const { return m_strings; }
+
+    /**
+     * The number of damaged blocks found so far.
+     */
+    int damagedBlockCount() const { return m_damagedBlocks; }
+
+    /**
+     * Returns true if @p data starts with the magic of the mapped format, to
+     * tell it apart from the QDataStream based formats of earlier versions.
+     */
+    static bool hasMagic(const QByteArray &data);
+
+private:
+    bool isRangeIntact(quint64 offset, quint64 size) const;
+    bool isBlockIntact(quint32 block) const;
+    bool isStringIntact(quint32 id) const;
+
+    static quint32 recordSize(quint32 version);
+
+    const uchar *m_data;
+    const CacheFileHeader *m_header;
+    const quint32 *m_paths;
+    const uchar *m_records;
+    quint32 m_recordSize;
+    CacheStringTable m_strings;
+
+    // Records of older versions, copied into the current layout
+    QVector<CacheTrackRecord> m_upgradedRecords;
+
+    // Verified lazily: 0 is unchecked, 1 intact, -1 damaged
+    mutable QVector<qint8> m_blockState;
+    mutable int m_damagedBlocks;
+};
+
+/**
+ * Builds a cache file in memory, deduplicating strings as tracks are added.
+ */
+class CacheFileWriter
+{
+public:
+    CacheFileWriter();
+
+    void reserve(int trackCount);
+
+    /**
+     * Adds the track at @p path.  The string members of @p record are
+     * ignored, the strings are added to the string table instead.
+     */
+    void addTrack(const QString &path, const CacheTrackRecord &record,
+                  const QString &title, const QString &artist, const QString &album,
+                  const QString &genre, const QString &comment);
+
+    bool write(QIODevice *device) const;
+
+    /**
+     * Atomically replaces @p fileName with the cache built so far.  Does not
+     * touch any GUI state, so it may be run from a worker thread.
+     */
+    bool save(const QString &fileName) const;
+
+private:
+    quint32 addString(const QString &value);
+
+    QHash<QString, quint32> m_stringIds;
+    QVector<CacheStringEntry> m_stringIndex;
+    QByteArray m_stringData;
+    QVector<quint32> m_paths;
+    QVector<CacheTrackRecord> m_records;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
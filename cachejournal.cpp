@@ -0,0 +1,326 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachejournal.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QtConcurrent>
+
+#include "cache.h"
+#include "cachefile.h"
+#include "cachejournalformat.h"
+#include "juk_debug.h"
+
+// Don't bother compacting journals smaller than this, however small the
+// collection is.
+static const qint64 minimumCompactionSize = 1024 * 1024;
+
+enum JournalOperation
+{
+    UpdateTrack = 1,
+    RemoveTrack = 2
+};
+
+CacheJournal::CacheJournal(QObject *parent) :
+    QObject(parent),
+    m_validSize(0),
+    m_cacheSize(0),
+    m_compactedSize(-1),
+    m_compactionRequested(false),
+    m_compactionWatcher(new QFutureWatcher<bool>(this))
+{
+    connect(m_compactionWatcher, SIGNAL(finished()), SLOT(slotCompactionFinished()));
+}
+
+CacheJournal::~CacheJournal()
+{
+    close();
+}
+
+QString CacheJournal::fileName() // static
+{
+    return Cache::fileHandleCacheFileName() + ".journal";
+}
+
+QHash<QString, FileHandle> CacheJournal::replay()
+{
+    QHash<QString, FileHandle> entries;
+    m_validSize = 0;
+
+    QFile f(fileName());
+    if(!f.open(QIODevice::ReadOnly) || f.size() == 0)
+        return entries;
+
+    QDataStream s(&f);
+
+    // Version 1 entries lack the persistent ID of updated tracks, versions 1
+    // and 2 whether their audio properties were read, versions 1 to 3 the
+    // size and inode the tag was read at.
+    const qint32 version = CacheJournalFormat::readHeader(s);
+    if(version == 0) {
+        qCWarning(JUK_LOG) << "Ignoring cache journal from an unknown version.";
+        return entries;
+    }
+
+    m_validSize = f.pos();
+    int count = 0;
+    QByteArray payload;
+
+    while(CacheJournalFormat::readEntry(s, &payload)) {
+        QBuffer buffer(&payload);
+        buffer.open(QIODevice::ReadOnly);
+
+        CacheDataStream ps(&buffer);
+        ps.setVersion(CacheDataStream::Qt_4_3);
+        ps.setCacheVersion(1);
+
+        qint8 operation;
+        QString path;
+        ps >> operation >> path;
+
+        if(operation == UpdateTrack) {
+            quint64 id = 0;
+            if(version >= 2)
+                ps >> id;
+
+            FileHandle file(path, ps);
+            file.setPersistentId(id);
+
+            // Otherwise Tag::read() guesses from the length and bitrate
+            bool hasAudioProperties = false;
+            if(version >= 3)
+                ps >> hasAudioProperties;
+            if(hasAudioProperties && file.fileInfo().exists() && !file.tag()->hasAudioProperties())
+                file.tag()->setAudioProperties(file.tag()->seconds(), file.tag()->bitrate());
+
+            // Otherwise the size found on disk now is taken, which hides
+            // changes made since.
+            if(version >= 4) {
+                qint64 size;
+                quint64 inode;
+                ps >> size >> inode;
+                file.setBaseFileStatus(size, inode);
+            }
+
+            // If the file is gone by now it would just be removed again
+            if(ps.status() == QDataStream::Ok && file.fileInfo().exists())
+                entries.insert(path, file);
+            else
+                entries.insert(path, FileHandle());
+        }
+        else if(operation == RemoveTrack)
+            entries.insert(path, FileHandle());
+
+        m_validSize = f.pos();
+        ++count;
+    }
+
+    if(m_validSize < f.size())
+        qCWarning(JUK_LOG) << "Dropping incomplete entries at the end of the cache journal.";
+
+    qCDebug(JUK_LOG) << "Replayed" << count << "entries from the cache journal";
+
+    // Start a new journal rather than appending to one of the old version.
+    // Its entries go into the cache, which is from an old version as well and
+    // gets rewritten once loaded.
+    if(version != CacheJournalFormat::currentVersion)
+        m_validSize = 0;
+
+    return entries;
+}
+
+bool CacheJournal::open()
+{
+    if(m_file.isOpen())
+        return true;
+
+    m_file.setFileName(fileName());
+    if(!m_file.open(QIODevice::ReadWrite)) {
+        qCCritical(JUK_LOG) << "Unable to open cache journal:" << m_file.errorString();
+        return false;
+    }
+
+    if(m_validSize < CacheJournalFormat::headerSize) {
+        m_file.resize(0);
+        m_file.write(CacheJournalFormat::header());
+    }
+    else
+        m_file.resize(m_validSize);
+
+    m_file.seek(m_file.size());
+    m_file.flush();
+
+    m_cacheSize = QFileInfo(Cache::fileHandleCacheFileName()).size();
+
+    // Anything left over from the last session is folded into the cache
+    // right away.
+    if(m_file.size() > CacheJournalFormat::headerSize)
+        requestCompaction();
+
+    return true;
+}
+
+void CacheJournal::close()
+{
+    if(!m_file.isOpen())
+        return;
+
+    if(isCompacting()) {
+        m_compactionWatcher->waitForFinished();
+        slotCompactionFinished();
+    }
+
+    m_file.close();
+}
+
+void CacheJournal::clear()
+{
+    m_validSize = 0;
+    discardEntriesBefore(m_file.isOpen() ? m_file.size() : 0);
+}
+
+void CacheJournal::recordUpdate(const FileHandle &file)
+{
+    if(!m_file.isOpen() || file.isNull())
+        return;
+
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    s << qint8(UpdateTrack)
+      << file.absFilePath()
+      << quint64(file.persistentId())
+      << file
+      << file.tag()->hasAudioProperties()
+      << file.baseSize()
+      << file.baseInode();
+
+    append(payload);
+}
+
+void CacheJournal::recordRemoval(const QString &path)
+{
+    if(!m_file.isOpen() || path.isEmpty())
+        return;
+
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    s << qint8(RemoveTrack)
+      << path;
+
+    append(payload);
+}
+
+void CacheJournal::compact(CacheFileWriter *snapshot)
+{
+    if(isCompacting() || !m_file.isOpen()) {
+        delete snapshot;
+        return;
+    }
+
+    // The snapshot covers everything journaled so far, entries appended while
+    // it is being written have to stay.
+    m_compactedSize = m_file.size();
+
+    const QString cacheFileName = Cache::fileHandleCacheFileName();
+    m_compactionWatcher->setFuture(QtConcurrent::run([snapshot, cacheFileName]() {
+        QScopedPointer<CacheFileWriter> writer(snapshot);
+        return writer->save(cacheFileName);
+    }));
+}
+
+bool CacheJournal::isCompacting() const
+{
+    return m_compactedSize >= 0;
+}
+
+void CacheJournal::slotCompactionFinished()
+{
+    // May already have been handled by close()
+    if(m_compactedSize < 0)
+        return;
+
+    const qint64 compactedSize = m_compactedSize;
+    m_compactedSize = -1;
+    m_compactionRequested = false;
+
+    if(!m_compactionWatcher->result()) {
+        qCWarning(JUK_LOG) << "Unable to compact the cache journal, keeping it.";
+        return;
+    }
+
+    m_cacheSize = QFileInfo(Cache::fileHandleCacheFileName()).size();
+    discardEntriesBefore(compactedSize);
+}
+
+void CacheJournal::append(const QByteArray &payload)
+{
+    // One write per entry keeps a torn entry detectable by its checksum.
+    const QByteArray framed = CacheJournalFormat::entry(payload);
+    if(m_file.write(framed) != framed.size() || !m_file.flush()) {
+        qCCritical(JUK_LOG) << "Error writing cache journal:" << m_file.errorString();
+        return;
+    }
+
+    if(!m_compactionRequested &&
+       m_file.size() > qMax(minimumCompactionSize, m_cacheSize / 2))
+    {
+        requestCompaction();
+    }
+}
+
+void CacheJournal::requestCompaction()
+{
+    m_compactionRequested = true;
+
+    // Queued so that a burst of changes (e.g. a folder scan) finishes first.
+    QMetaObject::invokeMethod(this, "compactionNeeded", Qt::QueuedConnection);
+}
+
+void CacheJournal::discardEntriesBefore(qint64 offset)
+{
+    const bool wasOpen = m_file.isOpen();
+
+    QByteArray remaining;
+    if(wasOpen) {
+        m_file.flush();
+        if(offset < m_file.size() && m_file.seek(qMax(offset, CacheJournalFormat::headerSize)))
+            remaining = m_file.readAll();
+        m_file.close();
+    }
+
+    QSaveFile f(fileName());
+    if(!f.open(QIODevice::WriteOnly) ||
+       f.write(CacheJournalFormat::header()) != CacheJournalFormat::headerSize ||
+       f.write(remaining) != remaining.size() ||
+       !f.commit())
+    {
+        qCCritical(JUK_LOG) << "Error rewriting cache journal:" << f.errorString();
+    }
+
+    if(wasOpen && m_file.open(QIODevice::ReadWrite))
+        m_file.seek(m_file.size());
+}
+
+// vim: set et sw=4 tw=0 sta:
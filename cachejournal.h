@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHEJOURNAL_H
+#define JUK_CACHEJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+#include "filehandle.h"
+
+class CacheFileWriter;
+
+template<class T>
+class QFutureWatcher;
+
+/**
+ * Write-ahead log of changes to the collection made since the collection
+ * cache was last written.  Each added, retagged or removed track is appended
+ * (and flushed) as it happens, so a crash loses nothing and quitting does not
+ * need to rewrite the whole cache.
+ *
+ * Once the journal grows large compared to the cache, compactionNeeded() is
+ * emitted, and the owner should pass a snapshot of the collection to
+ * compact().  The snapshot is written in a worker thread, after which the
+ * entries it covers are dropped from the journal.
+ *
+ * Entries are checksummed individually, so a partially written entry at the
+ * end (for instance after a crash) is simply dropped on the next start.
+ */
+class CacheJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CacheJournal(QObject *parent = nullptr);
+    virtual ~CacheJournal();
+
+    static QString fileName();
+
+    /**
+     * Reads the journal left over from the previous session.  Later entries
+     * replace earlier ones for the same file, and removed files map to a null
+     * FileHandle.  Must be called before open().
+     */
+    QHash<QString, FileHandle> replay();
+
+    /**
+     * Opens the journal for appending, dropping anything replay() could not
+     * read.  Until this is called, changes are not recorded.
+     */
+    bool open();
+
+    /**
+     * Waits for a running compaction and closes the journal.  Changes made
+     * afterwards are not recorded.
+     */
+    void close();
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    /**
+     * Drops every entry, for use after the complete cache has been written.
+     */
+    void clear();
+
+    void recordUpdate(const FileHandle &file);
+    void recordRemoval(const QString &path);
+
+    /**
+     * Writes @p snapshot (which is deleted afterwards) as the new collection
+     * cache in the background and then drops the entries it supersedes.
+     */
+    void compact(CacheFileWriter *snapshot);
+    bool isCompacting() const;
+
+signals:
+    void compactionNeeded();
+
+private slots:
+    void slotCompactionFinished();
+
+private:
+    void append(const QByteArray &payload);
+    void requestCompaction();
+    void discardEntriesBefore(qint64 offset);
+
+    QFile m_file;
+    qint64 m_validSize;
+    qint64 m_cacheSize;
+    qint64 m_compactedSize;
+    bool m_compactionRequested;
+    QFutureWatcher<bool> *m_compactionWatcher;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachejournalformat.h"
+
+#include <QDataStream>
+#include <QIODevice>
+
+static const quint32 journalMagic = 0x4A754B4A; // "JuKJ"
+
+static_assert(CacheJournalFormat::headerSize == sizeof(journalMagic) + sizeof(CacheJournalFormat::currentVersion),
+              "The header is the magic and the version");
+
+QByteArray CacheJournalFormat::header()
+{
+    QByteArray header;
+    QDataStream s(&header, QIODevice::WriteOnly);
+    s << journalMagic << currentVersion;
+
+    return header;
+}
+
+qint32 CacheJournalFormat::readHeader(QDataStream &s)
+{
+    quint32 magic;
+    qint32 version;
+    s >> magic >> version;
+
+    if(s.status() != QDataStream::Ok || magic != journalMagic ||
+       version < 1 || version > currentVersion)
+    {
+        return 0;
+    }
+
+    return version;
+}
+
+QByteArray CacheJournalFormat::entry(const QByteArray &payload)
+{
+    QByteArray entry;
+    QDataStream s(&entry, QIODevice::WriteOnly);
+
+    s << quint32(payload.size())
+      << qChecksum(payload.constData(), payload.size());
+    s.writeRawData(payload.constData(), payload.size());
+
+    return entry;
+}
+
+bool CacheJournalFormat::readEntry(QDataStream &s, QByteArray *payload)
+{
+    if(s.atEnd())
+        return false;
+
+    quint32 size;
+    quint16 checksum;
+    s >> size >> checksum;
+
+    const QIODevice *device = s.device();
+    if(s.status() != QDataStream::Ok || qint64(size) > device->size() - device->pos())
+        return false;
+
+    payload->resize(int(size));
+    return s.readRawData(payload->data(), int(size)) == int(size) &&
+           checksum == qChecksum(payload->constData(), size);
+}
+
+// vim: set et sw=4 tw=0 sta:
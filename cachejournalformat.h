@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHEJOURNALFORMAT_H
+#define JUK_CACHEJOURNALFORMAT_H
+
+#include <QByteArray>
+
+class QDataStream;
+
+/**
+ * The framing of the cache journal, see CacheJournal.  The journal starts
+ * with a header giving its version, followed by entries of a size, a checksum
+ * and the payload.  What the payloads hold is up to CacheJournal.
+ */
+namespace CacheJournalFormat
+{
+    /**
+     * The version written by header().
+     * 1: Original version.
+     * 2: Updated tracks have their persistent ID.
+     * 3: Updated tracks tell whether their audio properties were read.
+     * 4: Updated tracks have their size and inode.
+     */
+    const qint32 currentVersion = 4;
+
+    const qint64 headerSize = 8;
+
+    QByteArray header();
+
+    /**
+     * Reads the header from @p s and returns the version of the journal, or
+     * 0 if it is not a journal of a known version.
+     */
+    qint32 readHeader(QDataStream &s);
+
+    /**
+     * Returns @p payload framed as a journal entry, to be written at once.
+     */
+    QByteArray entry(const QByteArray &payload);
+
+    /**
+     * Reads the next entry from @p s into @p payload.  Returns false at the
+     * end of the journal and at an entry that is incomplete or damaged, in
+     * which case everything from there on should be dropped.
+     */
+    bool readEntry(QDataStream &s, QByteArray *payload);
+}
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
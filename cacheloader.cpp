@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cacheloader.h"
+
+#include <QElapsedTimer>
+
+#include "cache.h"
+
+CacheLoader::CacheLoader(QObject *parent)
+    : QObject(parent)
+    , m_decodeTime(0)
+{
+}
+
+void CacheLoader::startLoading()
+{
+    static const int BATCH_SIZE = 2048;
+
+    Cache *cache = Cache::instance();
+    FileHandleList items;
+    items.reserve(BATCH_SIZE);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    for(FileHandle item = cache->loadNextCachedItem();
+        !item.isNull();
+        item = cache->loadNextCachedItem())
+    {
+        items << item;
+
+        if(items.count() >= BATCH_SIZE) {
+            emit loadedItems(items);
+            items.clear();
+            items.reserve(BATCH_SIZE);
+        }
+    }
+
+    if(!items.isEmpty()) {
+        emit loadedItems(items);
+    }
+
+    m_decodeTime = timer.elapsed();
+}
+
+// vim: set et sw=4 tw=0 sta:
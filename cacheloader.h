@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHELOADER_H
+#define JUK_CACHELOADER_H
+
+#include <QObject>
+
+#include "filehandle.h"
+
+/**
+ * Decodes the items of the collection cache, emitting them in large batches
+ * so that the GUI thread can insert each batch at once.  Intended for use in
+ * a separate thread as a worker object, after
+ * Cache::prepareToLoadCachedItems() has succeeded.
+ */
+class CacheLoader : public QObject {
+    Q_OBJECT
+
+public:
+    explicit CacheLoader(QObject *parent = nullptr);
+
+    /**
+     * Time spent decoding in startLoading(), in milliseconds.  Only valid
+     * once loading has finished.
+     */
+    qint64 decodeTime() const { return m_decodeTime; }
+
+public slots:
+    void startLoading();
+
+signals:
+    void loadedItems(FileHandleList items);
+
+private:
+    qint64 m_decodeTime;
+};
+
+#endif // JUK_CACHELOADER_H
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,233 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachevalidator.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Files checked per work item.  Small enough to spread a collection over the
+// thread pool, large enough for most chunks to cover whole directories.
+static const int CHUNK_SIZE = 512;
+
+namespace {
+
+enum FileState
+{
+    FileFound,
+    FileMissing,
+    FileUnknown  ///< Could not be checked (e.g. permissions), leave it alone
+};
+
+struct FileStatus
+{
+    qint64 modificationTime;
+    qint64 size;
+    quint64 inode;
+};
+
+#ifdef Q_OS_UNIX
+
+/**
+ * Looks up files relative to the handle of their directory, which is only
+ * reopened when the directory changes.  Saves resolving the full path of
+ * every file of an album again.
+ */
+class DirectoryStat
+{
+public:
+    DirectoryStat() : m_fd(-1) {}
+    ~DirectoryStat() { closeDirectory(); }
+
+    FileState stat(const QString &path, FileStatus *status)
+    {
+        const QByteArray encodedPath = QFile::encodeName(path);
+        const int slash = encodedPath.lastIndexOf('/');
+
+        if(slash < 0)
+            return FileUnknown;
+
+        const QByteArray directory = encodedPath.left(qMax(slash, 1));
+
+        if(directory != m_directory) {
+            closeDirectory();
+            m_directory = directory;
+            m_fd = ::open(directory.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+
+        struct stat st;
+        const int result = m_fd >= 0
+            ? ::fstatat(m_fd, encodedPath.constData() + slash + 1, &st, 0)
+            : ::stat(encodedPath.constData(), &st);
+
+        if(result != 0)
+            return (errno == ENOENT || errno == ENOTDIR) ? FileMissing : FileUnknown;
+
+        if(!S_ISREG(st.st_mode))
+            return FileMissing;
+
+#ifdef Q_OS_DARWIN
+        const struct timespec &modified = st.st_mtimespec;
+#else
+        const struct timespec &modified = st.st_mtim;
+#endif
+
+        status->modificationTime = qint64(modified.tv_sec) * 1000 + modified.tv_nsec / 1000000;
+        status->size = st.st_size;
+        status->inode = st.st_ino;
+
+        return FileFound;
+    }
+
+private:
+    void closeDirectory()
+    {
+        if(m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+    }
+
+    QByteArray m_directory;
+    int m_fd;
+};
+
+#else
+
+class DirectoryStat
+{
+public:
+    FileState stat(const QString &path, FileStatus *status)
+    {
+        const QFileInfo fileInfo(path);
+
+        if(!fileInfo.exists() || !fileInfo.isFile())
+            return FileMissing;
+
+        status->modificationTime = fileInfo.lastModified().toMSecsSinceEpoch();
+        status->size = fileInfo.size();
+        status->inode = 0;
+
+        return FileFound;
+    }
+};
+
+#endif
+
+} // namespace
+
+CacheValidator::CacheValidator(const FileHandleList &files, QObject *parent)
+    : QObject(parent)
+    , m_files(files)
+{
+    m_entries.reserve(files.count());
+
+    for(int i = 0; i < files.count(); ++i) {
+        const FileHandle &file = files[i];
+        const QDateTime modified = file.baseModificationTime();
+
+        m_entries.append(Entry {
+            file.absFilePath(),
+            modified.isValid() ? modified.toMSecsSinceEpoch() : -1,
+            file.baseSize(),
+            file.baseInode(),
+            i
+        });
+    }
+}
+
+void CacheValidator::startValidating()
+{
+    // Keep the files of a directory together.
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry &a, const Entry &b) {
+        return a.path < b.path;
+    });
+
+    QVector<QPair<int, int>> chunks;
+    for(int begin = 0; begin < m_entries.count(); begin += CHUNK_SIZE)
+        chunks.append(qMakePair(begin, qMin(begin + CHUNK_SIZE, m_entries.count())));
+
+    QtConcurrent::blockingMap(chunks, [this](const QPair<int, int> &chunk) {
+        checkEntries(chunk.first, chunk.second);
+    });
+}
+
+void CacheValidator::checkEntries(int begin, int end)
+{
+    if(isCancelled())
+        return;
+
+    FileHandleList stale;
+    FileHandleList missing;
+    FileHandleList found;
+    QVector<CacheFileStatus> foundStatus;
+
+    DirectoryStat directory;
+
+    for(int i = begin; i < end; ++i) {
+        const Entry &entry = m_entries[i];
+        FileStatus status;
+
+        switch(directory.stat(entry.path, &status)) {
+        case FileMissing:
+            missing.append(m_files[entry.file]);
+            break;
+        case FileFound:
+            if(entry.modificationTime < 0 ||
+               entry.modificationTime != status.modificationTime ||
+               (entry.size >= 0 && entry.size != status.size) ||
+               (entry.inode != 0 && status.inode != 0 && entry.inode != status.inode))
+            {
+                stale.append(m_files[entry.file]);
+            }
+            else if(entry.size < 0 || (entry.inode == 0 && status.inode != 0)) {
+                found.append(m_files[entry.file]);
+                foundStatus.append(CacheFileStatus { status.size, status.inode });
+            }
+            break;
+        case FileUnknown:
+            break;
+        }
+    }
+
+    if(!stale.isEmpty()) {
+        m_staleCount.fetchAndAddOrdered(stale.count());
+        emit staleFiles(stale);
+    }
+
+    if(!missing.isEmpty()) {
+        m_missingCount.fetchAndAddOrdered(missing.count());
+        emit missingFiles(missing);
+    }
+
+    if(!found.isEmpty())
+        emit fileStatusFound(found, foundStatus);
+
+    const int checked = m_checkedCount.fetchAndAddOrdered(end - begin) + (end - begin);
+    emit progress(checked, m_entries.count());
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHEVALIDATOR_H
+#define JUK_CACHEVALIDATOR_H
+
+#include <QAtomicInt>
+#include <QMetaType>
+#include <QObject>
+#include <QVector>
+
+#include "filehandle.h"
+
+/**
+ * The size and inode of a file as found on disk by CacheValidator.
+ */
+struct CacheFileStatus
+{
+    qint64 size;
+    quint64 inode;
+};
+
+Q_DECLARE_METATYPE(CacheFileStatus);
+
+/**
+ * Checks whether the files loaded from the collection cache are still current
+ * by comparing their stored modification time, size and inode against the
+ * disk, without reading any tags.  The files are sorted by path and split into
+ * chunks which are checked in parallel, each chunk looking up the files of a
+ * directory relative to a single directory handle.
+ *
+ * Only the files that need attention are reported back, in one batch per
+ * chunk.  Intended for use in a separate thread as a worker object, see
+ * CacheLoader.  The FileHandles must not be modified until validation has
+ * finished, other than by the receivers of the signals below.
+ */
+class CacheValidator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CacheValidator(const FileHandleList &files, QObject *parent = nullptr);
+
+    int fileCount() const { return m_files.count(); }
+    int staleCount() const { return m_staleCount.loadAcquire(); }
+    int missingCount() const { return m_missingCount.loadAcquire(); }
+
+    /**
+     * Stops validation after the chunks currently being checked.  Thread-safe.
+     */
+    void cancel() { m_cancelled.storeRelease(1); }
+    bool isCancelled() const { return m_cancelled.loadAcquire() != 0; }
+
+public slots:
+    void startValidating();
+
+signals:
+    /**
+     * Emitted for files that changed since their tag was read.
+     */
+    void staleFiles(FileHandleList files);
+
+    /**
+     * Emitted for files that no longer exist or are no longer regular files.
+     */
+    void missingFiles(FileHandleList files);
+
+    /**
+     * Emitted for current files whose size or inode was not known yet, so that
+     * they can be stored in the cache for the next check.
+     */
+    void fileStatusFound(FileHandleList files, QVector<CacheFileStatus> status);
+
+    void progress(int checked, int total);
+
+private:
+    struct Entry
+    {
+        QString path;
+        qint64 modificationTime;
+        qint64 size;
+        quint64 inode;
+        int file;
+    };
+
+    void checkEntries(int begin, int end);
+
+    FileHandleList m_files;
+    QVector<Entry> m_entries;
+    QAtomicInt m_cancelled;
+    QAtomicInt m_checkedCount;
+    QAtomicInt m_staleCount;
+    QAtomicInt m_missingCount;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -36,12 +36,29 @@
 #include <QHeaderView>
 #include <QSaveFile>
 #include <QElapsedTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QThread>
+#include <QThreadPool>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
 
 #include "playlistcollection.h"
 #include "stringshare.h"
 #include "cache.h"
+#include "cachefile.h"
+#include "cacheloader.h"
+#include "cachevalidator.h"
 #include "actioncollection.h"
 #include "juktag.h"
+#include "librarywatcher.h"
+#include "mediafiles.h"
 #include "viewmode.h"
 #include "juk_debug.h"
 
@@ -58,8 +75,102 @@ CollectionList *CollectionList::instance()
     return m_list;
 }
 
+namespace {
+
+/**
+ * A file reported by the LibraryWatcher, as read by readLibraryFile().
+ */
+struct LibraryFile
+{
+    QString path;
+    FileHandle file;  ///< Null if there is nothing to update
+    bool missing;
+};
+
+} // namespace
+
+// Reads the tag of a new or changed file unless it still has the modification
+// time the collection knows.  Runs in the global thread pool.
+static LibraryFile readLibraryFile(const QPair<QString, qint64> &file)
+{
+    LibraryFile result { file.first, FileHandle(), false };
+    const QFileInfo fileInfo(file.first);
+
+    if(!fileInfo.isFile()) {
+        result.missing = !fileInfo.exists();
+        return result;
+    }
+
+    if(file.second >= 0 && fileInfo.lastModified().toMSecsSinceEpoch() == file.second)
+        return result;
+
+    const MediaFiles::FileType fileType = MediaFiles::fileType(file.first);
+    if(!fileInfo.isReadable() || !MediaFiles::isMediaType(fileType))
+        return result;
+
+    result.file = FileHandle(fileInfo, fileType);
+    result.file.scanTag();
+
+    return result;
+}
+
+// Rereads the tag of a file that changed since it was cached, into a new
+// FileHandle so that the one shown stays untouched until the GUI thread swaps
+// it.  Runs in the global thread pool.
+static FileHandle readStaleFile(const FileHandle &file)
+{
+    FileHandle result(QFileInfo(file.absFilePath()), file.fileType());
+    result.tag();
+
+    return result;
+}
+
 static QElapsedTimer stopwatch;
 
+// Reads the audio properties left out by folder scans, a batch at a time on a
+// single thread of idle priority, so that everything else goes first.
+Q_GLOBAL_STATIC(QThreadPool, audioPropertiesPool)
+static const int AUDIO_PROPERTIES_BATCH_SIZE = 64;
+
+// Returns the resident set size of JuK in KiB, or -1 where it is unknown.
+// Used to keep an eye on the memory used by the loaded collection.
+static qint64 residentMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if(statm.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        if(fields.size() > 1)
+            return fields[1].toLongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+#endif
+
+    return -1;
+}
+
+static void addToCacheSnapshot(CacheFileWriter *writer, const FileHandle &file)
+{
+    const Tag *tag = file.tag();
+    const QDateTime modified = file.baseModificationTime();
+
+    CacheTrackRecord record;
+    std::memset(&record, 0, sizeof(record));
+
+    record.track   = tag->track();
+    record.year    = tag->year();
+    record.seconds = tag->seconds();
+    record.bitrate = tag->bitrate();
+    record.flags   = tag->hasAudioProperties() ? CacheTrackRecord::AudioPropertiesRead : 0;
+    record.fileType = quint16(file.fileType());
+    record.modificationTime = modified.isValid() ? modified.toMSecsSinceEpoch() : -1;
+    record.size    = file.baseSize();
+    record.inode   = file.baseInode();
+    record.id      = file.persistentId();
+
+    writer->addTrack(file.absFilePath(), record,
+                     tag->title(), tag->artist(), tag->album(), tag->genre(), tag->comment());
+}
+
 void CollectionList::startLoadingCachedItems()
 {
     if(!m_list)
@@ -67,6 +178,7 @@ void CollectionList::startLoadingCachedItems()
 
     qCDebug(JUK_LOG) << "Starting to load cached items";
     stopwatch.start();
+    m_cacheInsertTime = 0;
 
     if(!Cache::instance()->prepareToLoadCachedItems()) {
         qCCritical(JUK_LOG) << "Unable to setup to load cache... perhaps it doesn't exist?";
@@ -75,42 +187,79 @@ void CollectionList::startLoadingCachedItems()
         return;
     }
 
-    qCDebug(JUK_LOG) << "Kicked off first batch";
-    QTimer::singleShot(0, this, SLOT(loadNextBatchCachedItems()));
+    auto loader = new CacheLoader;
+
+    connect(loader, &CacheLoader::loadedItems, this, &CollectionList::insertCachedItems);
+
+    auto loadWatcher = new QFutureWatcher<void>(this);
+    connect(loadWatcher, &QFutureWatcher<void>::finished, this, [=]() {
+            qCDebug(JUK_LOG) << "Decoding the cache took" << loader->decodeTime() << "ms";
+
+            loader->deleteLater();
+            loadWatcher->deleteLater();
+
+            completedLoadingCachedItems();
+        });
+
+    loadWatcher->setFuture(QtConcurrent::run(loader, &CacheLoader::startLoading));
+    qCDebug(JUK_LOG) << "Kicked off cache loading thread";
 }
 
-void CollectionList::loadNextBatchCachedItems()
+void CollectionList::insertCachedItems(const FileHandleList &files)
 {
-    Cache *cache = Cache::instance();
-    bool done = false;
+    QElapsedTimer timer;
+    timer.start();
 
-    for(int i = 0; i < 20; ++i) {
-        FileHandle cachedItem(cache->loadNextCachedItem());
-
-        if(cachedItem.isNull()) {
-            done = true;
-            break;
-        }
+    QList<QTreeWidgetItem *> newItems;
+    newItems.reserve(files.count());
 
+    for(const auto &file : files) {
         // This may have already been created via a loaded playlist.
-        if(!m_itemsDict.contains(cachedItem.absFilePath())) {
-            CollectionListItem *newItem = new CollectionListItem(this, cachedItem);
-            setupItem(newItem);
-        }
-    }
+        if(m_pathIndex.contains(file.absFilePath()))
+            continue;
+
+        CollectionListItem *newItem = new CollectionListItem(file);
+        addToDict(file.absFilePath(), newItem);
+        newItems.append(newItem);
 
-    if(!done) {
-        QTimer::singleShot(0, this, SLOT(loadNextBatchCachedItems()));
+        // Left over from a scan that ended before they were read.
+        queueAudioPropertiesRead(file);
     }
-    else {
-        completedLoadingCachedItems();
+
+    // Insert the whole batch into the view at once, and only then fill in
+    // the items, which needs them to be in the view.
+
+    setBlockDataChanged(true);
+    addTopLevelItems(newItems);
+
+    for(const auto item : newItems) {
+        CollectionListItem *newItem = static_cast<CollectionListItem *>(item);
+        updateTotals(newItem, 1);
+        newItem->refresh();
+        setupItem(newItem);
     }
+
+    setBlockDataChanged(false);
+    playlistItemsChanged();
+
+    m_cacheInsertTime += timer.elapsed();
 }
 
 void CollectionList::completedLoadingCachedItems()
 {
-    // The CollectionList is created with sorting disabled for speed.  Re-enable
-    // it here, and perform the sort.
+    // Tracks with damaged cache data are read from disk again here, reading
+    // tags isn't safe from the loading thread.
+    const QStringList damagedPaths = Cache::instance()->takeDamagedPaths();
+    for(const QString &path : damagedPaths) {
+        if(QFileInfo::exists(path))
+            createItem(FileHandle(path));
+    }
+
+    // The CollectionList is created with sorting disabled for speed.  Sort it
+    // now; a large collection is sorted in the background and keeps sorting
+    // disabled, see Playlist::sortByColumn().  The cache is saved in the
+    // order of the view, so unless the collection changed since, this only
+    // finds that it is in order already.
     KConfigGroup config(KSharedConfig::openConfig(), "Playlists");
 
     Qt::SortOrder order = Qt::DescendingOrder;
@@ -120,7 +269,30 @@ void CollectionList::completedLoadingCachedItems()
     m_list->sortByColumn(config.readEntry("CollectionListSortColumn", 1), order);
 
     qCDebug(JUK_LOG) << "Finished loading cached items, took" << stopwatch.elapsed() << "ms";
-    qCDebug(JUK_LOG) << m_itemsDict.size() << "items are in the CollectionList";
+    qCDebug(JUK_LOG) << "Inserting cached items took" << m_cacheInsertTime << "ms";
+    qCDebug(JUK_LOG) << "Resident memory after loading the collection:" << residentMemory() << "KiB";
+    qCDebug(JUK_LOG) << m_itemsById.size() << "items are in the CollectionList";
+
+    // Strings the cache had that no track uses any more.
+    StringShare::purge();
+
+    const StringShare::Statistics strings = StringShare::statistics();
+    qCDebug(JUK_LOG) << strings.strings << "distinct strings are shared," << strings.lookups
+                     << "lookups, dedup ratio" << strings.dedupRatio() << ","
+                     << strings.bytesSaved / 1024 << "KiB saved";
+
+    // Rewrite caches from older versions right away so that the next start
+    // can use the mapped format, and damaged ones before they get worse.
+    if(Cache::instance()->cacheNeedsRewrite())
+        saveItemsToCache();
+
+    // Folders are only scanned in full again if the directories remembered
+    // as scanned may hold files the collection lost.
+    if(m_itemsById.isEmpty() || Cache::instance()->cachedItemsLost())
+        m_directoryCache.clear();
+
+    // From here on changes are journaled instead of rewriting the cache.
+    Cache::instance()->journal()->open();
 
     emit cachedItemsLoaded();
 }
@@ -149,8 +321,17 @@ CollectionListItem *CollectionList::createItem(const FileHandle &file, QTreeWidg
     // It's probably possible to optimize the line below away, but, well, right
     // now it's more important to not load duplicate items.
 
-    if(m_itemsDict.contains(file.absFilePath()))
+    if(CollectionListItem *existing = lookup(file.absFilePath())) {
+        // A folder scan only reads files that changed since they were added.
+        if(existing->file() != file &&
+           file.baseModificationTime() > existing->file().baseModificationTime())
+        {
+            existing->setFile(file);
+            queueAudioPropertiesRead(file);
+        }
+
         return nullptr;
+    }
 
     CollectionListItem *item = new CollectionListItem(this, file);
 
@@ -162,10 +343,31 @@ CollectionListItem *CollectionList::createItem(const FileHandle &file, QTreeWidg
     }
 
     setupItem(item);
+    updateSortPosition(item);
+    queueAudioPropertiesRead(file);
 
     return item;
 }
 
+QHash<QString, qint64> CollectionList::knownFiles() const
+{
+    // Handed to the DirectoryLoader threads as a copy, and only rebuilt once
+    // the collection changes.
+    if(m_knownFilesChanged) {
+        m_knownFiles.clear();
+        m_knownFiles.reserve(m_pathIndex.size());
+
+        for(auto it = m_pathIndex.constBegin(); it != m_pathIndex.constEnd(); ++it) {
+            const QDateTime modified = m_itemsById.value(it.value())->file().baseModificationTime();
+            m_knownFiles.insert(it.key(), modified.isValid() ? modified.toMSecsSinceEpoch() : -1);
+        }
+
+        m_knownFilesChanged = false;
+    }
+
+    return m_knownFiles;
+}
+
 void CollectionList::clearItems(const PlaylistItemList &items)
 {
     foreach(PlaylistItem *item, items) {
@@ -192,76 +394,189 @@ void CollectionList::setupTreeViewEntries(ViewMode *viewMode) const
         treeViewMode->addItems(m_columnTags[column]->keys(), column);
 }
 
-void CollectionList::slotNewItems(const KFileItemList &items)
+void CollectionList::applyLibraryChanges(const LibraryChanges &changes)
 {
-    QStringList files;
+    PlaylistItemList removedItems;
 
-    for(KFileItemList::ConstIterator it = items.constBegin(); it != items.constEnd(); ++it)
-        files.append((*it).url().path());
+    for(const auto &file : changes.removedFiles) {
+        if(CollectionListItem *item = lookup(file))
+            removedItems.append(item);
+    }
 
-    addFiles(files);
-    update();
-}
+    if(!changes.removedDirectories.isEmpty()) {
+        QStringList prefixes;
+        for(const auto &directory : changes.removedDirectories)
+            prefixes.append(directory + '/');
 
-void CollectionList::slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
-{
-    for(int i = 0; i < items.count(); ++i) {
-        const KFileItem fileItem = items[i].second;
-        CollectionListItem *item = lookup(fileItem.url().path());
+        for(auto it = m_pathIndex.constBegin(); it != m_pathIndex.constEnd(); ++it) {
+            for(const auto &prefix : qAsConst(prefixes)) {
+                if(it.key().startsWith(prefix)) {
+                    removedItems.append(m_itemsById.value(it.value()));
+                    break;
+                }
+            }
+        }
+    }
+
+    if(!removedItems.isEmpty())
+        clearItems(removedItems);
+
+    if(!changes.addedDirectories.isEmpty())
+        addFiles(changes.addedDirectories);
+
+    // Files that still have the modification time of their tag are skipped.
+    const auto knownModificationTime = [this](const QString &file) -> qint64 {
+        const CollectionListItem *item = lookup(file);
+        if(!item || !item->file().baseModificationTime().isValid())
+            return -1;
+        return item->file().baseModificationTime().toMSecsSinceEpoch();
+    };
+
+    QStringList playlistFiles;
+    QVector<QPair<QString, qint64>> files;
+    files.reserve(changes.addedFiles.count() + changes.changedFiles.count());
+
+    for(const auto &file : changes.addedFiles) {
+        if(MediaFiles::isPlaylistFile(file))
+            playlistFiles.append(file);
+        else
+            files.append(qMakePair(file, knownModificationTime(file)));
+    }
+
+    for(const auto &file : changes.changedFiles) {
+        if(!MediaFiles::isPlaylistFile(file))
+            files.append(qMakePair(file, knownModificationTime(file)));
+    }
+
+    if(!playlistFiles.isEmpty())
+        addFiles(playlistFiles);
 
-        if(item) {
-            item->refreshFromDisk();
+    if(files.isEmpty())
+        return;
+
+    auto readWatcher = new QFutureWatcher<LibraryFile>(this);
 
-            // If the item is no longer on disk, remove it from the collection.
+    connect(readWatcher, &QFutureWatcher<LibraryFile>::finished, this, [this, readWatcher]() {
+        PlaylistItemList missingItems;
 
-            if(item->file().fileInfo().exists())
-                item->repaint();
-            else
-                delete item;
+        for(const auto &result : readWatcher->future().results()) {
+            CollectionListItem *item = lookup(result.path);
+
+            if(result.missing) {
+                if(item)
+                    missingItems.append(item);
+            }
+            else if(!result.file.isNull()) {
+                if(item) {
+                    item->setFile(result.file);
+                    queueAudioPropertiesRead(result.file);
+                }
+                else
+                    createItem(result.file);
+            }
         }
-    }
 
-    update();
+        if(!missingItems.isEmpty())
+            clearItems(missingItems);
+        else
+            playlistItemsChanged();
+
+        StringShare::purge();
+        readWatcher->deleteLater();
+    });
+
+    readWatcher->setFuture(QtConcurrent::mapped(files, readLibraryFile));
+}
+
+void CollectionList::saveItemsToCache() const
+{
+    qCDebug(JUK_LOG) << "Saving collection list to cache";
+
+    QScopedPointer<CacheFileWriter> writer(createCacheSnapshot());
+
+    if(writer->save(Cache::fileHandleCacheFileName()))
+        Cache::instance()->journal()->clear();
 }
 
-void CollectionList::slotDeleteItems(const KFileItemList &items)
+CacheFileWriter *CollectionList::createCacheSnapshot() const
 {
-    for(const auto &item : items) {
-        delete lookup(item.url().path());
+    CacheFileWriter *writer = new CacheFileWriter;
+    writer->reserve(m_itemsById.size());
+
+    // In the order of the view, so that the collection is loaded sorted and
+    // completedLoadingCachedItems() does not have to sort it again.
+    for(int i = 0; i < topLevelItemCount(); ++i) {
+        addToCacheSnapshot(writer, static_cast<const CollectionListItem *>(topLevelItem(i))->file());
     }
+
+    return writer;
 }
 
-void CollectionList::saveItemsToCache() const
+void CollectionList::queueAudioPropertiesRead(const FileHandle &file)
 {
-    qCDebug(JUK_LOG) << "Saving collection list to cache";
+    if(file.tag()->hasAudioProperties())
+        return;
 
-    QSaveFile f(Cache::fileHandleCacheFileName());
+    m_pendingAudioProperties.append(qMakePair(file.absFilePath(), file.fileType()));
 
-    if(!f.open(QIODevice::WriteOnly)) {
-        qCCritical(JUK_LOG) << "Error saving cache:" << f.errorString();
+    if(!m_readingAudioProperties) {
+        m_readingAudioProperties = true;
+        QTimer::singleShot(0, this, &CollectionList::readNextAudioProperties);
+    }
+}
+
+void CollectionList::readNextAudioProperties()
+{
+    if(m_pendingAudioProperties.isEmpty()) {
+        m_readingAudioProperties = false;
         return;
     }
 
-    QByteArray data;
-    QDataStream s(&data, QIODevice::WriteOnly);
-    s.setVersion(QDataStream::Qt_4_3);
+    const auto files = m_pendingAudioProperties.mid(0, AUDIO_PROPERTIES_BATCH_SIZE);
+    m_pendingAudioProperties.erase(m_pendingAudioProperties.begin(),
+                                   m_pendingAudioProperties.begin() + files.count());
 
-    QHash<QString, CollectionListItem *>::const_iterator it;
-    for(it = m_itemsDict.begin(); it != m_itemsDict.end(); ++it) {
-        s << it.key();
-        s << (*it)->file();
-    }
+    using AudioProperties = QVector<QPair<int, int>>;
+    auto readWatcher = new QFutureWatcher<AudioProperties>(this);
 
-    QDataStream fs(&f);
+    connect(readWatcher, &QFutureWatcher<AudioProperties>::finished, this, [this, readWatcher, files]() {
+        const AudioProperties properties = readWatcher->result();
+        readWatcher->deleteLater();
 
-    qint32 checksum = qChecksum(data.data(), data.size());
+        setBlockDataChanged(true);
 
-    fs << qint32(Cache::playlistItemsCacheVersion)
-       << checksum
-       << data;
+        for(int i = 0; i < files.count(); ++i) {
+            CollectionListItem *item = lookup(files[i].first);
 
-    if(!f.commit())
-        qCCritical(JUK_LOG) << "Error saving cache:" << f.errorString();
+            // Unreadable, removed or read again in the meantime
+            if(properties[i].first < 0 || !item || item->file().tag()->hasAudioProperties())
+                continue;
+
+            item->file().tag()->setAudioProperties(properties[i].first, properties[i].second);
+            item->refresh();
+        }
+
+        setBlockDataChanged(false);
+        playlistItemsChanged();
+
+        readNextAudioProperties();
+    });
+
+    readWatcher->setFuture(QtConcurrent::run(audioPropertiesPool(), [files]() {
+        QThread::currentThread()->setPriority(QThread::IdlePriority);
+
+        AudioProperties properties;
+        properties.reserve(files.count());
+
+        for(const auto &file : files) {
+            int seconds, bitrate;
+            if(!Tag::readAudioProperties(file.first, file.second, &seconds, &bitrate))
+                seconds = bitrate = -1;
+            properties.append(qMakePair(seconds, bitrate));
+        }
+
+        return properties;
+    }));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -284,32 +599,162 @@ void CollectionList::clear()
 
 void CollectionList::slotCheckCache()
 {
-    PlaylistItemList invalidItems;
+    if(m_cacheValidator)
+        return;
+
     qCDebug(JUK_LOG) << "Starting to check cached items for consistency";
     stopwatch.start();
 
-    int i = 0;
-    foreach(CollectionListItem *item, m_itemsDict) {
-        if(!item->checkCurrent())
-            invalidItems.append(item);
-        if(++i == (m_itemsDict.size() / 2))
-            qCDebug(JUK_LOG) << "Checkpoint";
-    }
+    FileHandleList files;
+    files.reserve(m_itemsById.size());
 
-    clearItems(invalidItems);
+    for(const auto item : qAsConst(m_itemsById))
+        files.append(item->file());
 
-    qCDebug(JUK_LOG) << "Finished consistency check, took" << stopwatch.elapsed() << "ms";
+    m_cacheValidator = new CacheValidator(files);
+
+    connect(m_cacheValidator, &CacheValidator::staleFiles,
+            this, &CollectionList::slotRefreshStaleFiles);
+    connect(m_cacheValidator, &CacheValidator::missingFiles,
+            this, &CollectionList::slotRemoveMissingFiles);
+    connect(m_cacheValidator, &CacheValidator::fileStatusFound,
+            this, &CollectionList::slotUpdateFileStatus);
+    connect(m_cacheValidator, &CacheValidator::progress,
+            this, &CollectionList::cacheCheckProgress);
+
+    m_cacheValidatorWatcher = new QFutureWatcher<void>(this);
+    connect(m_cacheValidatorWatcher, &QFutureWatcher<void>::finished,
+            this, &CollectionList::slotCacheCheckFinished);
+
+    m_cacheValidatorWatcher->setFuture(
+        QtConcurrent::run(m_cacheValidator, &CacheValidator::startValidating));
+}
+
+void CollectionList::slotCancelCacheCheck()
+{
+    if(m_cacheValidator)
+        m_cacheValidator->cancel();
+}
+
+void CollectionList::slotCompactCache()
+{
+    CacheJournal *journal = Cache::instance()->journal();
+
+    if(!journal->isOpen() || journal->isCompacting())
+        return;
+
+    qCDebug(JUK_LOG) << "Compacting cache journal";
+    journal->compact(createCacheSnapshot());
 }
 
 void CollectionList::slotRemoveItem(const QString &file)
 {
-    delete m_itemsDict[file];
+    delete lookup(file);
 }
 
 void CollectionList::slotRefreshItem(const QString &file)
 {
-    if(m_itemsDict[file])
-        m_itemsDict[file]->refresh();
+    if(CollectionListItem *item = lookup(file))
+        item->refresh();
+}
+
+void CollectionList::slotPlaylistEntriesFound(int count)
+{
+    if(count <= 0)
+        return;
+
+    m_playlistEntriesTotal += count;
+    emit playlistLoadProgress(m_playlistEntriesChecked, m_playlistEntriesTotal);
+}
+
+void CollectionList::slotPlaylistEntriesChecked(int count)
+{
+    m_playlistEntriesChecked += count;
+    emit playlistLoadProgress(m_playlistEntriesChecked, m_playlistEntriesTotal);
+
+    if(m_playlistEntriesChecked >= m_playlistEntriesTotal) {
+        m_playlistEntriesChecked = 0;
+        m_playlistEntriesTotal = 0;
+    }
+}
+
+void CollectionList::slotRefreshStaleFiles(const FileHandleList &files)
+{
+    auto readWatcher = new QFutureWatcher<FileHandle>(this);
+
+    connect(readWatcher, &QFutureWatcher<FileHandle>::finished, this, [this, readWatcher, files]() {
+        const QList<FileHandle> results = readWatcher->future().results();
+
+        for(int i = 0; i < results.count(); ++i) {
+            CollectionListItem *item = lookup(files[i].absFilePath());
+
+            // The item may have been removed or replaced in the meantime.
+            if(!item || item->file() != files[i])
+                continue;
+
+            item->setFile(results[i]);
+        }
+
+        StringShare::purge();
+        readWatcher->deleteLater();
+    });
+
+    readWatcher->setFuture(QtConcurrent::mapped(files, readStaleFile));
+}
+
+void CollectionList::slotRemoveMissingFiles(const FileHandleList &files)
+{
+    PlaylistItemList invalidItems;
+
+    for(const auto &file : files) {
+        CollectionListItem *item = lookup(file.absFilePath());
+        if(item && item->file() == file)
+            invalidItems.append(item);
+    }
+
+    clearItems(invalidItems);
+}
+
+void CollectionList::slotUpdateFileStatus(const FileHandleList &files,
+                                          const QVector<CacheFileStatus> &status)
+{
+    CacheJournal *journal = Cache::instance()->journal();
+
+    for(int i = 0; i < files.count(); ++i) {
+        FileHandle file = files[i];
+        CollectionListItem *item = lookup(file.absFilePath());
+
+        if(!item || item->file() != file)
+            continue;
+
+        const bool sizeWasUnknown = file.baseSize() < 0;
+        file.setBaseFileStatus(status[i].size, status[i].inode);
+
+        // A size that was not known yet is missing from the totals, which
+        // refresh() fixes and journals along the way.
+        if(sizeWasUnknown)
+            item->refresh();
+        else
+            journal->recordUpdate(file);
+    }
+}
+
+void CollectionList::slotCacheCheckFinished()
+{
+    qCDebug(JUK_LOG) << "Finished consistency check of" << m_cacheValidator->fileCount()
+                     << "items, took" << stopwatch.elapsed() << "ms;"
+                     << m_cacheValidator->staleCount() << "changed,"
+                     << m_cacheValidator->missingCount() << "missing"
+                     << (m_cacheValidator->isCancelled() ? "(cancelled)" : "");
+
+    // A cancelled check stops short of the total, finish it for the status bar.
+    if(m_cacheValidator->isCancelled())
+        emit cacheCheckProgress(m_cacheValidator->fileCount(), m_cacheValidator->fileCount());
+
+    m_cacheValidator->deleteLater();
+    m_cacheValidator = nullptr;
+    m_cacheValidatorWatcher->deleteLater();
+    m_cacheValidatorWatcher = nullptr;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -318,7 +763,15 @@ void CollectionList::slotRefreshItem(const QString &file)
 
 CollectionList::CollectionList(PlaylistCollection *collection) :
     Playlist(collection, true),
-    m_columnTags(15, 0)
+    m_columnTags(15, 0),
+    m_cacheInsertTime(0),
+    m_cacheValidator(nullptr),
+    m_cacheValidatorWatcher(nullptr),
+    m_nextTrackId(1),
+    m_knownFilesChanged(true),
+    m_readingAudioProperties(false),
+    m_playlistEntriesChecked(0),
+    m_playlistEntriesTotal(0)
 {
     QAction *spaction = ActionCollection::actions()->addAction("showPlaying");
     spaction->setText(i18n("Show Playing"));
@@ -336,6 +789,18 @@ CollectionList::CollectionList(PlaylistCollection *collection) :
 
     // Even set to true it wouldn't work with this class due to other checks
     setAllowDuplicates(false);
+
+    // Saves measuring any text at startup, see calculateColumnWeights().
+    KConfigGroup config(KSharedConfig::openConfig(), "Playlists");
+    setColumnWidthStatistics(config.readEntry("CollectionListColumnWidths", QList<int>()),
+                             config.readEntry("CollectionListColumnWidthCounts", QList<int>()));
+
+    connect(Cache::instance()->journal(), SIGNAL(compactionNeeded()),
+            this, SLOT(slotCompactCache()));
+
+    m_directoryCache.load();
+
+    audioPropertiesPool()->setMaxThreadCount(1);
 }
 
 CollectionList::~CollectionList()
@@ -344,6 +809,20 @@ CollectionList::~CollectionList()
     config.writeEntry("CollectionListSortColumn", header()->sortIndicatorSection());
     config.writeEntry("CollectionListSortAscending", header()->sortIndicatorOrder() == Qt::AscendingOrder);
 
+    QList<int> widths;
+    QList<int> widthCounts;
+    columnWidthStatistics(&widths, &widthCounts);
+    config.writeEntry("CollectionListColumnWidths", widths);
+    config.writeEntry("CollectionListColumnWidthCounts", widthCounts);
+
+    if(m_cacheValidator) {
+        m_cacheValidator->cancel();
+        m_cacheValidatorWatcher->waitForFinished();
+        delete m_cacheValidator;
+    }
+
+    m_directoryCache.save();
+
     // The CollectionListItems will try to remove themselves from the
     // m_columnTags member, so we must make sure they're gone before we
     // are.
@@ -412,7 +891,44 @@ QStringList CollectionList::uniqueSet(UniqueSetType t) const
 
 CollectionListItem *CollectionList::lookup(const QString &file) const
 {
-    return m_itemsDict.value(file, nullptr);
+    const quint64 id = m_pathIndex.value(file);
+    return id != 0 ? m_itemsById.value(id) : nullptr;
+}
+
+CollectionListItem *CollectionList::lookup(quint64 id) const
+{
+    return m_itemsById.value(id);
+}
+
+void CollectionList::addToDict(const QString &file, CollectionListItem *item)
+{
+    FileHandle handle = item->file();
+    quint64 id = handle.persistentId();
+
+    // Files new to the collection get the next free ID, as do the rare ones
+    // whose cached ID was handed out already.
+    const auto existing = m_itemsById.constFind(id);
+
+    if(id == 0 || (existing != m_itemsById.constEnd() && existing.value() != item)) {
+        id = m_nextTrackId++;
+        handle.setPersistentId(id);
+    }
+    else
+        m_nextTrackId = qMax(m_nextTrackId, id + 1);
+
+    m_itemsById.insert(id, item);
+    m_pathIndex.insert(file, id);
+    m_knownFilesChanged = true;
+}
+
+void CollectionList::removeFromDict(const QString &file)
+{
+    const quint64 id = m_pathIndex.take(file);
+
+    if(id != 0)
+        m_itemsById.remove(id);
+
+    m_knownFilesChanged = true;
 }
 
 void CollectionList::removeStringFromDict(const QString &value, int column)
@@ -447,53 +963,66 @@ void CollectionListItem::refresh()
     int offset = CollectionList::instance()->columnOffset();
     int columns = lastColumn() + offset + 1;
 
-    sharedData()->metadata.resize(columns);
-    sharedData()->cachedWidths.resize(columns);
+    TrackStore &store = CollectionList::instance()->m_trackStore;
+    const int row = trackRow();
+
+    // The totals of every playlist with the track are kept up to date by
+    // taking out the old length and size and adding the new ones.
+    CollectionList::instance()->updateTotals(this, -1);
+    for(PlaylistItem *child : qAsConst(m_children))
+        child->playlist()->updateTotals(child, -1);
+
+    store.setNumbers(row, file().tag());
+    store.setBytes(row, file().baseSize());
+
+    CollectionList::instance()->updateTotals(this, 1);
+    for(PlaylistItem *child : qAsConst(m_children))
+        child->playlist()->updateTotals(child, 1);
 
     for(int i = offset; i < columns; i++) {
-        setText(i, text(i));
         int id = i - offset;
-        if(id != TrackNumberColumn && id != LengthColumn) {
-            // All columns other than track num and length need local-encoded data for sorting
+        if(TrackStore::hasSortKey(id)) {
+            // Columns sorted by text need local-encoded data for sorting
 
-            QString toLower = text(i).toLower();
+            // The store interns the keys, so repeated values share one string.
 
-            // For some columns, we may be able to share some strings
+            const QString toLower = text(i).toLower();
 
-            if((id == ArtistColumn) || (id == AlbumColumn) ||
-               (id == GenreColumn)  || (id == YearColumn)  ||
-               (id == CommentColumn))
+            if((id == ArtistColumn || id == AlbumColumn || id == GenreColumn) &&
+               store.sortKey(row, id) != toLower)
             {
-                toLower = StringShare::tryShare(toLower);
-
-                if(id != YearColumn && id != CommentColumn && sharedData()->metadata[id] != toLower) {
-                    CollectionList::instance()->removeStringFromDict(sharedData()->metadata[id], id);
-                    CollectionList::instance()->addStringToDict(text(i), id);
-                }
+                CollectionList::instance()->removeStringFromDict(store.sortKey(row, id), id);
+                CollectionList::instance()->addStringToDict(text(i), id);
             }
 
-            sharedData()->metadata[id] = toLower;
+            store.setSortKey(row, id, toLower);
         }
 
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 11, 0))
-        int newWidth = treeWidget()->fontMetrics().horizontalAdvance(text(i));
-#else
-        // .width is deprecated in Qt 5.11 or later
-        int newWidth = treeWidget()->fontMetrics().width(text(i));
-#endif
-        if(newWidth != sharedData()->cachedWidths[i])
+        // Widths are measured lazily, see Playlist::calculateColumnWeights().
+        // Only those measured before have to be measured again.
+        if(store.width(row, id) >= 0)
+            updateWidth(id);
+        else
             playlist()->slotWeightDirty(i);
-
-        sharedData()->cachedWidths[i] = newWidth;
     }
 
+    // The items show the shared data directly, so just tell the views that it
+    // changed.
+
+    emitDataChanged();
+    CollectionList::instance()->updateSortPosition(this);
+
     for(PlaylistItemList::Iterator it = m_children.begin(); it != m_children.end(); ++it) {
+        (*it)->emitDataChanged();
+        (*it)->playlist()->updateSortPosition(*it);
         (*it)->playlist()->update();
         (*it)->playlist()->playlistItemsChanged();
     }
     if(treeWidget()->isVisible())
         treeWidget()->viewport()->update();
 
+    Cache::instance()->journal()->recordUpdate(file());
+
     CollectionList::instance()->playlistItemsChanged();
     emit CollectionList::instance()->signalCollectionChanged();
 }
@@ -519,6 +1048,9 @@ void CollectionListItem::updateCollectionDict(const QString &oldPath, const QStr
 
     collection->removeFromDict(oldPath);
     collection->addToDict(newPath, this);
+
+    if(oldPath != newPath)
+        Cache::instance()->journal()->recordRemoval(oldPath);
 }
 
 void CollectionListItem::repaint() const
@@ -537,10 +1069,12 @@ CollectionListItem::CollectionListItem(CollectionList *parent, const FileHandle
     PlaylistItem(parent),
     m_shuttingDown(false)
 {
-    parent->addToDict(file.absFilePath(), this);
-
+    sharedData()->row = parent->m_trackStore.allocate();
     sharedData()->fileHandle = file;
 
+    parent->addToDict(file.absFilePath(), this);
+    parent->updateTotals(this, 1);
+
     if(file.tag()) {
         refresh();
         parent->playlistItemsChanged();
@@ -550,6 +1084,14 @@ CollectionListItem::CollectionListItem(CollectionList *parent, const FileHandle
     }
 }
 
+CollectionListItem::CollectionListItem(const FileHandle &file) :
+    PlaylistItem(),
+    m_shuttingDown(false)
+{
+    sharedData()->row = CollectionList::instance()->m_trackStore.allocate();
+    sharedData()->fileHandle = file;
+}
+
 CollectionListItem::~CollectionListItem()
 {
     m_shuttingDown = true;
@@ -560,12 +1102,44 @@ CollectionListItem::~CollectionListItem()
     CollectionList *l = CollectionList::instance();
     if(l) {
         l->removeFromDict(file().absFilePath());
+        Cache::instance()->journal()->recordRemoval(file().absFilePath());
+
+        // The folder scan has to add the file again if it's still there.
+        const QString path = file().absFilePath();
+        l->m_directoryCache.invalidate(path.left(path.lastIndexOf('/')));
         l->removeStringFromDict(file().tag()->album(), AlbumColumn);
         l->removeStringFromDict(file().tag()->artist(), ArtistColumn);
         l->removeStringFromDict(file().tag()->genre(), GenreColumn);
+        l->removeWidthStatistics(this);
+        l->updateTotals(this, -1);
+        l->m_trackStore.release(trackRow());
     }
 }
 
+void CollectionListItem::updateWidth(int column)
+{
+    CollectionList *collection = CollectionList::instance();
+    const QString columnText = text(column + collection->columnOffset());
+
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 11, 0))
+    const int newWidth = collection->fontMetrics().horizontalAdvance(columnText);
+#else
+    // .width is deprecated in Qt 5.11 or later
+    const int newWidth = collection->fontMetrics().width(columnText);
+#endif
+
+    TrackStore &store = collection->m_trackStore;
+    const int oldWidth = store.width(trackRow(), column);
+
+    if(!store.setWidth(trackRow(), column, newWidth))
+        return;
+
+    collection->updateWidthStatistics(column, oldWidth, newWidth);
+
+    for(PlaylistItem *child : qAsConst(m_children))
+        child->playlist()->updateWidthStatistics(column, oldWidth, newWidth);
+}
+
 void CollectionListItem::addChildItem(PlaylistItem *child)
 {
     m_children.append(child);
@@ -577,17 +1151,4 @@ void CollectionListItem::removeChildItem(PlaylistItem *child)
         m_children.removeAll(child);
 }
 
-bool CollectionListItem::checkCurrent()
-{
-    if(!file().fileInfo().exists() || !file().fileInfo().isFile())
-        return false;
-
-    if(!file().current()) {
-        file().refresh();
-        refresh();
-    }
-
-    return true;
-}
-
 // vim: set et sw=4 tw=0 sta:
@@ -22,11 +22,17 @@
 
 #include "playlist.h"
 #include "playlistitem.h"
+#include "cachevalidator.h"
+#include "directorycache.h"
+#include "trackstore.h"
 
 class ViewMode;
-class KFileItem;
-class KFileItemList;
 class KDirWatch;
+class CacheFileWriter;
+struct LibraryChanges;
+
+template<class T>
+class QFutureWatcher;
 
 /**
  * This type is for mapping QString track attributes like the album, artist
@@ -71,16 +77,24 @@ public:
 
 protected:
     CollectionListItem(CollectionList *parent, const FileHandle &file);
+
+    /**
+     * Creates an item that still needs to be added to the CollectionList (and
+     * then refreshed), see CollectionList::insertCachedItems().
+     */
+    explicit CollectionListItem(const FileHandle &file);
+
     virtual ~CollectionListItem();
 
     void addChildItem(PlaylistItem *child);
     void removeChildItem(PlaylistItem *child);
 
     /**
-     * Returns true if the item is now up to date (even if this required a refresh) or
-     * false if the item is invalid.
+     * Measures the text width of \a column (not counting the column offset)
+     * and passes the change on to the width statistics of every playlist
+     * that has the track.
      */
-    bool checkCurrent();
+    void updateWidth(int column);
 
     virtual CollectionListItem *collectionItem() override { return this; }
 
@@ -112,6 +126,11 @@ public:
 
     CollectionListItem *lookup(const QString &file) const;
 
+    /**
+     * Returns the item of the track with FileHandle::persistentId() @p id.
+     */
+    CollectionListItem *lookup(quint64 id) const;
+
     virtual CollectionListItem *createItem(const FileHandle &file,
                                      QTreeWidgetItem * = nullptr) override;
 
@@ -121,19 +140,50 @@ public:
 
     virtual bool canReload() const override { return true; }
 
+    /**
+     * Writes the complete collection to the cache.  Normally changes are only
+     * appended to the cache journal, see CacheJournal.
+     */
     void saveItemsToCache() const;
 
+    /**
+     * Brings the collection up to date with a batch of changes found by the
+     * LibraryWatcher.  Removed files leave the collection right away, the tags
+     * of new and changed files are read in the background.
+     */
+    void applyLibraryChanges(const LibraryChanges &changes);
+
+    /**
+     * The sort keys, column widths and numeric tags of all tracks, see
+     * PlaylistItem::trackRow().
+     */
+    const TrackStore &trackStore() const { return m_trackStore; }
+
 public slots:
     virtual void clear() override;
 
+    /**
+     * Checks in the background whether the files of the collection changed
+     * since they were cached.  Changed files are read again, and files that
+     * are gone are removed from the collection.
+     */
     void slotCheckCache();
+    void slotCancelCacheCheck();
+
+    /**
+     * Folds the cache journal into the cache in the background.
+     */
+    void slotCompactCache();
 
     void slotRemoveItem(const QString &file);
     void slotRefreshItem(const QString &file);
 
-    void slotNewItems(const KFileItemList &items);
-    void slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items);
-    void slotDeleteItems(const KFileItemList &items);
+    /**
+     * Keep count of the entries of all playlist files being loaded, see
+     * PlaylistFileLoader.
+     */
+    void slotPlaylistEntriesFound(int count);
+    void slotPlaylistEntriesChecked(int count);
 
 protected:
     CollectionList(PlaylistCollection *collection);
@@ -144,8 +194,12 @@ protected:
 
     // These methods are used by CollectionListItem, which is a friend class.
 
-    void addToDict(const QString &file, CollectionListItem *item) { m_itemsDict.insert(file, item); }
-    void removeFromDict(const QString &file) { m_itemsDict.remove(file); }
+    /**
+     * Indexes @p item under its persistent ID, assigning one if it has none
+     * yet, and maps @p file to the ID.
+     */
+    void addToDict(const QString &file, CollectionListItem *item);
+    void removeFromDict(const QString &file);
 
     // These methods are also used by CollectionListItem, to manage the
     // strings used in generating the unique sets and tree view mode playlists.
@@ -156,7 +210,10 @@ protected:
     void addWatched(const QString &file);
     void removeWatched(const QString &file);
 
-    virtual bool hasItem(const QString &file) const override { return m_itemsDict.contains(file); }
+    virtual bool hasItem(const QString &file) const override { return m_pathIndex.contains(file); }
+
+    virtual DirectoryCache *directoryCache() override { return &m_directoryCache; }
+    virtual QHash<QString, qint64> knownFiles() const override;
 
 signals:
     void signalCollectionChanged();
@@ -175,6 +232,17 @@ signals:
     // and invalid track detection to proceed.
     void cachedItemsLoaded();
 
+    /**
+     * Progress of the check started by slotCheckCache().
+     */
+    void cacheCheckProgress(int checked, int total);
+
+    /**
+     * Progress of loading playlist files, summed over all playlists being
+     * loaded at the same time.
+     */
+    void playlistLoadProgress(int checked, int total);
+
 public slots:
     /**
      * Loads the CollectionListItems from the Cache.  Should be called after program
@@ -183,10 +251,9 @@ public slots:
     void startLoadingCachedItems();
 
     /**
-     * Loads a few items at a time. Intended to be single-shotted into the event
-     * loop so that loading the music doesn't freeze the GUI.
+     * Adds a batch of items decoded from the cache by the loading thread.
      */
-    void loadNextBatchCachedItems();
+    void insertCachedItems(const FileHandleList &files);
 
     /**
      * Teardown from cache loading (e.g. a sort operation). Should
@@ -194,7 +261,26 @@ public slots:
      */
     void completedLoadingCachedItems();
 
+private slots:
+    void slotRefreshStaleFiles(const FileHandleList &files);
+    void slotRemoveMissingFiles(const FileHandleList &files);
+    void slotUpdateFileStatus(const FileHandleList &files, const QVector<CacheFileStatus> &status);
+    void slotCacheCheckFinished();
+
 private:
+    /**
+     * Returns a copy of the collection for writing to the cache, which can be
+     * handed to another thread.  The caller owns the result.
+     */
+    CacheFileWriter *createCacheSnapshot() const;
+
+    /**
+     * Queues @p file for reading its length and bitrate in the background if
+     * they are not known yet, e.g. after a folder scan (see Tag::ScanRead).
+     */
+    void queueAudioPropertiesRead(const FileHandle &file);
+    void readNextAudioProperties();
+
     /**
      * Just the size of the above enum to keep from hard coding it in several
      * locations.
@@ -202,9 +288,26 @@ private:
     static const int m_uniqueSetCount = 3;
 
     static CollectionList *m_list;
-    QHash<QString, CollectionListItem *> m_itemsDict;
+    QHash<quint64, CollectionListItem *> m_itemsById;
+
+    /**
+     * Paths only matter where files come and go, everything else goes by ID.
+     */
+    QHash<QString, quint64> m_pathIndex;
+    quint64 m_nextTrackId;
     KDirWatch *m_dirWatch;
     TagCountDicts m_columnTags;
+    qint64 m_cacheInsertTime;
+    CacheValidator *m_cacheValidator;
+    QFutureWatcher<void> *m_cacheValidatorWatcher;
+    DirectoryCache m_directoryCache;
+    TrackStore m_trackStore;
+    mutable QHash<QString, qint64> m_knownFiles;
+    mutable bool m_knownFilesChanged;
+    QVector<QPair<QString, MediaFiles::FileType>> m_pendingAudioProperties;
+    bool m_readingAudioProperties;
+    int m_playlistEntriesChecked;
+    int m_playlistEntriesTotal;
 };
 
 #endif
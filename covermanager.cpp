@@ -29,6 +29,8 @@
 #include <QByteArray>
 #include <QMap>
 #include <QTemporaryFile>
+#include <QSaveFile>
+#include <QBuffer>
 #include <QStandardPaths>
 #include <QUrl>
 
@@ -45,6 +47,23 @@ typedef QHash<QString, coverKey> TrackLookupMap;
 
 static const char dragMimetype[] = "application/x-juk-coverid";
 
+// Version 0 of the cover database was a complete dump of the covers and the
+// track mapping.  Version 1 is a log of changes (see
+// CoverManagerPrivate::appendEntry()) which is only rewritten once most of
+// it is superseded.
+static const quint32 coverDatabaseVersion = 1;
+static const qint64 coverDatabaseHeaderSize = sizeof(quint32);
+
+// Don't bother compacting logs with fewer entries than this.
+static const int minimumCompactionEntries = 256;
+
+enum CoverDatabaseOperation
+{
+    AddCover = 1,
+    RemoveCover = 2,
+    SetTrackCover = 3
+};
+
 const coverKey CoverManager::NoMatch = 0;
 
 // Used to save and load CoverData from a QDataStream
@@ -118,7 +137,12 @@ public:
     /// 't' followed by the pathname for Thumbnail covers.
     /// However only thumbnails are currently cached.
 
-    CoverManagerPrivate() : m_timer(new CoverSaveHelper(0)), m_coverProxy(0)
+    CoverManagerPrivate() :
+        m_timer(new CoverSaveHelper(0)),
+        m_coverProxy(0),
+        m_entryCount(0),
+        m_validSize(0),
+        m_needsRewrite(false)
     {
         loadCovers();
     }
@@ -149,7 +173,25 @@ public:
      */
     coverKey nextId() const;
 
-    void saveCovers() const;
+    /**
+     * These append a change, which must already have been made to covers or
+     * tracks, to the cover database on disk.
+     */
+    void logCoverAdded(coverKey id);
+    void logCoverRemoved(coverKey id);
+    void logTrackCoverChanged(const QString &path, coverKey id);
+
+    /**
+     * Forgets cover @p id and the tracks using it.
+     */
+    void applyCoverRemoval(coverKey id);
+
+    /**
+     * Rewrites the cover database if most of its entries are superseded by
+     * later ones.  Changes are written as they are made, so nothing is lost
+     * if this is not called.
+     */
+    void saveCovers();
 
     CoverProxy *coverProxy() {
         if(!m_coverProxy)
@@ -159,6 +201,14 @@ public:
 
     private:
     void loadCovers();
+    void loadLegacyCovers(QDataStream &in);
+    void replayCovers(QFile &file);
+
+    void applyTrackCover(const QString &path, coverKey id);
+
+    void appendEntry(const QByteArray &payload);
+    bool openLog();
+    void writeDatabase();
 
     /**
      * @return the full path and filename of the file storing the cover
@@ -169,6 +219,11 @@ public:
     CoverSaveHelper *m_timer;
 
     CoverProxy *m_coverProxy;
+
+    QFile m_log;
+    int m_entryCount;
+    qint64 m_validSize;
+    bool m_needsRewrite;
 };
 
 // This is responsible for making sure that the CoverManagerPrivate class
@@ -185,43 +240,139 @@ void CoverManagerPrivate::createDataDir() const
     dir.mkpath(dirPath);
 }
 
-void CoverManagerPrivate::saveCovers() const
+void CoverManagerPrivate::saveCovers()
 {
-    // Make sure the directory exists first.
-    createDataDir();
+    const int liveEntries = int(covers.size()) + tracks.size();
 
-    QFile file(coverLocation());
+    if(m_needsRewrite || m_entryCount > qMax(minimumCompactionEntries, 2 * liveEntries))
+        writeDatabase();
+}
+
+void CoverManagerPrivate::logCoverAdded(coverKey id)
+{
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
+
+    s << qint8(AddCover) << quint32(id) << covers[id];
+
+    appendEntry(payload);
+}
+
+void CoverManagerPrivate::logCoverRemoved(coverKey id)
+{
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
 
-    qCDebug(JUK_LOG) << "Opening covers db: " << coverLocation();
+    s << qint8(RemoveCover) << quint32(id);
 
-    if(!file.open(QIODevice::WriteOnly)) {
-        qCCritical(JUK_LOG) << "Unable to save covers to disk!\n";
+    appendEntry(payload);
+}
+
+void CoverManagerPrivate::logTrackCoverChanged(const QString &path, coverKey id)
+{
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
+
+    s << qint8(SetTrackCover) << path << quint32(id);
+
+    appendEntry(payload);
+}
+
+void CoverManagerPrivate::appendEntry(const QByteArray &payload)
+{
+    if(!openLog())
+        return;
+
+    QByteArray entry;
+    QDataStream s(&entry, QIODevice::WriteOnly);
+
+    s << quint32(payload.size())
+      << qChecksum(payload.constData(), payload.size());
+    s.writeRawData(payload.constData(), payload.size());
+
+    // One write per entry keeps a torn entry detectable by its checksum.
+    if(m_log.write(entry) != entry.size() || !m_log.flush()) {
+        qCCritical(JUK_LOG) << "Unable to save covers to disk:" << m_log.errorString();
         return;
     }
 
-    QDataStream out(&file);
+    m_validSize = m_log.size();
+    ++m_entryCount;
 
-    // Write out the version and count
-    out << quint32(0) << quint32(covers.size());
+    requestSave(); // Compact if needed once things calm down.
+}
 
-    qCDebug(JUK_LOG) << "Writing out" << covers.size() << "covers.";
+bool CoverManagerPrivate::openLog()
+{
+    if(m_needsRewrite || m_validSize < coverDatabaseHeaderSize)
+        writeDatabase();
 
-    // Write out the data
-    for(const auto &it : covers) {
-        out << quint32(it.first);
-        out << it.second;
+    if(m_log.isOpen())
+        return true;
+
+    m_log.setFileName(coverLocation());
+    if(!m_log.open(QIODevice::ReadWrite)) {
+        qCCritical(JUK_LOG) << "Unable to open covers db:" << m_log.errorString();
+        return false;
     }
 
-    // Now write out the track mapping.
-    out << quint32(tracks.count());
+    // Drop anything loadCovers() could not read.
+    m_log.resize(m_validSize);
+    m_log.seek(m_validSize);
+
+    return true;
+}
+
+void CoverManagerPrivate::writeDatabase()
+{
+    // Make sure the directory exists first.
+    createDataDir();
+
+    // The log is replaced by a new file.
+    m_log.close();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+
+    QDataStream out(&buffer);
+    out << coverDatabaseVersion;
 
-    qCDebug(JUK_LOG) << "Writing out" << tracks.count() << "tracks.";
+    const auto writeEntry = [&out](const QByteArray &payload) {
+        out << quint32(payload.size())
+            << qChecksum(payload.constData(), payload.size());
+        out.writeRawData(payload.constData(), payload.size());
+    };
 
-    TrackLookupMap::ConstIterator trackMapIt = tracks.constBegin();
-    while(trackMapIt != tracks.constEnd()) {
-        out << trackMapIt.key() << quint32(trackMapIt.value());
-        ++trackMapIt;
+    qCDebug(JUK_LOG) << "Writing out" << covers.size() << "covers and"
+                     << tracks.count() << "tracks to" << coverLocation();
+
+    for(const auto &it : covers) {
+        QByteArray payload;
+        QDataStream s(&payload, QIODevice::WriteOnly);
+        s << qint8(AddCover) << quint32(it.first) << it.second;
+        writeEntry(payload);
+    }
+
+    for(auto it = tracks.constBegin(); it != tracks.constEnd(); ++it) {
+        QByteArray payload;
+        QDataStream s(&payload, QIODevice::WriteOnly);
+        s << qint8(SetTrackCover) << it.key() << quint32(it.value());
+        writeEntry(payload);
+    }
+
+    QSaveFile file(coverLocation());
+    if(!file.open(QIODevice::WriteOnly) ||
+       file.write(data) != data.size() ||
+       !file.commit())
+    {
+        qCCritical(JUK_LOG) << "Unable to save covers to disk:" << file.errorString();
+        return;
     }
+
+    m_entryCount = int(covers.size()) + tracks.size();
+    m_validSize = data.size();
+    m_needsRewrite = false;
 }
 
 void CoverManagerPrivate::loadCovers()
@@ -234,18 +385,33 @@ void CoverManagerPrivate::loadCovers()
     }
 
     QDataStream in(&file);
-    quint32 count, version;
+    quint32 version;
 
     // First thing we'll read in will be the version.
-    // Only version 0 is defined for now.
     in >> version;
-    if(version > 0) {
+
+    if(version == 0) {
+        loadLegacyCovers(in);
+
+        // Converted to the log format on the first change.
+        m_needsRewrite = true;
+    }
+    else if(version == coverDatabaseVersion)
+        replayCovers(file);
+    else {
         qCCritical(JUK_LOG) << "Cover database was created by a higher version of JuK,\n";
         qCCritical(JUK_LOG) << "I don't know what to do with it.\n";
 
         return;
     }
 
+    qCDebug(JUK_LOG) << "Tracks hash table has" << tracks.size() << "entries.";
+}
+
+void CoverManagerPrivate::loadLegacyCovers(QDataStream &in)
+{
+    quint32 count;
+
     // Read in the count next, then the data.
     in >> count;
 
@@ -279,8 +445,91 @@ void CoverManagerPrivate::loadCovers()
             tracks.insert(path, id);
         }
     }
+}
 
-    qCDebug(JUK_LOG) << "Tracks hash table has" << tracks.size() << "entries.";
+void CoverManagerPrivate::replayCovers(QFile &file)
+{
+    // The version has already been read.
+    QDataStream in(&file);
+
+    m_validSize = file.pos();
+    m_entryCount = 0;
+
+    while(!in.atEnd()) {
+        quint32 size;
+        quint16 checksum;
+        in >> size >> checksum;
+
+        if(in.status() != QDataStream::Ok || qint64(size) > file.size() - file.pos())
+            break;
+
+        QByteArray payload(int(size), Qt::Uninitialized);
+        if(in.readRawData(payload.data(), int(size)) != int(size) ||
+           checksum != qChecksum(payload.constData(), size))
+        {
+            break;
+        }
+
+        QDataStream s(payload);
+        qint8 operation;
+        quint32 id;
+        s >> operation;
+
+        if(operation == AddCover) {
+            CoverData data;
+            s >> id >> data;
+            data.refCount = 0;
+            covers[(coverKey) id] = data;
+        }
+        else if(operation == RemoveCover) {
+            s >> id;
+            applyCoverRemoval(id);
+        }
+        else if(operation == SetTrackCover) {
+            QString path;
+            s >> path >> id;
+            applyTrackCover(path, id);
+        }
+
+        m_validSize = file.pos();
+        ++m_entryCount;
+    }
+
+    if(m_validSize < file.size())
+        qCWarning(JUK_LOG) << "Dropping incomplete entries at the end of the covers db.";
+
+    qCDebug(JUK_LOG) << "Loaded" << covers.size() << "covers from" << m_entryCount << "entries.";
+}
+
+void CoverManagerPrivate::applyTrackCover(const QString &path, coverKey id)
+{
+    const coverKey oldId = tracks.value(path, CoverManager::NoMatch);
+
+    if(oldId != CoverManager::NoMatch) {
+        auto oldCover = covers.find(oldId);
+        if(oldCover != covers.end())
+            oldCover->second.refCount--;
+        tracks.remove(path);
+    }
+
+    auto cover = covers.find(id);
+    if(cover != covers.end()) {
+        cover->second.refCount++;
+        tracks.insert(path, id);
+    }
+}
+
+void CoverManagerPrivate::applyCoverRemoval(coverKey id)
+{
+    // Remove references to files that had that track ID.
+    for(auto it = tracks.begin(); it != tracks.end(); ) {
+        if(it.value() == id)
+            it = tracks.erase(it);
+        else
+            ++it;
+    }
+
+    covers.erase(id);
 }
 
 QString CoverManagerPrivate::coverLocation() const
@@ -443,6 +692,7 @@ coverKey CoverManager::addCover(const QUrl &path, const QString &artist, const Q
     coverData.refCount = 0;
 
     data()->covers.emplace(id, coverData);
+    data()->logCoverAdded(id);
 
     // Can't use NetAccess::download() since if path is already a local file
     // (which is possible) then that function will return without copying, since
@@ -458,8 +708,6 @@ coverKey CoverManager::addCover(const QUrl &path, const QString &artist, const Q
 
     job->start();
 
-    data()->requestSave(); // Save changes when possible.
-
     return id;
 }
 
@@ -514,18 +762,13 @@ bool CoverManager::removeCover(coverKey id)
     QPixmapCache::remove(QString("f%1").arg(coverData.path));
     QPixmapCache::remove(QString("t%1").arg(coverData.path));
 
-    // Remove references to files that had that track ID.
-    QList<QString> affectedFiles = data()->tracks.keys(id);
-    foreach (const QString &file, affectedFiles) {
-        data()->tracks.remove(file);
-    }
-
     // Remove covers from disk.
     QFile::remove(coverData.path);
 
-    // Finally, forget that we ever knew about this cover.
-    data()->covers.erase(id);
-    data()->requestSave();
+    // Finally, forget that we ever knew about this cover, and which tracks
+    // used it.
+    data()->applyCoverRemoval(id);
+    data()->logCoverRemoved(id);
 
     return true;
 }
@@ -590,7 +833,7 @@ void CoverManager::setIdForTrack(const QString &path, coverKey id)
         data()->tracks.insert(path, id);
     }
 
-    data()->requestSave();
+    data()->logTrackCoverChanged(path, id);
 }
 
 coverKey CoverManager::idForTrack(const QString &path)
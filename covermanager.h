@@ -34,7 +34,7 @@ template<class T>
 class QList;
 
 /**
- * This class saves the covers when its saveCovers() slot is called to avoid
+ * This class compacts the covers when its saveCovers() slot is called to avoid
  * making CoverManager a QObject and avoid moving the actual implementation
  * class (CoverManagerPrivate) to this .h file.  Used with a QTimer to save
  * the covers after changes are made.
@@ -215,10 +215,9 @@ public:
     static bool replaceCover(coverKey id, const QPixmap &large);
 
     /**
-     * Saves the current CoverManager information to disk.  Changes are not
-     * automatically written to disk due to speed issues, so you can
-     * periodically call this function while running to reduce the chance of
-     * lost data in the event of a crash.
+     * Compacts the CoverManager information on disk if needed.  Changes are
+     * appended to the cover database as they are made, so this only rewrites
+     * the database once most of it has been superseded by later changes.
      */
     static void saveCovers();
 
@@ -0,0 +1,178 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directorycache.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "juk_debug.h"
+
+static const quint32 directoryCacheMagic = 0x4A754B44; // "JuKD"
+static const qint32 directoryCacheVersion = 1;
+
+// A directory changed this recently could change again without getting a
+// different modification time, so it is not remembered.
+static const qint64 modificationTimeSlack = 2000;
+
+DirectoryCache::DirectoryCache() :
+    m_changed(false)
+{
+}
+
+QString DirectoryCache::fileName() // static
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/directories";
+}
+
+void DirectoryCache::load()
+{
+    QMutexLocker locker(&m_lock);
+    m_entries.clear();
+    m_changed = false;
+
+    QFile f(fileName());
+    if(!f.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic;
+    qint32 version;
+    quint32 count;
+    s >> magic >> version >> count;
+
+    if(s.status() != QDataStream::Ok || magic != directoryCacheMagic ||
+       version != directoryCacheVersion)
+    {
+        qCWarning(JUK_LOG) << "Ignoring directory cache from an unknown version.";
+        return;
+    }
+
+    m_entries.reserve(int(count));
+
+    for(quint32 i = 0; i < count && s.status() == QDataStream::Ok; ++i) {
+        QString path;
+        Entry entry;
+        s >> path >> entry.modificationTime >> entry.entryCount >> entry.subdirectories;
+        m_entries.insert(path, entry);
+    }
+
+    if(s.status() != QDataStream::Ok) {
+        qCWarning(JUK_LOG) << "The directory cache is damaged, all folders will be scanned.";
+        m_entries.clear();
+        return;
+    }
+
+    qCDebug(JUK_LOG) << "Loaded" << m_entries.count() << "directories from the directory cache";
+}
+
+void DirectoryCache::save()
+{
+    QMutexLocker locker(&m_lock);
+
+    if(!m_changed)
+        return;
+
+    QSaveFile f(fileName());
+    if(!f.open(QIODevice::WriteOnly)) {
+        qCCritical(JUK_LOG) << "Error saving directory cache:" << f.errorString();
+        return;
+    }
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_5_0);
+
+    s << directoryCacheMagic
+      << directoryCacheVersion
+      << quint32(m_entries.count());
+
+    for(auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        s << it.key()
+          << it->modificationTime
+          << it->entryCount
+          << it->subdirectories;
+    }
+
+    if(s.status() != QDataStream::Ok || !f.commit()) {
+        qCCritical(JUK_LOG) << "Error saving directory cache:" << f.errorString();
+        return;
+    }
+
+    m_changed = false;
+}
+
+void DirectoryCache::clear()
+{
+    QMutexLocker locker(&m_lock);
+
+    if(m_entries.isEmpty())
+        return;
+
+    m_entries.clear();
+    m_changed = true;
+}
+
+bool DirectoryCache::isUnchanged(const QString &path, const QDateTime &modified,
+                                 QStringList *subdirectories, int *entryCount) const
+{
+    if(!modified.isValid())
+        return false;
+
+    QMutexLocker locker(&m_lock);
+
+    const auto it = m_entries.constFind(path);
+    if(it == m_entries.constEnd() || it->modificationTime != modified.toMSecsSinceEpoch())
+        return false;
+
+    *subdirectories = it->subdirectories;
+    *entryCount = it->entryCount;
+
+    return true;
+}
+
+void DirectoryCache::insert(const QString &path, const QDateTime &modified,
+                            int entryCount, const QStringList &subdirectories)
+{
+    QMutexLocker locker(&m_lock);
+    m_changed = true;
+
+    const qint64 modificationTime = modified.isValid() ? modified.toMSecsSinceEpoch() : -1;
+
+    if(modificationTime < 0 ||
+       modificationTime > QDateTime::currentMSecsSinceEpoch() - modificationTimeSlack)
+    {
+        m_entries.remove(path);
+        return;
+    }
+
+    m_entries.insert(path, Entry { modificationTime, entryCount, subdirectories });
+}
+
+void DirectoryCache::invalidate(const QString &path)
+{
+    QMutexLocker locker(&m_lock);
+
+    if(m_entries.remove(path) > 0)
+        m_changed = true;
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_DIRECTORYCACHE_H
+#define JUK_DIRECTORYCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+class QDateTime;
+
+/**
+ * Remembers the directories that have been scanned into the collection, with
+ * the modification time and number of entries each had and its
+ * subdirectories.  A directory's modification time changes whenever an entry
+ * is added, removed or renamed, so a directory that still has the same one
+ * needs no new listing: all of its files are already in the collection, and
+ * only its subdirectories need to be checked in turn.  See DirectoryLoader.
+ *
+ * All methods other than load() and save() are thread-safe.
+ */
+class DirectoryCache
+{
+public:
+    DirectoryCache();
+
+    static QString fileName();
+
+    void load();
+    void save();
+
+    /**
+     * Forgets every directory, e.g. after the collection cache was lost.
+     */
+    void clear();
+
+    /**
+     * Returns true if @p path was scanned before and still has modification
+     * time @p modified.  In that case its subdirectories are returned in
+     * @p subdirectories and its number of entries in @p entryCount.
+     */
+    bool isUnchanged(const QString &path, const QDateTime &modified,
+                     QStringList *subdirectories, int *entryCount) const;
+
+    /**
+     * Remembers that @p path, with the given modification time, entries and
+     * subdirectories, has been completely added to the collection.
+     */
+    void insert(const QString &path, const QDateTime &modified,
+                int entryCount, const QStringList &subdirectories);
+
+    /**
+     * Makes the next scan list @p path again, e.g. because a file in it was
+     * removed from the collection.
+     */
+    void invalidate(const QString &path);
+
+private:
+    struct Entry
+    {
+        qint64 modificationTime;
+        qint32 entryCount;
+        QStringList subdirectories;
+    };
+
+    mutable QMutex m_lock;
+    QHash<QString, Entry> m_entries;
+    bool m_changed;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -16,11 +16,28 @@
 
 #include "directoryloader.h"
 
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include <QDirIterator>
+#include <QFile>
 #include <QFileInfo>
-#include <QMutex>
+#include <QGlobalStatic>
 #include <QMutexLocker>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "mediafiles.h"
+#include "directorycache.h"
+#include "juk_debug.h"
 
 // Classifies files into types for potential loading purposes.
 enum class MediaFileType {
@@ -30,49 +47,207 @@ enum class MediaFileType {
     Directory
 };
 
-static MediaFileType classifyFile(const QFileInfo &fileInfo);
-static FileHandle loadMediaFile(const QString &fileName);
+namespace {
+
+/**
+ * A directory entry with everything the loader needs to know about it.
+ */
+struct DirectoryEntry
+{
+    QString canonicalPath;
+    bool isDirectory;
+    bool isFile;
+    bool isReadable;         ///< Only checked for media files
+    MediaFiles::FileType fileType; ///< Of files, UnknownFile for others
+    qint64 modificationTime; ///< msecs since the epoch
+    qint64 size;
+    quint64 inode;           ///< 0 if unknown
+};
+
+} // namespace
 
-DirectoryLoader::DirectoryLoader(const QString &dir, QObject *parent)
+static void readDirectory(const QString &path, QVector<DirectoryEntry> *entries);
+static bool directoryModificationTime(const QString &path, QDateTime *modified);
+static MediaFileType classifyFile(const DirectoryEntry &entry, MediaFiles::FileType *fileType);
+static qint64 processStatistic(const char *fileName, const QByteArray &key);
+
+// Files are handed to the GUI in batches of this size.
+static const int BATCH_SIZE = 256;
+
+// Directories with more files than this have them read in several tasks.
+static const int FILES_PER_TASK = 64;
+
+Q_GLOBAL_STATIC(QThreadPool, directoryLoaderPool)
+
+DirectoryLoader::DirectoryLoader(const QString &dir, DirectoryCache *directoryCache,
+                                 QObject *parent)
     : QObject(parent)
-    , m_dirIterator(
-        dir,
-        QDir::AllEntries | QDir::NoDotAndDotDot,
-        QDirIterator::Subdirectories | QDirIterator::FollowSymlinks)
+    , m_dir(dir)
+    , m_directoryCache(directoryCache)
+    , m_pendingTasks(0)
+    , m_skippedDirCount(0)
+    , m_skippedEntryCount(0)
 {
+    // The pool is set up here as this is still in the GUI thread.
+    const KConfigGroup config(KSharedConfig::openConfig(), "Settings");
+    const int threadCount = config.readEntry("ScanThreads", 0);
+
+    scanPool()->setMaxThreadCount(
+        threadCount > 0 ? threadCount : QThread::idealThreadCount());
 }
 
 void DirectoryLoader::startLoading()
 {
-    static const int BATCH_SIZE = 256;
-    FileHandleList files;
+    // For the cost of a tag read (see Tag::ScanRead).  Counts the reads of
+    // the whole process, so the GUI thread adds a little.
+    const qint64 bytesReadBefore = processStatistic("/proc/self/io", "rchar:");
+
+    const QFileInfo dirInfo(m_dir);
+    queueDirectory(dirInfo.canonicalFilePath(), dirInfo.lastModified());
+
+    {
+        QMutexLocker locker(&m_lock);
+        while(m_pendingTasks > 0)
+            m_tasksDone.wait(&m_lock);
+    }
+
+    if(!m_loadedFiles.isEmpty()) {
+        emit loadedFiles(m_loadedFiles);
+        m_loadedFiles.clear();
+    }
+
+    qCDebug(JUK_LOG) << "Read the tags of" << parsedFileCount() << "files in" << m_dir
+                     << "and skipped" << skippedFileCount() << "known files";
+
+    const qint64 bytesRead = processStatistic("/proc/self/io", "rchar:") - bytesReadBefore;
+    if(bytesReadBefore >= 0 && parsedFileCount() > 0) {
+        qCDebug(JUK_LOG) << "Read" << bytesRead / parsedFileCount() << "bytes per file, peak"
+                         << "resident memory" << processStatistic("/proc/self/status", "VmHWM:")
+                         << "KiB";
+    }
+
+    if(m_directoryCache) {
+        qCDebug(JUK_LOG) << "Scanned" << m_scannedDirs.count() << "directories in" << m_dir
+                         << "and skipped" << m_skippedDirCount << "unchanged ones with"
+                         << m_skippedEntryCount << "entries";
+    }
+}
+
+void DirectoryLoader::recordScannedDirectories()
+{
+    if(!m_directoryCache)
+        return;
 
-    while(m_dirIterator.hasNext()) {
-        const auto fileName = m_dirIterator.next();
-        const QFileInfo fileInfo(fileName);
-        const auto type = classifyFile(fileInfo);
+    for(const auto &dir : qAsConst(m_scannedDirs))
+        m_directoryCache->insert(dir.path, dir.modified, dir.entryCount, dir.subdirectories);
+
+    m_scannedDirs.clear();
+}
+
+QThreadPool *DirectoryLoader::scanPool() // static
+{
+    return directoryLoaderPool();
+}
+
+template<class Function>
+void DirectoryLoader::queueTask(Function task)
+{
+    {
+        QMutexLocker locker(&m_lock);
+        ++m_pendingTasks;
+    }
+
+    QtConcurrent::run(scanPool(), [this, task]() {
+        task();
+
+        QMutexLocker locker(&m_lock);
+        if(--m_pendingTasks == 0)
+            m_tasksDone.wakeAll();
+    });
+}
+
+void DirectoryLoader::queueDirectory(const QString &path, const QDateTime &modified)
+{
+    if(path.isEmpty())
+        return;
+
+    {
+        // Symlinks may lead to the same directory more than once.
+        QMutexLocker locker(&m_lock);
+        if(m_visitedDirs.contains(path))
+            return;
+        m_visitedDirs.insert(path);
+    }
+
+    queueTask([this, path, modified]() { scanDirectory(path, modified); });
+}
+
+void DirectoryLoader::scanDirectory(const QString &path, const QDateTime &modified)
+{
+    QStringList subdirectories;
+    int entryCount = 0;
+
+    if(m_directoryCache &&
+       m_directoryCache->isUnchanged(path, modified, &subdirectories, &entryCount))
+    {
+        // All of the files here are known, but the subdirectories may still
+        // have changed.
+        for(const auto &subdirectory : qAsConst(subdirectories)) {
+            QDateTime subdirectoryModified;
+            if(directoryModificationTime(subdirectory, &subdirectoryModified))
+                queueDirectory(subdirectory, subdirectoryModified);
+        }
+
+        QMutexLocker locker(&m_lock);
+        ++m_skippedDirCount;
+        m_skippedEntryCount += entryCount;
+        return;
+    }
+
+    QVector<DirectoryEntry> entries;
+    readDirectory(path, &entries);
+    entryCount = entries.count();
+
+    QVector<MediaFile> mediaFiles;
+
+    for(const auto &entry : qAsConst(entries)) {
+        MediaFiles::FileType fileType = MediaFiles::UnknownFile;
+        const auto type = classifyFile(entry, &fileType);
 
         switch(type) {
             case MediaFileType::Playlist:
-                emit loadedPlaylist(fileName);
+                emit loadedPlaylist(entry.canonicalPath);
                 break;
 
             case MediaFileType::MediaFile:
                 {
-                    const auto loadedMetadata = loadMediaFile(fileInfo.canonicalFilePath());
-                    files << loadedMetadata;
+                    const auto known = m_knownFiles.constFind(entry.canonicalPath);
+
+                    if(known != m_knownFiles.constEnd() &&
+                       known.value() == entry.modificationTime)
+                    {
+                        m_skippedFileCount.fetchAndAddRelaxed(1);
+                        break;
+                    }
+
+                    mediaFiles << MediaFile {
+                        entry.canonicalPath, fileType,
+                        entry.modificationTime, entry.size, entry.inode
+                    };
 
-                    if(files.count() >= BATCH_SIZE) {
-                        emit loadedFiles(files);
-                        files.clear();
+                    if(mediaFiles.count() >= FILES_PER_TASK) {
+                        queueTask([this, mediaFiles]() { loadMediaFiles(mediaFiles); });
+                        mediaFiles.clear();
                     }
                 }
                 break;
 
             case MediaFileType::Directory:
-                // this should be impossible based on the
-                // QDirIterator settings
-                continue;
+                subdirectories << entry.canonicalPath;
+                queueDirectory(entry.canonicalPath,
+                               QDateTime::fromMSecsSinceEpoch(entry.modificationTime));
+                break;
+
             case MediaFileType::UnusableFile:
                 continue;
             default:
@@ -80,46 +255,222 @@ void DirectoryLoader::startLoading()
         }
     }
 
-    if(!files.isEmpty()) {
-        emit loadedFiles(files);
+    if(!mediaFiles.isEmpty())
+        loadMediaFiles(mediaFiles);
+
+    if(m_directoryCache) {
+        QMutexLocker locker(&m_lock);
+        m_scannedDirs.append(ScannedDirectory { path, modified, entryCount, subdirectories });
+    }
+}
+
+void DirectoryLoader::loadMediaFiles(const QVector<MediaFile> &mediaFiles)
+{
+    FileHandleList files;
+    files.reserve(mediaFiles.count());
+
+    for(const auto &mediaFile : mediaFiles) {
+        // Every file gets its own FileHandle and TagLib::File, and the shared
+        // strings are interned under a lock (see StringShare), so this needs
+        // no synchronization.  The FileHandle is not changed again until it
+        // reaches the GUI thread.
+        FileHandle file(mediaFile.path, mediaFile.type,
+                        QDateTime::fromMSecsSinceEpoch(mediaFile.modificationTime),
+                        mediaFile.size, mediaFile.inode);
+        file.scanTag(); // Ensure tag is read, the collection reads the rest
+        files << file;
     }
+
+    m_parsedFileCount.fetchAndAddRelaxed(files.count());
+
+    addLoadedFiles(files);
 }
 
-MediaFileType classifyFile(const QFileInfo &fileInfo)
+void DirectoryLoader::addLoadedFiles(const FileHandleList &files)
 {
-    const QString path = fileInfo.canonicalFilePath();
+    FileHandleList batch;
 
-    if(fileInfo.isFile() && fileInfo.isReadable() &&
-        MediaFiles::isMediaFile(path))
     {
-        return MediaFileType::MediaFile;
+        QMutexLocker locker(&m_lock);
+        m_loadedFiles << files;
+
+        if(m_loadedFiles.count() < BATCH_SIZE)
+            return;
+
+        batch.swap(m_loadedFiles);
     }
 
-    // These are all the files we care about, anything remaining needs to be a
-    // directory or playlist or it must be unusable
+    emit loadedFiles(batch);
+}
 
-    if(MediaFiles::isPlaylistFile(path)) {
-        return MediaFileType::Playlist;
+#ifdef Q_OS_UNIX
+
+static qint64 modificationTimeOf(const struct stat &st)
+{
+#ifdef Q_OS_DARWIN
+    const struct timespec &modified = st.st_mtimespec;
+#else
+    const struct timespec &modified = st.st_mtim;
+#endif
+
+    return qint64(modified.tv_sec) * 1000 + modified.tv_nsec / 1000000;
+}
+
+// Lists the directory through its file descriptor, with a single fstatat()
+// per entry.  The directory is canonical, so so are the paths of the entries
+// in it, other than symlinks, which are the only ones that need resolving.
+// Only media files are checked for being readable, with faccessat(), which
+// unlike the permission bits takes the owner, ACLs and read-only mounts into
+// account.
+void readDirectory(const QString &path, QVector<DirectoryEntry> *entries)
+{
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+
+    DIR *dir = ::fdopendir(fd);
+    if(!dir) {
+        ::close(fd);
+        return;
     }
 
-    if(fileInfo.isDir()) {
+    const QString prefix = path.endsWith('/') ? path : path + '/';
+
+    while(const struct dirent *dirEntry = ::readdir(dir)) {
+        const char *name = dirEntry->d_name;
+
+        // Hidden, like with QDir's default filter, or . and ..
+        if(name[0] == '.')
+            continue;
+
+        struct stat st;
+        if(::fstatat(fd, name, &st, 0) != 0)
+            continue; // e.g. a dangling symlink
+
+        bool isSymlink = dirEntry->d_type == DT_LNK;
+        if(dirEntry->d_type == DT_UNKNOWN) {
+            struct stat linkStatus;
+            isSymlink = ::fstatat(fd, name, &linkStatus, AT_SYMLINK_NOFOLLOW) == 0 &&
+                S_ISLNK(linkStatus.st_mode);
+        }
+
+        DirectoryEntry entry;
+        entry.canonicalPath = prefix + QFile::decodeName(name);
+
+        if(isSymlink) {
+            entry.canonicalPath = QFileInfo(entry.canonicalPath).canonicalFilePath();
+            if(entry.canonicalPath.isEmpty())
+                continue;
+        }
+
+        entry.isDirectory = S_ISDIR(st.st_mode);
+        entry.isFile = S_ISREG(st.st_mode);
+        entry.fileType = entry.isFile
+            ? MediaFiles::fileType(entry.canonicalPath)
+            : MediaFiles::UnknownFile;
+        entry.isReadable = MediaFiles::isMediaType(entry.fileType) &&
+            ::faccessat(fd, name, R_OK, 0) == 0;
+        entry.modificationTime = modificationTimeOf(st);
+        entry.size = st.st_size;
+        entry.inode = st.st_ino;
+
+        entries->append(entry);
+    }
+
+    ::closedir(dir); // Closes fd as well
+}
+
+bool directoryModificationTime(const QString &path, QDateTime *modified)
+{
+    struct stat st;
+    if(::stat(QFile::encodeName(path).constData(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return false;
+
+    *modified = QDateTime::fromMSecsSinceEpoch(modificationTimeOf(st));
+    return true;
+}
+
+#else
+
+void readDirectory(const QString &path, QVector<DirectoryEntry> *entries)
+{
+    QDirIterator dirIterator(path, QDir::AllEntries | QDir::NoDotAndDotDot);
+
+    while(dirIterator.hasNext()) {
+        dirIterator.next();
+        const QFileInfo fileInfo = dirIterator.fileInfo();
+
+        const QString canonicalPath = fileInfo.canonicalFilePath();
+        const MediaFiles::FileType fileType = fileInfo.isFile()
+            ? MediaFiles::fileType(canonicalPath)
+            : MediaFiles::UnknownFile;
+
+        entries->append(DirectoryEntry {
+            canonicalPath,
+            fileInfo.isDir(),
+            fileInfo.isFile(),
+            MediaFiles::isMediaType(fileType) && fileInfo.isReadable(),
+            fileType,
+            fileInfo.lastModified().toMSecsSinceEpoch(),
+            fileInfo.size(),
+            0
+        });
+    }
+}
+
+bool directoryModificationTime(const QString &path, QDateTime *modified)
+{
+    const QFileInfo dirInfo(path);
+    if(!dirInfo.isDir())
+        return false;
+
+    *modified = dirInfo.lastModified();
+    return true;
+}
+
+#endif
+
+MediaFileType classifyFile(const DirectoryEntry &entry, MediaFiles::FileType *fileType)
+{
+    if(entry.isDirectory) {
         return MediaFileType::Directory;
     }
 
+    // Classified just once while listing, the type is handed on to the tag
+    // reader.
+    *fileType = entry.fileType;
+
+    if(MediaFiles::isMediaType(*fileType) && entry.isFile && entry.isReadable) {
+        return MediaFileType::MediaFile;
+    }
+
+    // These are all the files we care about, anything remaining needs to be
+    // a playlist or it must be unusable
+
+    if(*fileType == MediaFiles::PlaylistFile) {
+        return MediaFileType::Playlist;
+    }
+
     return MediaFileType::UnusableFile;
 }
 
-FileHandle loadMediaFile(const QString &fileName)
+qint64 processStatistic(const char *fileName, const QByteArray &key)
 {
-    // Just because our GUI thread accesses are serialized by signal/slot magic
-    // doesn't mean that our non-GUI threads don't require deconfliction
-    // Neither FileHandle nor TagLib are not thread-safe so synchronize access
-    // to this function.
-    static QMutex fhLock;
-    QMutexLocker locker(&fhLock);
+#ifdef Q_OS_LINUX
+    // Lines like "rchar: 1234" or "VmHWM:     5678 kB"
+    QFile f(QString::fromLatin1(fileName));
+    if(!f.open(QIODevice::ReadOnly))
+        return -1;
 
-    FileHandle loadedMetadata(fileName);
-    (void) loadedMetadata.tag(); // Ensure tag is read
+    const QList<QByteArray> lines = f.readAll().split('\n');
+    for(const QByteArray &line : lines) {
+        if(line.startsWith(key))
+            return line.mid(key.size()).simplified().split(' ').value(0).toLongLong();
+    }
+#else
+    Q_UNUSED(fileName);
+    Q_UNUSED(key);
+#endif
 
-    return loadedMetadata;
+    return -1;
 }
@@ -17,21 +17,68 @@
 #ifndef JUK_DIRECTORYLOADER_H
 #define JUK_DIRECTORYLOADER_H
 
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QHash>
 #include <QObject>
-#include <QDirIterator>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
 
 #include "filehandle.h"
+#include "mediafiles.h"
+
+class QDateTime;
+class QThreadPool;
+
+class DirectoryCache;
 
 /**
  * Loads music files and their metadata from a given directory, emitting loaded
  * files in a batch periodically. Intended for use in a separate thread as a
  * worker object.
+ *
+ * The directory tree is scanned by a thread pool shared by all loaders: each
+ * subdirectory is queued as a task of its own, and large directories have
+ * their files read in several tasks, so idle threads pick up whatever part of
+ * any tree is left.  The number of threads is read from the ScanThreads entry
+ * of the Settings group, defaulting to the number of cores.
+ *
+ * If a DirectoryCache is given, directories that did not change since they
+ * were last scanned are not listed again, only their subdirectories are
+ * checked.  The directories scanned are only added to the cache by
+ * recordScannedDirectories(), once the files found are in the collection.
  */
 class DirectoryLoader : public QObject {
     Q_OBJECT
 
 public:
-    DirectoryLoader(const QString &dir, QObject *parent = nullptr);
+    DirectoryLoader(const QString &dir, DirectoryCache *directoryCache = nullptr,
+                    QObject *parent = nullptr);
+
+    /**
+     * Files in @p knownFiles are only read if their modification time
+     * differs.  Must be called before startLoading().
+     */
+    void setKnownFiles(const QHash<QString, qint64> &knownFiles) { m_knownFiles = knownFiles; }
+
+    /**
+     * The number of media files that were read and that were skipped as
+     * known.  Only valid once loading has finished.
+     */
+    int parsedFileCount() const { return m_parsedFileCount.loadAcquire(); }
+    int skippedFileCount() const { return m_skippedFileCount.loadAcquire(); }
+
+    /**
+     * Adds the directories scanned to the DirectoryCache.  To be called from
+     * the GUI thread once loading has finished and every loadedFiles() signal
+     * has been handled, so that the cache never lists a directory whose files
+     * are not all in the collection yet.
+     */
+    void recordScannedDirectories();
 
 public slots:
     void startLoading();
@@ -41,7 +88,47 @@ signals:
     void loadedPlaylist(QString fileName);
 
 private:
-    QDirIterator m_dirIterator;
+    struct MediaFile
+    {
+        QString path;
+        MediaFiles::FileType type;
+        qint64 modificationTime;
+        qint64 size;
+        quint64 inode;
+    };
+
+    static QThreadPool *scanPool();
+
+    template<class Function>
+    void queueTask(Function task);
+
+    void queueDirectory(const QString &path, const QDateTime &modified);
+    void scanDirectory(const QString &path, const QDateTime &modified);
+    void loadMediaFiles(const QVector<MediaFile> &mediaFiles);
+    void addLoadedFiles(const FileHandleList &files);
+
+    struct ScannedDirectory
+    {
+        QString path;
+        QDateTime modified;
+        int entryCount;
+        QStringList subdirectories;
+    };
+
+    QString m_dir;
+    DirectoryCache *m_directoryCache;
+    QHash<QString, qint64> m_knownFiles; // Read-only while loading
+    QAtomicInt m_parsedFileCount;
+    QAtomicInt m_skippedFileCount;
+
+    QMutex m_lock; // Protects everything below
+    QWaitCondition m_tasksDone;
+    int m_pendingTasks;
+    QSet<QString> m_visitedDirs;
+    FileHandleList m_loadedFiles;
+    QVector<ScannedDirectory> m_scannedDirs;
+    int m_skippedDirCount;
+    int m_skippedEntryCount;
 };
 
 #endif // JUK_DIRECTORYLOADER_H
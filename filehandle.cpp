@@ -17,6 +17,7 @@
 
 #include "filehandle.h"
 
+#include <QDateTime>
 #include <QFileInfo>
 #include <QSharedData>
 #include <QScopedPointer>
@@ -24,6 +25,7 @@
 #include "filehandleproperties.h"
 #include "juktag.h"
 #include "cache.h"
+#include "cachefile.h"
 #include "coverinfo.h"
 #include "juk_debug.h"
 
@@ -43,13 +45,33 @@ AddProperty(Extension, fileInfo().suffix())
 class FileHandle::FileHandlePrivate : public QSharedData
 {
 public:
-    FileHandlePrivate(QFileInfo fInfo)
+    FileHandlePrivate(QFileInfo fInfo, MediaFiles::FileType type = MediaFiles::UnknownFile)
         : tag(nullptr)
         , coverInfo(nullptr)
         , fileInfo(fInfo)
         , absFilePath(fInfo.canonicalFilePath())
+        , baseSize(-1)
+        , baseInode(0)
+        , persistentId(0)
+        , fileType(type)
     {
         baseModificationTime = fileInfo.lastModified();
+        if(fileInfo.exists())
+            baseSize = fileInfo.size();
+    }
+
+    FileHandlePrivate(const QString &canonicalPath, const QDateTime &modificationTime,
+                      qint64 size, quint64 inode)
+        : tag(nullptr)
+        , coverInfo(nullptr)
+        , fileInfo(canonicalPath)
+        , absFilePath(canonicalPath)
+        , baseModificationTime(modificationTime)
+        , baseSize(size)
+        , baseInode(inode)
+        , persistentId(0)
+        , fileType(MediaFiles::UnknownFile)
+    {
     }
 
     mutable QScopedPointer<Tag> tag;
@@ -57,6 +79,10 @@ public:
     QFileInfo fileInfo;
     QString absFilePath;
     QDateTime baseModificationTime;
+    qint64 baseSize;
+    quint64 baseInode;
+    quint64 persistentId;
+    MediaFiles::FileType fileType;
     mutable QDateTime lastModified;
 };
 
@@ -74,6 +100,18 @@ FileHandle::FileHandle(const QFileInfo &info) :
 {
 }
 
+FileHandle::FileHandle(const QFileInfo &info, MediaFiles::FileType type) :
+    d(new FileHandlePrivate(info, type))
+{
+}
+
+FileHandle::FileHandle(const QString &canonicalPath, MediaFiles::FileType type,
+                       const QDateTime &modificationTime, qint64 size, quint64 inode) :
+    d(new FileHandlePrivate(canonicalPath, modificationTime, size, inode))
+{
+    d->fileType = type;
+}
+
 FileHandle::FileHandle()
     : FileHandle(QFileInfo()) // delegating ctor
 {
@@ -91,12 +129,34 @@ FileHandle::FileHandle(const QString &path, CacheDataStream &s)
         read(s);
 }
 
+FileHandle::FileHandle(const QString &canonicalPath, const CacheTrackRecord &record,
+                       const CacheStringTable &strings)
+    : d(new FileHandlePrivate(
+            canonicalPath,
+            record.modificationTime >= 0
+                ? QDateTime::fromMSecsSinceEpoch(record.modificationTime)
+                : QDateTime(),
+            record.size,
+            record.inode))
+{
+    if(record.fileType <= MediaFiles::OggFile)
+        d->fileType = MediaFiles::FileType(record.fileType);
+
+    d->tag.reset(new Tag(d->absFilePath, &record, &strings));
+}
+
 FileHandle::~FileHandle() = default;
 
 void FileHandle::refresh()
 {
     d->fileInfo.refresh();
-    d->tag.reset(new Tag(d->absFilePath));
+    d->tag.reset(new Tag(d->absFilePath, d->fileType));
+
+    // The tag is current as of now.
+    d->lastModified = QDateTime();
+    d->baseModificationTime = d->fileInfo.lastModified();
+    d->baseSize = d->fileInfo.exists() ? d->fileInfo.size() : -1;
+    d->baseInode = 0;
 }
 
 void FileHandle::setFile(const QString &path)
@@ -111,17 +171,25 @@ void FileHandle::setFile(const QString &path)
         return;
     }
 
+    const quint64 id = d->persistentId;
     d = new FileHandlePrivate(QFileInfo(path));
+    d->persistentId = id;
 }
 
 Tag *FileHandle::tag() const
 {
     if(Q_UNLIKELY(!d->tag))
-        d->tag.reset(new Tag(d->absFilePath));
+        d->tag.reset(new Tag(d->absFilePath, d->fileType));
 
     return d->tag.data();
 }
 
+void FileHandle::scanTag() const
+{
+    if(!d->tag)
+        d->tag.reset(new Tag(d->absFilePath, d->fileType, Tag::ScanRead));
+}
+
 CoverInfo *FileHandle::coverInfo() const
 {
     if(Q_UNLIKELY(!d->coverInfo))
@@ -152,6 +220,42 @@ bool FileHandle::current() const
             d->baseModificationTime >= lastModified());
 }
 
+QDateTime FileHandle::baseModificationTime() const
+{
+    return d->baseModificationTime;
+}
+
+qint64 FileHandle::baseSize() const
+{
+    return d->baseSize;
+}
+
+quint64 FileHandle::baseInode() const
+{
+    return d->baseInode;
+}
+
+void FileHandle::setBaseFileStatus(qint64 size, quint64 inode)
+{
+    d->baseSize = size;
+    d->baseInode = inode;
+}
+
+MediaFiles::FileType FileHandle::fileType() const
+{
+    return d->fileType;
+}
+
+quint64 FileHandle::persistentId() const
+{
+    return d->persistentId;
+}
+
+void FileHandle::setPersistentId(quint64 id)
+{
+    d->persistentId = id;
+}
+
 const QDateTime &FileHandle::lastModified() const
 {
     if(d->lastModified.isNull())
@@ -21,6 +21,8 @@
 #include <QVector>
 #include <QMetaType>
 
+#include "mediafiles.h"
+
 class QString;
 class QFileInfo;
 class QDateTime;
@@ -30,6 +32,8 @@ class QStringList;
 class CoverInfo;
 class Tag;
 class CacheDataStream;
+class CacheStringTable;
+struct CacheTrackRecord;
 
 /**
  * A value based, explicitly shared wrapper around file related information
@@ -42,9 +46,30 @@ public:
     FileHandle();
     FileHandle(const FileHandle &f);
     explicit FileHandle(const QFileInfo &info);
+
+    /**
+     * For files already classified, e.g. by the DirectoryLoader, so that
+     * reading the tag does not need to do it again.
+     */
+    FileHandle(const QFileInfo &info, MediaFiles::FileType type);
+
+    /**
+     * For files the DirectoryLoader found, which already knows the canonical
+     * path and status of the file, so that none of it is looked up again.
+     */
+    FileHandle(const QString &canonicalPath, MediaFiles::FileType type,
+               const QDateTime &modificationTime, qint64 size, quint64 inode);
     explicit FileHandle(const QString &path);
     FileHandle(const QString &path, CacheDataStream &s);
 
+    /**
+     * Restores a file from a record of the mapped collection cache.  The path
+     * stored in the cache is already canonical and the tag was current as of
+     * the stored modification time, so this does not touch the disk.
+     */
+    FileHandle(const QString &canonicalPath, const CacheTrackRecord &record,
+               const CacheStringTable &strings);
+
     // manually declared so its definition can be delayed until .cpp
     ~FileHandle();
 
@@ -55,6 +80,13 @@ public:
     void setFile(const QString &path);
 
     Tag *tag() const;
+
+    /**
+     * Reads the tag like tag() does, but only as much of the file as a folder
+     * scan needs (see Tag::ScanRead).  Does nothing if the tag is already
+     * there.
+     */
+    void scanTag() const;
     CoverInfo *coverInfo() const;
     QString absFilePath() const;
     const QFileInfo &fileInfo() const;
@@ -63,6 +95,31 @@ public:
     bool current() const;
     const QDateTime &lastModified() const;
 
+    /**
+     * The modification time, size and inode of the file as of when its tag
+     * was read, which tell whether the tag is still current without reading
+     * it again.  The size is -1 and the inode 0 where they are not known.
+     */
+    QDateTime baseModificationTime() const;
+    qint64 baseSize() const;
+    quint64 baseInode() const;
+    void setBaseFileStatus(qint64 size, quint64 inode);
+
+    /**
+     * The type of the file if it is already known, MediaFiles::UnknownFile
+     * otherwise.
+     */
+    MediaFiles::FileType fileType() const;
+
+    /**
+     * The number that identifies the track within the collection, kept in the
+     * cache so that it stays the same from one run to the next.  It is handed
+     * out by the CollectionList, 0 means none has been assigned yet.  Shared
+     * by every copy of this FileHandle, and kept by setFile().
+     */
+    quint64 persistentId() const;
+    void setPersistentId(quint64 id);
+
     void read(CacheDataStream &s);
 
     FileHandle &operator=(const FileHandle &f);
@@ -20,6 +20,7 @@
 
 #include <KLocalizedString>
 
+#include "cache.h"
 #include "collectionlist.h"
 #include "playermanager.h"
 #include "juk-exception.h"
@@ -101,7 +102,7 @@ void HistoryPlaylistItem::setDateTime(const QDateTime &dt)
 // helper functions
 ////////////////////////////////////////////////////////////////////////////////
 
-QDataStream &operator<<(QDataStream &s, const HistoryPlaylist &p)
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const HistoryPlaylist &p)
 {
     PlaylistItemList l = const_cast<HistoryPlaylist *>(&p)->items();
 
@@ -109,31 +110,30 @@ QDataStream &operator<<(QDataStream &s, const HistoryPlaylist &p)
 
     for(PlaylistItemList::ConstIterator it = l.constBegin(); it != l.constEnd(); ++it) {
         const HistoryPlaylistItem *i = static_cast<HistoryPlaylistItem *>(*it);
-        s << i->file().absFilePath();
+        s.writeTrack(i->file());
         s << i->dateTime();
     }
 
     return s;
 }
 
-QDataStream &operator>>(QDataStream &s, HistoryPlaylist &p)
+PlaylistDataStream &operator>>(PlaylistDataStream &s, HistoryPlaylist &p)
 {
     qint32 count;
     s >> count;
 
     HistoryPlaylistItem *after = 0;
 
-    QString fileName;
     QDateTime dateTime;
 
     for(int i = 0; i < count; i++) {
-        s >> fileName;
+        const FileHandle file = s.readTrack();
         s >> dateTime;
 
-        if(fileName.isEmpty() || !dateTime.isValid())
+        if(!dateTime.isValid())
             throw BICStreamException();
 
-        HistoryPlaylistItem *a = p.createItem(FileHandle(fileName), after);
+        HistoryPlaylistItem *a = p.createItem(file, after);
         if(Q_LIKELY(a)) {
             after = a;
             after->setDateTime(dateTime);
@@ -64,8 +64,8 @@ private:
     QTimer *m_timer;
 };
 
-QDataStream &operator<<(QDataStream &s, const HistoryPlaylist &p);
-QDataStream &operator>>(QDataStream &s, HistoryPlaylist &p);
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const HistoryPlaylist &p);
+PlaylistDataStream &operator>>(PlaylistDataStream &s, HistoryPlaylist &p);
 
 #endif
 
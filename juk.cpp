@@ -235,6 +235,14 @@ void JuK::setupLayout()
             m_statusLabel, &StatusLabel::setItemTotalTime);
     connect(m_splitter, &PlaylistSplitter::currentPlaylistChanged,
             m_statusLabel, &StatusLabel::slotCurrentPlaylistHasChanged);
+    connect(CollectionList::instance(), &CollectionList::cacheCheckProgress,
+            m_statusLabel, [this](int checked, int total) {
+                m_statusLabel->showProgress(i18n("Checking collection"), checked, total);
+            });
+    connect(CollectionList::instance(), &CollectionList::playlistLoadProgress,
+            m_statusLabel, [this](int checked, int total) {
+                m_statusLabel->showProgress(i18n("Loading playlists"), checked, total);
+            });
 
     m_splitter->setFocus();
 }
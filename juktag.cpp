@@ -31,33 +31,69 @@
 #include "stringshare.h"
 #include "juk_debug.h"
 
+static QString lengthStringFor(int totalSeconds)
+{
+    const int seconds = totalSeconds % 60;
+    const int minutes = (totalSeconds - seconds) / 60;
+
+    return QString::number(minutes) + (seconds >= 10 ? ":" : ":0") + QString::number(seconds);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // public members
 ////////////////////////////////////////////////////////////////////////////////
 
 
-Tag::Tag(const QString &fileName) :
+Tag::Tag(const QString &fileName, MediaFiles::FileType type, ReadStyle style) :
     m_fileName(fileName),
     m_track(0),
     m_year(0),
     m_seconds(0),
     m_bitrate(0),
-    m_isValid(false)
+    m_isValid(false),
+    m_hasAudioProperties(false),
+    m_record(nullptr),
+    m_strings(nullptr)
 {
     if(fileName.isEmpty()) {
         qCCritical(JUK_LOG) << "Trying to add empty file";
         return;
     }
 
-    TagLib::File *file = MediaFiles::fileFactoryByType(fileName);
+    if(type == MediaFiles::UnknownFile)
+        type = MediaFiles::fileType(fileName);
+
+    TagLib::File *file = style == ScanRead
+        ? MediaFiles::scanFileByType(fileName, type)
+        : MediaFiles::fileFactoryByType(fileName, type);
+
     if(file && file->isValid()) {
         setup(file);
-        delete file;
+
+        // Estimates are shown until the full read replaces them.
+        bool exact = true;
+        if(style == ScanRead && MediaFiles::hasScanAudioProperties(type, &exact) && !exact)
+            m_hasAudioProperties = false;
     }
     else {
         qCCritical(JUK_LOG) << "Couldn't resolve the mime type of \"" <<
             fileName << "\" -- this shouldn't happen.";
     }
+
+    delete file;
+}
+
+Tag::Tag(const QString &fileName, const CacheTrackRecord *record, const CacheStringTable *strings) :
+    m_fileName(fileName),
+    m_track(0),
+    m_year(0),
+    m_seconds(0),
+    m_bitrate(0),
+    m_isValid(true),
+    m_hasAudioProperties(false),
+    m_record(record),
+    m_strings(strings)
+{
 }
 
 bool Tag::save() const
@@ -67,13 +103,13 @@ bool Tag::save() const
     TagLib::File *file = MediaFiles::fileFactoryByType(m_fileName);
 
     if(file && !file->readOnly() && file->isValid() && file->tag()) {
-        file->tag()->setTitle(TagLib::String(m_title.toUtf8().constData(), TagLib::String::UTF8));
-        file->tag()->setArtist(TagLib::String(m_artist.toUtf8().constData(), TagLib::String::UTF8));
-        file->tag()->setAlbum(TagLib::String(m_album.toUtf8().constData(), TagLib::String::UTF8));
-        file->tag()->setGenre(TagLib::String(m_genre.toUtf8().constData(), TagLib::String::UTF8));
-        file->tag()->setComment(TagLib::String(m_comment.toUtf8().constData(), TagLib::String::UTF8));
-        file->tag()->setTrack(m_track);
-        file->tag()->setYear(m_year);
+        file->tag()->setTitle(TagLib::String(title().toUtf8().constData(), TagLib::String::UTF8));
+        file->tag()->setArtist(TagLib::String(artist().toUtf8().constData(), TagLib::String::UTF8));
+        file->tag()->setAlbum(TagLib::String(album().toUtf8().constData(), TagLib::String::UTF8));
+        file->tag()->setGenre(TagLib::String(genre().toUtf8().constData(), TagLib::String::UTF8));
+        file->tag()->setComment(TagLib::String(comment().toUtf8().constData(), TagLib::String::UTF8));
+        file->tag()->setTrack(track());
+        file->tag()->setYear(year());
         result = file->save();
     }
     else {
@@ -85,6 +121,44 @@ bool Tag::save() const
     return result;
 }
 
+void Tag::setAudioProperties(int seconds, int bitrate)
+{
+    detachFromCache();
+
+    m_seconds = seconds;
+    m_bitrate = bitrate;
+    m_hasAudioProperties = true;
+    m_lengthString = lengthStringFor(m_seconds);
+}
+
+bool Tag::readAudioProperties(const QString &fileName, MediaFiles::FileType type,
+                              int *seconds, int *bitrate) // static
+{
+    TagLib::File *file = type == MediaFiles::UnknownFile
+        ? MediaFiles::fileFactoryByType(fileName)
+        : MediaFiles::fileFactoryByType(fileName, type);
+
+    if(!file || !file->isValid() || !file->audioProperties()) {
+        delete file;
+        return false;
+    }
+
+    *seconds = file->audioProperties()->length();
+    *bitrate = file->audioProperties()->bitrate();
+
+    delete file;
+    return true;
+}
+
+QString Tag::lengthString() const
+{
+    // Cached tags only compute this when it's asked for
+    if(m_lengthString.isNull())
+        m_lengthString = lengthStringFor(seconds());
+
+    return m_lengthString;
+}
+
 QString Tag::playingString() const
 {
     QString str;
@@ -153,6 +227,9 @@ CacheDataStream &Tag::read(CacheDataStream &s)
     }
     }
 
+    // Not stored in this format, see CacheJournal for where it matters.
+    m_hasAudioProperties = m_seconds != 0 || m_bitrate != 0;
+
     minimizeMemoryUsage();
     return s;
 }
@@ -167,9 +244,34 @@ Tag::Tag(const QString &fileName, bool) :
     m_year(0),
     m_seconds(0),
     m_bitrate(0),
-    m_isValid(true)
+    m_isValid(true),
+    m_hasAudioProperties(false),
+    m_record(nullptr),
+    m_strings(nullptr)
+{
+
+}
+
+void Tag::detachFromCache()
 {
+    if(!m_record)
+        return;
 
+    const CacheTrackRecord *record = m_record;
+    const CacheStringTable *strings = m_strings;
+    m_record = nullptr;
+    m_strings = nullptr;
+
+    m_title   = strings->string(record->title);
+    m_artist  = strings->string(record->artist);
+    m_album   = strings->string(record->album);
+    m_genre   = strings->string(record->genre);
+    m_comment = strings->string(record->comment);
+    m_track   = record->track;
+    m_year    = record->year;
+    m_seconds = record->seconds;
+    m_bitrate = record->bitrate;
+    m_hasAudioProperties = (record->flags & CacheTrackRecord::AudioPropertiesRead) != 0;
 }
 
 void Tag::setup(TagLib::File *file)
@@ -188,13 +290,14 @@ void Tag::setup(TagLib::File *file)
     m_track = file->tag()->track();
     m_year  = file->tag()->year();
 
-    m_seconds = file->audioProperties()->length();
-    m_bitrate = file->audioProperties()->bitrate();
-
-    const int seconds = m_seconds % 60;
-    const int minutes = (m_seconds - seconds) / 60;
+    // Not read by a ScanRead of every format.
+    if(file->audioProperties()) {
+        m_seconds = file->audioProperties()->length();
+        m_bitrate = file->audioProperties()->bitrate();
+        m_hasAudioProperties = true;
+    }
 
-    m_lengthString = QString::number(minutes) + (seconds >= 10 ? ":" : ":0") + QString::number(seconds);
+    m_lengthString = lengthStringFor(m_seconds);
 
     if(m_title.isEmpty()) {
         int i = m_fileName.lastIndexOf('/');
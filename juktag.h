@@ -22,6 +22,9 @@
 
 namespace TagLib { class File; }
 
+#include "cachefile.h"
+#include "mediafiles.h"
+
 class CacheDataStream;
 
 /*!
@@ -33,36 +36,79 @@ class Tag
 {
     friend class FileHandle;
 public:
-    Tag(const QString &fileName);
+    /**
+     * How much of a file is read.  ScanRead skips ID3v2 pictures and only
+     * reads the audio properties TagLib can estimate quickly, see
+     * MediaFiles::scanFileByType().  Ogg files would have to be read near
+     * their end.  The exact length and bitrate of MP3 and Ogg files are read
+     * later, see hasAudioProperties().
+     */
+    enum ReadStyle { FullRead, ScanRead };
+
+    /**
+     * Reads the tag of @p fileName, which is classified first unless its
+     * @p type is already known.
+     */
+    Tag(const QString &fileName, MediaFiles::FileType type = MediaFiles::UnknownFile,
+        ReadStyle style = FullRead);
     /**
      * Create an empty tag.  Used in FileHandle for cache restoration.
      */
     Tag(const QString &fileName, bool);
 
+    /**
+     * Create a tag backed by a record of the mapped collection cache.  The
+     * fields are only turned into strings when they are first asked for, and
+     * are copied out of the cache once any of them is changed.  Both @p record
+     * and @p strings must outlive the tag.
+     */
+    Tag(const QString &fileName, const CacheTrackRecord *record, const CacheStringTable *strings);
+
     bool save() const;
 
-    QString title() const { return m_title; }
-    QString artist() const { return m_artist; }
-    QString album() const { return m_album; }
-    QString genre() const { return m_genre; }
-    int track() const { return m_track; }
-    int year() const { return m_year; }
-    QString comment() const { return m_comment; }
+    QString title() const { return m_record ? m_strings->string(m_record->title) : m_title; }
+    QString artist() const { return m_record ? m_strings->string(m_record->artist) : m_artist; }
+    QString album() const { return m_record ? m_strings->string(m_record->album) : m_album; }
+    QString genre() const { return m_record ? m_strings->string(m_record->genre) : m_genre; }
+    int track() const { return m_record ? m_record->track : m_track; }
+    int year() const { return m_record ? m_record->year : m_year; }
+    QString comment() const { return m_record ? m_strings->string(m_record->comment) : m_comment; }
 
     QString fileName() const { return m_fileName; }
 
-    void setTitle(const QString &value) { m_title = value; }
-    void setArtist(const QString &value) { m_artist = value; }
-    void setAlbum(const QString &value) { m_album = value; }
-    void setGenre(const QString &value) { m_genre = value; }
-    void setTrack(int value) { m_track = value; }
-    void setYear(int value) { m_year = value; }
-    void setComment(const QString &value) { m_comment = value; }
+    void setTitle(const QString &value) { detachFromCache(); m_title = value; }
+    void setArtist(const QString &value) { detachFromCache(); m_artist = value; }
+    void setAlbum(const QString &value) { detachFromCache(); m_album = value; }
+    void setGenre(const QString &value) { detachFromCache(); m_genre = value; }
+    void setTrack(int value) { detachFromCache(); m_track = value; }
+    void setYear(int value) { detachFromCache(); m_year = value; }
+    void setComment(const QString &value) { detachFromCache(); m_comment = value; }
 
     void setFileName(const QString &value) { m_fileName = value; }
 
-    int seconds() const { return m_seconds; }
-    int bitrate() const { return m_bitrate; }
+    int seconds() const { return m_record ? m_record->seconds : m_seconds; }
+    int bitrate() const { return m_record ? m_record->bitrate : m_bitrate; }
+
+    /**
+     * Returns false if the length and bitrate are not known yet or are only
+     * estimated, e.g. after a ScanRead.  Kept in the cache, so this is also the case for tags that
+     * are read from it before the properties were filled in.
+     */
+    bool hasAudioProperties() const
+    {
+        return m_record ? (m_record->flags & CacheTrackRecord::AudioPropertiesRead) != 0
+                        : m_hasAudioProperties;
+    }
+    void setAudioProperties(int seconds, int bitrate);
+
+    /**
+     * Reads just the length and bitrate of @p fileName, which is classified
+     * first unless its @p type is already known.  TagLib has no way to skip
+     * the tag, so it is still parsed.  Returns false if the file could not
+     * be read.
+     */
+    static bool readAudioProperties(const QString &fileName, MediaFiles::FileType type,
+                                    int *seconds, int *bitrate);
 
     bool isValid() const { return m_isValid; }
 
@@ -70,7 +116,7 @@ public:
      * As a convenience, since producing a length string from a number of second
      * isn't a one liner, provide the length in string form.
      */
-    QString lengthString() const { return m_lengthString; }
+    QString lengthString() const;
 
     /**
      * Convenience function to return a concise string describing the track,
@@ -83,6 +129,7 @@ public:
 private:
     void setup(TagLib::File *file);
     void minimizeMemoryUsage();
+    void detachFromCache();
 
     QString m_fileName;
     QString m_title;
@@ -95,8 +142,13 @@ private:
     int m_seconds;
     int m_bitrate;
     QDateTime m_modificationTime;
-    QString m_lengthString;
+    mutable QString m_lengthString;
     bool m_isValid;
+    bool m_hasAudioProperties;
+
+    // Used instead of the fields above until detachFromCache()
+    const CacheTrackRecord *m_record;
+    const CacheStringTable *m_strings;
 };
 
 QDataStream &operator<<(QDataStream &s, const Tag &t);
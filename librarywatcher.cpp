@@ -0,0 +1,553 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "librarywatcher.h"
+
+#include <KDirLister>
+#include <KFileItem>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QtConcurrent>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "juk_debug.h"
+
+// Changes are delivered once no event came in for this long...
+static const int flushDelay = 750;
+
+// ...but no later than this after the first one, even if events keep coming.
+static const int maximumFlushDelay = 5000;
+
+#ifdef Q_OS_LINUX
+static const uint32_t inotifyMask =
+    IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+    IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+#endif
+
+static bool isBelowFolder(const QString &path, const QStringList &folders)
+{
+    for(const auto &folder : folders) {
+        if(path.startsWith(folder))
+            return true;
+    }
+
+    return false;
+}
+
+// Returns whether one of the directories above path is in directories.
+static bool hasAncestorIn(const QString &path, const QSet<QString> &directories)
+{
+    int slash = path.lastIndexOf('/');
+
+    while(slash > 0) {
+        if(directories.contains(path.left(slash)))
+            return true;
+        slash = path.lastIndexOf('/', slash - 1);
+    }
+
+    return false;
+}
+
+// Lists folders and all directories below them, other than the excluded ones.
+// Run in a separate thread for the music folders.
+static QStringList listDirectories(const QStringList &folders, const QStringList &excludedFolders)
+{
+    QStringList directories;
+    QSet<QString> seen;
+    QStringList pending;
+
+    for(const auto &folder : folders) {
+        const QString canonicalFolder = QDir(folder).canonicalPath();
+        if(!canonicalFolder.isEmpty())
+            pending.append(canonicalFolder);
+    }
+
+    while(!pending.isEmpty()) {
+        const QString directory = pending.takeLast();
+
+        if(seen.contains(directory) || isBelowFolder(directory, excludedFolders))
+            continue;
+
+        seen.insert(directory);
+        directories.append(directory);
+
+        QDirIterator it(directory, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | QDir::Hidden);
+        while(it.hasNext())
+            pending.append(it.next());
+    }
+
+    return directories;
+}
+
+LibraryWatcher::LibraryWatcher(QObject *parent)
+    : QObject(parent)
+    , m_enabled(false)
+    , m_watching(false)
+    , m_rescanNeeded(false)
+    , m_inotifyFd(-1)
+    , m_inotifyNotifier(nullptr)
+    , m_watchGeneration(0)
+    , m_watchLimitReached(false)
+    , m_dirLister(nullptr)
+{
+    m_flushTimer.setSingleShot(true);
+    connect(&m_flushTimer, &QTimer::timeout, this, &LibraryWatcher::flush);
+}
+
+LibraryWatcher::~LibraryWatcher()
+{
+    stopWatching();
+
+#ifdef Q_OS_LINUX
+    if(m_inotifyFd >= 0)
+        ::close(m_inotifyFd);
+#endif
+
+    qCDebug(JUK_LOG) << "Library watcher saw" << m_statistics.created << "created,"
+                     << m_statistics.modified << "modified and" << m_statistics.removed
+                     << "removed paths," << m_statistics.overflows << "overflows;"
+                     << m_statistics.delivered << "changes in" << m_statistics.batches
+                     << "batches," << m_statistics.coalesced << "coalesced,"
+                     << m_statistics.ignored << "ignored";
+}
+
+void LibraryWatcher::setFolders(const QStringList &folders, const QStringList &excludedFolders)
+{
+    if(folders == m_folders && excludedFolders == m_excludedFolders)
+        return;
+
+    m_folders = folders;
+    m_excludedFolders = excludedFolders;
+
+    if(m_watching) {
+        stopWatching();
+        startWatching();
+    }
+}
+
+void LibraryWatcher::setEnabled(bool enable)
+{
+    m_enabled = enable;
+
+    if(m_enabled && !m_watching)
+        startWatching();
+}
+
+void LibraryWatcher::addChangedPath(const QString &path)
+{
+    recordEvent(path, Modified, QFileInfo(path).isDir());
+}
+
+void LibraryWatcher::flush()
+{
+    m_flushTimer.stop();
+
+    if(m_pending.isEmpty() && !m_rescanNeeded)
+        return;
+
+    LibraryChanges changes;
+    changes.rescanNeeded = m_rescanNeeded;
+
+    QSet<QString> addedDirectories;
+    QSet<QString> removedDirectories;
+
+    for(auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+        if(!it->isDirectory)
+            continue;
+
+        if(it->type == Removed)
+            removedDirectories.insert(it.key());
+        else
+            addedDirectories.insert(it.key());
+    }
+
+    // Whatever happened below a directory that is scanned or removed as a
+    // whole is covered by that.
+
+    for(auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it) {
+        const QString &path = it.key();
+
+        if(it->type == Removed) {
+            if(hasAncestorIn(path, removedDirectories))
+                continue;
+
+            if(it->isDirectory)
+                changes.removedDirectories.append(path);
+            else
+                changes.removedFiles.append(path);
+        }
+        else {
+            if(hasAncestorIn(path, addedDirectories))
+                continue;
+
+            if(it->isDirectory)
+                changes.addedDirectories.append(path);
+            else if(it->type == Created)
+                changes.addedFiles.append(path);
+            else
+                changes.changedFiles.append(path);
+        }
+    }
+
+    const int count = changes.addedFiles.count() + changes.changedFiles.count() +
+        changes.removedFiles.count() + changes.addedDirectories.count() +
+        changes.removedDirectories.count();
+
+    m_statistics.delivered += count;
+    ++m_statistics.batches;
+
+    qCDebug(JUK_LOG) << "Delivering" << count << "library changes from" << m_pending.count()
+                     << "paths:" << changes.addedFiles.count() << "added,"
+                     << changes.changedFiles.count() << "changed,"
+                     << changes.removedFiles.count() << "removed files,"
+                     << changes.addedDirectories.count() << "added,"
+                     << changes.removedDirectories.count() << "removed directories"
+                     << (changes.rescanNeeded ? "(events lost)" : "");
+
+    m_pending.clear();
+    m_rescanNeeded = false;
+
+    emit changesReady(changes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+void LibraryWatcher::recordEvent(const QString &path, ChangeType type, bool isDirectory)
+{
+    switch(type) {
+    case Created:
+        ++m_statistics.created;
+        break;
+    case Modified:
+        ++m_statistics.modified;
+        break;
+    case Removed:
+        ++m_statistics.removed;
+        break;
+    }
+
+    if(!m_enabled || isExcluded(path)) {
+        ++m_statistics.ignored;
+        return;
+    }
+
+    const auto it = m_pending.find(path);
+
+    if(it == m_pending.end()) {
+        if(m_pending.isEmpty() && !m_flushTimer.isActive())
+            m_firstPending.start();
+
+        m_pending.insert(path, PendingChange { type, isDirectory });
+    }
+    else {
+        ++m_statistics.coalesced;
+
+        // Anything followed by a removal is a removal, a removal followed by
+        // anything else a replaced file that has to be read again, and a
+        // creation stays one.
+
+        if(type == Removed)
+            it->type = Removed;
+        else if(it->type == Removed)
+            it->type = isDirectory ? Created : Modified;
+        else if(type == Created && isDirectory)
+            it->type = Created;
+
+        it->isDirectory = isDirectory;
+    }
+
+    if(!m_flushTimer.isActive() || m_firstPending.elapsed() < maximumFlushDelay - flushDelay)
+        m_flushTimer.start(flushDelay);
+}
+
+bool LibraryWatcher::isExcluded(const QString &path) const
+{
+    return !m_excludedFolders.isEmpty() && isBelowFolder(path, m_excludedFolders);
+}
+
+void LibraryWatcher::startWatching()
+{
+    m_watching = true;
+
+    if(m_folders.isEmpty())
+        return;
+
+    if(m_inotifyFd < 0 && !m_dirLister)
+        setupInotify();
+
+    if(m_inotifyFd < 0) {
+        setupDirLister();
+        return;
+    }
+
+    // Anything created while the directories are listed is found by the
+    // folder scan running at the same time.
+    addWatchesInBackground(m_folders);
+}
+
+void LibraryWatcher::stopWatching()
+{
+    m_watching = false;
+
+    // Directory walks still running finish on their own, see
+    // addWatchesInBackground().
+    ++m_watchGeneration;
+
+#ifdef Q_OS_LINUX
+    for(auto it = m_watchPaths.constBegin(); it != m_watchPaths.constEnd(); ++it)
+        ::inotify_rm_watch(m_inotifyFd, it.key());
+#endif
+
+    m_watchPaths.clear();
+    m_watchDescriptors.clear();
+    m_watchLimitReached = false;
+    m_statistics.watches = 0;
+
+    if(m_dirLister) {
+        m_dirLister->stop();
+        m_dirLister->deleteLater();
+        m_dirLister = nullptr;
+    }
+}
+
+void LibraryWatcher::setupInotify()
+{
+#ifdef Q_OS_LINUX
+    m_inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(m_inotifyFd < 0) {
+        qCWarning(JUK_LOG) << "Unable to use inotify, only the music folders themselves are watched:"
+                           << strerror(errno);
+        return;
+    }
+
+    m_inotifyNotifier = new QSocketNotifier(m_inotifyFd, QSocketNotifier::Read, this);
+    connect(m_inotifyNotifier, &QSocketNotifier::activated,
+            this, &LibraryWatcher::readInotifyEvents);
+#endif
+}
+
+void LibraryWatcher::readInotifyEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buffer[16384];
+
+    forever {
+        const ssize_t length = ::read(m_inotifyFd, buffer, sizeof(buffer));
+
+        if(length <= 0) {
+            if(length < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        for(ssize_t offset = 0; offset < length; ) {
+            const auto event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                ++m_statistics.overflows;
+                qCWarning(JUK_LOG) << "Too many changes at once, the music folders will be scanned again";
+
+                if(m_enabled) {
+                    m_rescanNeeded = true;
+                    if(!m_flushTimer.isActive())
+                        m_flushTimer.start(flushDelay);
+                }
+                continue;
+            }
+
+            if(event->mask & IN_IGNORED) {
+                const QString directory = m_watchPaths.take(event->wd);
+                if(m_watchDescriptors.value(directory, -1) == event->wd)
+                    m_watchDescriptors.remove(directory);
+                m_statistics.watches = m_watchPaths.count();
+                continue;
+            }
+
+            const QString directory = m_watchPaths.value(event->wd);
+            if(directory.isEmpty())
+                continue;
+
+            if(event->mask & IN_DELETE_SELF) {
+                recordEvent(directory, Removed, true);
+                continue;
+            }
+
+            if(event->len == 0)
+                continue;
+
+            const QString path = directory + '/' + QFile::decodeName(QByteArray(event->name));
+            const bool isDirectory = event->mask & IN_ISDIR;
+
+            if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if(isDirectory && !isExcluded(path)) {
+                    // The directory itself is watched right away so that
+                    // nothing added to it is missed.  A directory moved in
+                    // can hold a whole tree, which is listed in the
+                    // background; one that was just created may already
+                    // have subdirectories too.
+                    addWatches(QStringList(path));
+                    addWatchesInBackground(QStringList(path));
+                }
+                recordEvent(path, Created, isDirectory);
+            }
+            else if(event->mask & IN_CLOSE_WRITE) {
+                recordEvent(path, Modified, false);
+            }
+            else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if(isDirectory)
+                    removeWatchesBelow(path);
+                recordEvent(path, Removed, isDirectory);
+            }
+        }
+    }
+#endif
+}
+
+void LibraryWatcher::addWatches(const QStringList &directories)
+{
+    for(const auto &directory : directories)
+        addWatch(directory);
+
+    m_statistics.watches = m_watchPaths.count();
+}
+
+void LibraryWatcher::addWatchesInBackground(const QStringList &folders)
+{
+    // Listing every directory of a large tree takes a while, so it is done
+    // in a separate thread.
+
+    auto walk = new QFutureWatcher<QStringList>(this);
+    const int generation = m_watchGeneration;
+
+    connect(walk, &QFutureWatcher<QStringList>::finished, this, [this, walk, generation]() {
+        walk->deleteLater();
+
+        // The watches were dropped in the meantime.
+        if(generation != m_watchGeneration)
+            return;
+
+        addWatches(walk->result());
+
+        qCDebug(JUK_LOG) << "Watching" << m_statistics.watches << "directories for changes";
+    });
+
+    const QStringList excludedFolders = m_excludedFolders;
+
+    walk->setFuture(QtConcurrent::run([folders, excludedFolders]() {
+        return listDirectories(folders, excludedFolders);
+    }));
+}
+
+void LibraryWatcher::addWatch(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    if(m_watchDescriptors.contains(directory))
+        return;
+
+    const int wd = ::inotify_add_watch(m_inotifyFd, QFile::encodeName(directory).constData(),
+                                       inotifyMask);
+
+    if(wd < 0) {
+        if(errno == ENOSPC && !m_watchLimitReached) {
+            m_watchLimitReached = true;
+            qCWarning(JUK_LOG) << "The inotify watch limit was reached, changes in" << directory
+                               << "and other folders will go unnoticed."
+                               << "Consider raising fs.inotify.max_user_watches.";
+        }
+        return;
+    }
+
+    m_watchPaths.insert(wd, directory);
+    m_watchDescriptors.insert(directory, wd);
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+void LibraryWatcher::removeWatchesBelow(const QString &directory)
+{
+#ifdef Q_OS_LINUX
+    const QString prefix = directory + '/';
+
+    for(auto it = m_watchDescriptors.begin(); it != m_watchDescriptors.end(); ) {
+        if(it.key() == directory || it.key().startsWith(prefix)) {
+            ::inotify_rm_watch(m_inotifyFd, it.value());
+            m_watchPaths.remove(it.value());
+            it = m_watchDescriptors.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    m_statistics.watches = m_watchPaths.count();
+#else
+    Q_UNUSED(directory);
+#endif
+}
+
+void LibraryWatcher::setupDirLister()
+{
+    m_dirLister = new KDirLister(this);
+
+    // KDirLister's auto error handling seems to crash JuK during startup.
+    m_dirLister->setAutoErrorHandlingEnabled(false, nullptr);
+
+    connect(m_dirLister, &KDirLister::newItems,
+            this, &LibraryWatcher::dirListerNewItems);
+    connect(m_dirLister, &KDirLister::refreshItems,
+            this, &LibraryWatcher::dirListerRefreshItems);
+    connect(m_dirLister, &KDirLister::itemsDeleted,
+            this, &LibraryWatcher::dirListerItemsDeleted);
+
+    for(const auto &folder : qAsConst(m_folders))
+        m_dirLister->openUrl(QUrl::fromUserInput(folder), KDirLister::Keep);
+}
+
+void LibraryWatcher::dirListerNewItems(const KFileItemList &items)
+{
+    for(const auto &item : items)
+        recordEvent(item.url().path(), Created, item.isDir());
+}
+
+void LibraryWatcher::dirListerRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
+{
+    for(const auto &item : items)
+        recordEvent(item.second.url().path(), Modified, item.second.isDir());
+}
+
+void LibraryWatcher::dirListerItemsDeleted(const KFileItemList &items)
+{
+    for(const auto &item : items)
+        recordEvent(item.url().path(), Removed, item.isDir());
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,180 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_LIBRARYWATCHER_H
+#define JUK_LIBRARYWATCHER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+class KDirLister;
+class KFileItemList;
+class KFileItem;
+class QSocketNotifier;
+
+/**
+ * One batch of changes below the music folders, with every path listed at
+ * most once.  Paths are canonical.
+ */
+struct LibraryChanges
+{
+    QStringList addedFiles;
+    QStringList changedFiles;
+    QStringList removedFiles;
+    QStringList addedDirectories;
+    QStringList removedDirectories;
+
+    /**
+     * Set if events were lost, in which case the folders need to be scanned
+     * again to catch up.
+     */
+    bool rescanNeeded = false;
+
+    bool isEmpty() const
+    {
+        return addedFiles.isEmpty() && changedFiles.isEmpty() && removedFiles.isEmpty() &&
+               addedDirectories.isEmpty() && removedDirectories.isEmpty() && !rescanNeeded;
+    }
+};
+
+Q_DECLARE_METATYPE(LibraryChanges);
+
+/**
+ * Watches the music folders for files being added, changed or removed.
+ *
+ * On Linux the whole tree below the folders is watched with inotify, elsewhere
+ * (or if inotify is unavailable) the folders themselves are watched with
+ * KDirLister.  Either way events are not passed on one by one: they are
+ * collected per path until no new event came in for a short while (or a
+ * longer while has passed since the first one), and later events for a path
+ * are folded into earlier ones.  A file that is written to many times becomes
+ * one change.  A file that is created and removed again becomes a removal,
+ * as a creation can't be told apart from KDirLister listing a file that was
+ * there all along; removing a file the collection doesn't have does nothing.
+ * The result is delivered as a single LibraryChanges.
+ */
+class LibraryWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Counts the events seen since the watcher was created, for debugging.
+     */
+    struct Statistics
+    {
+        quint64 created = 0;
+        quint64 modified = 0;
+        quint64 removed = 0;
+        quint64 overflows = 0;
+        quint64 ignored = 0;    ///< While disabled or below an excluded folder
+        quint64 coalesced = 0;  ///< Folded into a change already pending
+        quint64 delivered = 0;  ///< Changes passed on after coalescing
+        quint64 batches = 0;
+        int watches = 0;
+    };
+
+    explicit LibraryWatcher(QObject *parent = nullptr);
+    virtual ~LibraryWatcher();
+
+    /**
+     * Sets the folders to watch and the folders below them to leave alone.
+     */
+    void setFolders(const QStringList &folders, const QStringList &excludedFolders);
+
+    /**
+     * Events only become changes while the watcher is enabled, others are
+     * dropped.  The watches themselves are set up when it is first enabled.
+     */
+    void setEnabled(bool enable);
+    bool isEnabled() const { return m_enabled; }
+
+    /**
+     * Reports @p path as changed without waiting for an event, e.g. a
+     * directory that should be scanned again.
+     */
+    void addChangedPath(const QString &path);
+
+    /**
+     * Delivers the pending changes right away instead of waiting.
+     */
+    void flush();
+
+    const Statistics &statistics() const { return m_statistics; }
+
+    /**
+     * Returns true if the inotify backend is in use.
+     */
+    bool usesInotify() const { return m_inotifyFd >= 0; }
+
+signals:
+    void changesReady(const LibraryChanges &changes);
+
+private:
+    enum ChangeType { Created, Modified, Removed };
+
+    struct PendingChange
+    {
+        ChangeType type;
+        bool isDirectory;
+    };
+
+    void recordEvent(const QString &path, ChangeType type, bool isDirectory);
+    bool isExcluded(const QString &path) const;
+    void startWatching();
+    void stopWatching();
+
+    void setupInotify();
+    void readInotifyEvents();
+    void addWatches(const QStringList &directories);
+    void addWatchesInBackground(const QStringList &folders);
+    void addWatch(const QString &directory);
+    void removeWatchesBelow(const QString &directory);
+
+    void setupDirLister();
+    void dirListerNewItems(const KFileItemList &items);
+    void dirListerRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items);
+    void dirListerItemsDeleted(const KFileItemList &items);
+
+    QStringList m_folders;
+    QStringList m_excludedFolders;
+    bool m_enabled;
+    bool m_watching;
+
+    QHash<QString, PendingChange> m_pending;
+    QTimer m_flushTimer;
+    QElapsedTimer m_firstPending;
+    bool m_rescanNeeded;
+
+    int m_inotifyFd;
+    QSocketNotifier *m_inotifyNotifier;
+    QHash<int, QString> m_watchPaths;
+    QHash<QString, int> m_watchDescriptors;
+    int m_watchGeneration; ///< Changed when the watches are dropped
+    bool m_watchLimitReached;
+
+    KDirLister *m_dirLister;
+
+    Statistics m_statistics;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
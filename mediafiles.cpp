@@ -27,10 +27,18 @@
 #include <QStandardPaths>
 #include <QMimeType>
 #include <QMimeDatabase>
+#include <QFileInfo>
+#include <QGlobalStatic>
+#include <QHash>
+#include <QReadWriteLock>
 
 #include <taglib.h>
 #include <taglib_config.h>
 #include <tag.h>
+#include <audioproperties.h>
+#include <id3v2frame.h>
+#include <id3v2framefactory.h>
+#include <id3v2header.h>
 #include <mpegfile.h>
 #include <vorbisfile.h>
 #include <flacfile.h>
@@ -54,8 +62,6 @@
 #include "juk_debug.h"
 
 namespace MediaFiles {
-    static QStringList savedMimeTypes;
-
     static const char mp3Type[]  = "audio/mpeg";
     static const char oggType[]  = "audio/ogg";
     static const char flacType[] = "audio/x-flac";
@@ -143,60 +149,269 @@ QString MediaFiles::savePlaylistDialog(const QString &playlistName, QWidget *par
     return fileName;
 }
 
-TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName)
+// Maps a mime type to the FileType JuK uses for it.  The order of the checks
+// matters as some of these types inherit others.
+static MediaFiles::FileType fileTypeForMimeType(const QMimeType &mimeType, const QString &fileName)
 {
-    QMimeDatabase db;
-    QMimeType result = db.mimeTypeForFile(fileName);
-    if(!result.isValid())
-        return nullptr;
+    using namespace MediaFiles;
 
-    TagLib::File *file(nullptr);
-    QByteArray encodedFileName(QFile::encodeName(fileName));
+    if(!mimeType.isValid())
+        return UnknownFile;
 
-    if(result.inherits(QLatin1String(mp3Type)))
-        file = new TagLib::MPEG::File(encodedFileName.constData());
-    else if(result.inherits(QLatin1String(flacType)))
-        file = new TagLib::FLAC::File(encodedFileName.constData());
-    else if(result.inherits(QLatin1String(vorbisType)))
-        file = new TagLib::Vorbis::File(encodedFileName.constData());
+    if(mimeType.inherits(QLatin1String(mp3Type)))
+        return MP3File;
+    if(mimeType.inherits(QLatin1String(flacType)))
+        return FLACFile;
+    if(mimeType.inherits(QLatin1String(vorbisType)))
+        return VorbisFile;
 #ifdef TAGLIB_WITH_ASF
-    else if(result.inherits(QLatin1String(asfType)))
-        file = new TagLib::ASF::File(encodedFileName.constData());
+    if(mimeType.inherits(QLatin1String(asfType)))
+        return ASFFile;
 #endif
 #ifdef TAGLIB_WITH_MP4
-    else if(result.inherits(QLatin1String(mp4Type)) || result.inherits(QLatin1String(mp4AudiobookType)))
-        file = new TagLib::MP4::File(encodedFileName.constData());
+    if(mimeType.inherits(QLatin1String(mp4Type)) || mimeType.inherits(QLatin1String(mp4AudiobookType)))
+        return MP4File;
 #endif
-    else if(result.inherits(QLatin1String(mpcType)))
-        file = new TagLib::MPC::File(encodedFileName.constData());
-    else if(result.inherits(QLatin1String(oggflacType)))
-        file = new TagLib::Ogg::FLAC::File(encodedFileName.constData());
+    if(mimeType.inherits(QLatin1String(mpcType)))
+        return MPCFile;
+    if(mimeType.inherits(QLatin1String(oggflacType)))
+        return OggFLACFile;
 #if TAGLIB_HAS_OPUSFILE
-    else if(result.inherits(QLatin1String(oggopusType)) ||
-            (result.inherits(QLatin1String(oggType)) && fileName.endsWith(QLatin1String(".opus")))
-            )
+    if(mimeType.inherits(QLatin1String(oggopusType)) ||
+       (mimeType.inherits(QLatin1String(oggType)) && fileName.endsWith(QLatin1String(".opus"))))
     {
-        file = new TagLib::Ogg::Opus::File(encodedFileName.constData());
+        return OpusFile;
     }
+#else
+    Q_UNUSED(fileName);
 #endif
+    if(mimeType.inherits(QLatin1String(oggType)))
+        return OggFile;
+    if(mimeType.inherits(QLatin1String(m3uType)))
+        return PlaylistFile;
 
-    return file;
+    return UnknownFile;
 }
 
-bool MediaFiles::isMediaFile(const QString &fileName)
+namespace {
+
+/**
+ * Remembers the FileType of each file extension.  Extensions that the mime
+ * database cannot resolve by name alone (e.g. .ogg, which may hold any Ogg
+ * codec) are remembered as ambiguous.
+ */
+class FileTypeTable
 {
+public:
+    FileTypeTable()
+    {
+        // Seed the table with everything we can play, so that lookups from
+        // the DirectoryLoader threads rarely need the write lock.
+        QMimeDatabase db;
+        QStringList types = MediaFiles::mimeTypes();
+        QStringList suffixes;
+
+        types << QLatin1String(MediaFiles::m3uType);
+        for(const auto &name : qAsConst(types))
+            suffixes << db.mimeTypeForName(name).suffixes();
+
+        for(const auto &suffix : suffixes)
+            m_types.insert(suffix.toLower(), resolve(db, suffix.toLower()));
+    }
+
+    // Returns false if the contents of a file with this suffix need to be
+    // examined.
+    bool lookup(const QString &suffix, MediaFiles::FileType *type)
+    {
+        {
+            QReadLocker locker(&m_lock);
+            const auto it = m_types.constFind(suffix);
+            if(it != m_types.constEnd()) {
+                *type = it.value().type;
+                return !it.value().ambiguous;
+            }
+        }
+
+        QMimeDatabase db;
+        const Entry entry = resolve(db, suffix);
+
+        QWriteLocker locker(&m_lock);
+        m_types.insert(suffix, entry);
+
+        *type = entry.type;
+        return !entry.ambiguous;
+    }
+
+private:
+    struct Entry
+    {
+        MediaFiles::FileType type;
+        bool ambiguous;
+    };
+
+    static Entry resolve(const QMimeDatabase &db, const QString &suffix)
+    {
+        const QString fileName = QStringLiteral("file.") + suffix;
+        const auto candidates = db.mimeTypesForFileName(fileName);
+
+        if(candidates.count() != 1)
+            return Entry { MediaFiles::UnknownFile, true };
+
+        return Entry { fileTypeForMimeType(candidates.first(), fileName), false };
+    }
+
+    QReadWriteLock m_lock;
+    QHash<QString, Entry> m_types;
+};
+
+} // namespace
+
+Q_GLOBAL_STATIC(FileTypeTable, fileTypeTable)
+
+MediaFiles::FileType MediaFiles::fileType(const QString &fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    FileType type = UnknownFile;
+
+    if(!suffix.isEmpty() && fileTypeTable()->lookup(suffix, &type))
+        return type;
+
     QMimeDatabase db;
-    QMimeType result = db.mimeTypeForFile(fileName);
-    if(!result.isValid())
-        return false;
+    return fileTypeForMimeType(db.mimeTypeForFile(fileName), fileName);
+}
+
+TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName)
+{
+    return fileFactoryByType(fileName, fileType(fileName));
+}
+
+// Opens a file with the given TagLib options.  A null frameFactory means the
+// default one.
+static TagLib::File *openFile(const QString &fileName, MediaFiles::FileType type,
+                              bool readProperties,
+                              TagLib::AudioProperties::ReadStyle propertiesStyle,
+                              TagLib::ID3v2::FrameFactory *frameFactory)
+{
+    using namespace MediaFiles;
+
+    const QByteArray encodedFileName(QFile::encodeName(fileName));
+    const char *const name = encodedFileName.constData();
+
+    if(!frameFactory)
+        frameFactory = TagLib::ID3v2::FrameFactory::instance();
 
-    // Search through our table of media types for a match
-    for(const auto &mimeType : mimeTypes()) {
-        if(result.inherits(mimeType))
-            return true;
+    switch(type) {
+    case MP3File:
+        return new TagLib::MPEG::File(name, frameFactory, readProperties, propertiesStyle);
+    case FLACFile:
+        return new TagLib::FLAC::File(name, frameFactory, readProperties, propertiesStyle);
+    case VorbisFile:
+        return new TagLib::Vorbis::File(name, readProperties, propertiesStyle);
+#ifdef TAGLIB_WITH_ASF
+    case ASFFile:
+        return new TagLib::ASF::File(name, readProperties, propertiesStyle);
+#endif
+#ifdef TAGLIB_WITH_MP4
+    case MP4File:
+        return new TagLib::MP4::File(name, readProperties, propertiesStyle);
+#endif
+    case MPCFile:
+        return new TagLib::MPC::File(name, readProperties, propertiesStyle);
+    case OggFLACFile:
+        return new TagLib::Ogg::FLAC::File(name, readProperties, propertiesStyle);
+#if TAGLIB_HAS_OPUSFILE
+    case OpusFile:
+        return new TagLib::Ogg::Opus::File(name, readProperties, propertiesStyle);
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+namespace {
+
+// Stands in for an attached picture during scans.  Only the frame header is
+// parsed, which is all ID3v2::Tag needs to step over the frame, so the
+// picture is neither parsed nor copied out of the tag data.
+class SkippedFrame : public TagLib::ID3v2::Frame
+{
+public:
+    explicit SkippedFrame(Header *header) : Frame(header) {}
+
+    virtual TagLib::String toString() const override { return TagLib::String(); }
+
+protected:
+    virtual void parseFields(const TagLib::ByteVector &) override {}
+    virtual TagLib::ByteVector renderFields() const override { return TagLib::ByteVector(); }
+};
+
+class ScanFrameFactory : public TagLib::ID3v2::FrameFactory
+{
+public:
+    virtual TagLib::ID3v2::Frame *createFrame(const TagLib::ByteVector &data,
+                                              const TagLib::ID3v2::Header *tagHeader) const override
+    {
+        // ID3v2.2 has three letter frame IDs
+        const unsigned int version = tagHeader->majorVersion();
+        if(data.startsWith(version < 3 ? "PIC" : "APIC"))
+            return new SkippedFrame(new TagLib::ID3v2::Frame::Header(data, version));
+
+        return FrameFactory::createFrame(data, tagHeader);
     }
+};
+
+} // namespace
+
+Q_GLOBAL_STATIC(ScanFrameFactory, scanFrameFactory)
 
-    return false;
+TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName, FileType type)
+{
+    return openFile(fileName, type, true, TagLib::AudioProperties::Average, nullptr);
+}
+
+TagLib::File *MediaFiles::scanFileByType(const QString &fileName, FileType type)
+{
+    return openFile(fileName, type, hasScanAudioProperties(type),
+                    TagLib::AudioProperties::Fast, scanFrameFactory());
+}
+
+bool MediaFiles::hasScanAudioProperties(FileType type, bool *exact)
+{
+    // TagLib finds the properties of these in the header it reads for the
+    // tag anyway.  The fast estimate of MP3 files takes the first frame
+    // (and its Xing or VBRI header) after the tag.  Ogg files would need
+    // their last page, near the end of the file.
+    bool scanned = false;
+    bool isExact = false;
+
+    switch(type) {
+    case FLACFile:
+    case ASFFile:
+    case MP4File:
+    case MPCFile:
+        scanned = isExact = true;
+        break;
+    case MP3File:
+        scanned = true;
+        break;
+    default:
+        break;
+    }
+
+    if(exact)
+        *exact = isExact;
+
+    return scanned;
+}
+
+bool MediaFiles::isMediaFile(const QString &fileName)
+{
+    return isMediaType(fileType(fileName));
+}
+
+bool MediaFiles::isMediaType(FileType type)
+{
+    return type != UnknownFile && type != PlaylistFile;
 }
 
 static bool isFileOfMimeType(const QString &fileName, const QString &mimeType)
@@ -208,7 +423,7 @@ static bool isFileOfMimeType(const QString &fileName, const QString &mimeType)
 
 bool MediaFiles::isPlaylistFile(const QString &fileName)
 {
-    return isFileOfMimeType(fileName, m3uType);
+    return fileType(fileName) == PlaylistFile;
 }
 
 bool MediaFiles::isMP3(const QString &fileName)
@@ -257,12 +472,14 @@ bool MediaFiles::isOggFLAC(const QString &fileName)
 
 QStringList MediaFiles::mimeTypes()
 {
-    if(!savedMimeTypes.isEmpty())
-        return savedMimeTypes;
-
-    for(unsigned i = 0; i < ARRAY_SIZE(mediaTypes); ++i) {
-        savedMimeTypes << QLatin1String(mediaTypes[i]);
-    }
+    // Built once, thread-safe since fileType() is used by the DirectoryLoader
+    static const QStringList savedMimeTypes = []() {
+        QStringList types;
+        for(unsigned i = 0; i < ARRAY_SIZE(mediaTypes); ++i) {
+            types << QLatin1String(mediaTypes[i]);
+        }
+        return types;
+    }();
 
     return savedMimeTypes;
 }
@@ -48,6 +48,30 @@ namespace MediaFiles
      */
     QString savePlaylistDialog(const QString &playlistName, QWidget *parent = nullptr);
 
+    /**
+     * The kinds of files JuK knows how to handle, see fileType().
+     */
+    enum FileType {
+        UnknownFile,
+        PlaylistFile,
+        MP3File,
+        FLACFile,
+        VorbisFile,
+        ASFFile,
+        MP4File,
+        MPCFile,
+        OggFLACFile,
+        OpusFile,
+        OggFile      ///< Some other Ogg file, playable but without tags
+    };
+
+    /**
+     * Classifies @p fileName.  The type is looked up by extension in a table
+     * built from the mime database on first use, only files whose extension
+     * does not decide the type have their contents examined.  Thread-safe.
+     */
+    FileType fileType(const QString &fileName);
+
     /**
      * Returns a pointer to a new appropriate subclass of TagLib::File, or
      * a null pointer if there is no appropriate subclass for the given
@@ -55,11 +79,37 @@ namespace MediaFiles
      */
     TagLib::File *fileFactoryByType(const QString &fileName);
 
+    /**
+     * As above, for a file already known to be of type @p type.
+     */
+    TagLib::File *fileFactoryByType(const QString &fileName, FileType type);
+
+    /**
+     * Opens @p fileName of type @p type for a folder scan.  The audio
+     * properties are only read for formats where TagLib finds them next to
+     * the tag (see hasScanAudioProperties()), with TagLib's fast estimate.
+     * Pictures in ID3v2 tags are skipped instead of parsed, so the file must
+     * not be saved.
+     */
+    TagLib::File *scanFileByType(const QString &fileName, FileType type);
+
+    /**
+     * Returns whether scanFileByType() reads the audio properties of files
+     * of @p type, and whether what it reads is exact (as opposed to an
+     * estimate to be replaced by a full read later) in @p exact.
+     */
+    bool hasScanAudioProperties(FileType type, bool *exact = nullptr);
+
     /**
      * Returns true if fileName is a supported media file.
      */
     bool isMediaFile(const QString &fileName);
 
+    /**
+     * Returns true if files of type @p type are supported media files.
+     */
+    bool isMediaType(FileType type);
+
     /**
      * Returns true if fileName is a supported playlist file.
      */
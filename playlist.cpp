@@ -67,8 +67,10 @@
 #include "directoryloader.h"
 #include "playlistitem.h"
 #include "playlistcollection.h"
+#include "playlistfileloader.h"
 #include "playlistsearch.h"
 #include "playlistsharedsettings.h"
+#include "playlistsorter.h"
 #include "mediafiles.h"
 #include "collectionlist.h"
 #include "filerenamer.h"
@@ -82,6 +84,7 @@
 #include "coverdialog.h"
 #include "tagtransactionmanager.h"
 #include "cache.h"
+#include "stringshare.h"
 #include "juk_debug.h"
 
 using namespace ActionCollection;
@@ -96,6 +99,12 @@ quint32 g_trackID = 0;
  * Just a shortcut of sorts.
  */
 
+// Smaller playlists are sorted by the view right away.
+static const int backgroundSortThreshold = 5000;
+
+// Enough text widths per column for a useful average.
+static const int widthSampleSize = 256;
+
 static bool manualResize()
 {
     return action<KToggleAction>("resizeColumnsManually")->isChecked();
@@ -167,6 +176,11 @@ Playlist::Playlist(PlaylistCollection *collection, bool delaySetup, int extraCol
 
 Playlist::~Playlist()
 {
+    // The loader outlives us (see loadFile()), there's no point in it
+    // reading the rest of the file.
+    if(m_fileLoader)
+        m_fileLoader->cancel();
+
     // clearItem() will take care of removing the items from the history,
     // so call clearItems() to make sure it happens.
     //
@@ -300,7 +314,7 @@ void Playlist::saveAs()
 
 void Playlist::updateDeletedItem(PlaylistItem *item)
 {
-    m_members.remove(item->file().absFilePath());
+    m_members.remove(item->file().persistentId());
 
     m_history.removeAll(item);
 }
@@ -371,7 +385,7 @@ void Playlist::setItemsVisible(const QModelIndexList &indexes, bool visible) //
     m_visibleChanged = true;
 
     for(QModelIndex index : indexes)
-        itemFromIndex(index)->setHidden(!visible);
+        setItemHidden(itemFromIndex(index), !visible);
 }
 
 void Playlist::setSearch(PlaylistSearch* s)
@@ -382,7 +396,7 @@ void Playlist::setSearch(PlaylistSearch* s)
         return;
 
     for(int row = 0; row < topLevelItemCount(); ++row)
-        topLevelItem(row)->setHidden(true);
+        setItemHidden(topLevelItem(row), true);
     setItemsVisible(s->matchedItems(), true);
 
     TrackSequenceManager::instance()->iterator()->playlistChanged();
@@ -397,12 +411,12 @@ void Playlist::setSearchEnabled(bool enabled)
 
     if(enabled) {
         for(int row = 0; row < topLevelItemCount(); ++row)
-            topLevelItem(row)->setHidden(true);
+            setItemHidden(topLevelItem(row), true);
         setItemsVisible(m_search->matchedItems(), true);
     }
     else
         for(PlaylistItem* item : items())
-            item->setHidden(false);
+            setItemHidden(item, false);
 
 }
 
@@ -614,6 +628,8 @@ void Playlist::slotReload()
 
 void Playlist::slotWeightDirty(int column)
 {
+    m_shownItemsDirty = true;
+
     if(column < 0) {
         m_weightDirty.clear();
         for(int i = 0; i < columnCount(); i++) {
@@ -888,6 +904,7 @@ void Playlist::dropEvent(QDropEvent *e)
         // Since we're trying to arrange things manually, turn off sorting.
 
         sortItems(columnCount() + 1, Qt::AscendingOrder);
+        m_sortedInBackground = false;
 
         const QList<QTreeWidgetItem *> items = QTreeWidget::selectedItems();
 
@@ -931,7 +948,7 @@ void Playlist::applySharedSettings()
     m_applySharedSettings = true;
 }
 
-void Playlist::read(QDataStream &s)
+void Playlist::read(PlaylistDataStream &s)
 {
     s >> m_playlistName
       >> m_fileName;
@@ -942,19 +959,17 @@ void Playlist::read(QDataStream &s)
 
     // Do not sort. Add the files in the order they were saved.
     setSortingEnabled(false);
+    m_sortedInBackground = false;
 
-    QStringList files;
-    s >> files;
+    quint32 count;
+    s >> count;
 
     QTreeWidgetItem *after = 0;
 
     m_blockDataChanged = true;
 
-    foreach(const QString &file, files) {
-        if(file.isEmpty())
-            throw BICStreamException();
-
-        after = createItem(FileHandle(file), after);
+    for(quint32 i = 0; i < count; ++i) {
+        after = createItem(s.readTrack(), after);
     }
 
     m_blockDataChanged = false;
@@ -967,6 +982,9 @@ void Playlist::paintEvent(QPaintEvent *pe)
 {
     // If there are columns that need to be updated, well, update them.
 
+    if(m_shownItemsDirty && !manualResize())
+        measureShownItems();
+
     if(!m_weightDirty.isEmpty() && !manualResize())
     {
         calculateColumnWeights();
@@ -984,9 +1002,18 @@ void Playlist::resizeEvent(QResizeEvent *re)
     if(re->size().width() != re->oldSize().width() && !manualResize())
         slotUpdateColumnWidths();
 
+    m_shownItemsDirty = true;
     QTreeWidget::resizeEvent(re);
 }
 
+void Playlist::scrollContentsBy(int dx, int dy)
+{
+    if(dy != 0)
+        m_shownItemsDirty = true;
+
+    QTreeWidget::scrollContentsBy(dx, dy);
+}
+
 // Reimplemented to show a visual indication of which of the view's playlist
 // items is actually playing.
 void Playlist::drawRow(QPainter *p, const QStyleOptionViewItem &option, const QModelIndex &index) const
@@ -1017,6 +1044,13 @@ void Playlist::takeItem(QTreeWidgetItem *item)
     QTreeWidget::takeTopLevelItem(index);
 }
 
+bool Playlist::hasItem(const QString &file) const
+{
+    // Paths are only used to find the track, membership goes by ID.
+    const CollectionListItem *item = CollectionList::instance()->lookup(file);
+    return item && m_members.contains(item->file().persistentId());
+}
+
 PlaylistItem *Playlist::createItem(const FileHandle &file, QTreeWidgetItem *after)
 {
     return createItem<PlaylistItem>(file, after);
@@ -1142,6 +1176,7 @@ void Playlist::hideColumn(int c, bool updateSearch)
         return;
 
     QTreeWidget::hideColumn(c);
+    m_sortTieBreakColumnsDirty = true;
 
     if(c == m_leftColumn) {
         updatePlaying();
@@ -1176,6 +1211,8 @@ void Playlist::showColumn(int c, bool updateSearch)
         return;
 
     QTreeWidget::showColumn(c);
+    m_sortTieBreakColumnsDirty = true;
+    m_shownItemsDirty = true;
 
     if(c == leftMostVisibleColumn()) {
         updatePlaying();
@@ -1194,12 +1231,246 @@ void Playlist::showColumn(int c, bool updateSearch)
         redisplaySearch();
 }
 
+const QVector<int> &Playlist::sortTieBreakColumns() const
+{
+    // Worked out once rather than for every comparison of a sort.
+    if(m_sortTieBreakColumnsDirty) {
+        const int offset = columnOffset();
+        const int last = !isColumnHidden(PlaylistItem::AlbumColumn + offset)
+            ? PlaylistItem::TrackNumberColumn
+            : PlaylistItem::ArtistColumn;
+
+        m_sortTieBreakColumns.clear();
+
+        for(int i = PlaylistItem::ArtistColumn; i <= last; i++) {
+            if(!isColumnHidden(i + offset))
+                m_sortTieBreakColumns.append(i + offset);
+        }
+
+        m_sortTieBreakColumns.append(PlaylistItem::TrackColumn + offset);
+        m_sortTieBreakColumnsDirty = false;
+    }
+
+    return m_sortTieBreakColumns;
+}
+
 void Playlist::sortByColumn(int column, Qt::SortOrder order)
 {
+    // Whatever is still being sorted in the background is out of date now.
+    ++m_sortGeneration;
+
+    if(topLevelItemCount() >= backgroundSortThreshold && canSortInBackground(column)) {
+        sortInBackground(column, order);
+        return;
+    }
+
+    // A full sort compares every row, so collate new keys into ranks first
+    // rather than comparing them with the collator over and over.
+    if(CollectionList *collection = CollectionList::instance()) {
+        const TrackStore &store = collection->trackStore();
+        const int offset = columnOffset();
+
+        if(TrackStore::hasSortKey(column - offset))
+            store.prepareSortRanks(column - offset);
+        for(const int tieBreakColumn : sortTieBreakColumns()) {
+            if(TrackStore::hasSortKey(tieBreakColumn - offset))
+                store.prepareSortRanks(tieBreakColumn - offset);
+        }
+    }
+
+    m_sortedInBackground = false;
     setSortingEnabled(true);
     QTreeWidget::sortByColumn(column, order);
 }
 
+void Playlist::updateSortPosition(PlaylistItem *item)
+{
+    // Only while the view does not keep itself sorted, see sortInBackground().
+    if(!m_sortedInBackground || isSortingEnabled() || item->treeWidget() != this)
+        return;
+
+    QTreeWidgetItem *root = invisibleRootItem();
+    const int index = root->indexOfChild(item);
+    const bool ascending = header()->sortIndicatorOrder() == Qt::AscendingOrder;
+
+    const auto lessThan = [ascending](const QTreeWidgetItem *first, const QTreeWidgetItem *second) {
+        return ascending ? *first < *second : *second < *first;
+    };
+
+    const QTreeWidgetItem *previous = index > 0 ? root->child(index - 1) : nullptr;
+    const QTreeWidgetItem *next = root->child(index + 1);
+
+    if((!previous || !lessThan(item, previous)) && (!next || !lessThan(next, item)))
+        return;
+
+    const bool wasCurrent = currentItem() == item;
+    const bool wasSelected = item->isSelected();
+    const bool blockDataChanged = m_blockDataChanged;
+    m_blockDataChanged = true;
+
+    {
+        const QSignalBlocker blocker(this);
+
+        root->takeChild(index);
+
+        // After the items that are equal to it, like a stable sort would.
+        int first = 0;
+        int last = root->childCount();
+        while(first < last) {
+            const int middle = first + (last - first) / 2;
+            if(lessThan(item, root->child(middle)))
+                last = middle;
+            else
+                first = middle + 1;
+        }
+
+        root->insertChild(first, item);
+
+        if(wasCurrent)
+            setCurrentItem(item, 0, QItemSelectionModel::NoUpdate);
+        item->setSelected(wasSelected);
+    }
+
+    m_blockDataChanged = blockDataChanged;
+}
+
+/**
+ * The key of \a row in \a column (not counting the column offset) that
+ * orders rows the same way as PlaylistItem::compare().
+ */
+static quint32 sortKey(const TrackStore &store, int row, int column)
+{
+    switch(column) {
+    case PlaylistItem::TrackNumberColumn:
+        return PlaylistSorter::numberKey(store.track(row));
+    case PlaylistItem::LengthColumn:
+        return PlaylistSorter::numberKey(store.seconds(row));
+    case PlaylistItem::BitrateColumn:
+        return PlaylistSorter::numberKey(store.bitrate(row));
+    default:
+        return store.sortRank(row, column);
+    }
+}
+
+bool Playlist::canSortInBackground(int column) const
+{
+    // The extra columns of subclasses and the cover column are not in the
+    // TrackStore.
+    const int offset = columnOffset();
+    return column >= offset
+        && column - offset <= PlaylistItem::lastColumn()
+        && column - offset != PlaylistItem::CoverColumn;
+}
+
+void Playlist::sortInBackground(int column, Qt::SortOrder order)
+{
+    // With sorting enabled the view would sort everything again itself.
+    // Turning it off also hides the sort indicator and makes the header
+    // unclickable, so bring those back; clicks are handled by
+    // slotHeaderClicked().
+    setSortingEnabled(false);
+    m_sortedInBackground = true;
+
+    header()->setSortIndicatorShown(true);
+    header()->setSectionsClickable(true);
+    header()->setSortIndicator(column, order);
+
+    const TrackStore &store = CollectionList::instance()->trackStore();
+    const int offset = columnOffset();
+
+    QVector<int> columns = { column - offset };
+    for(const int tieBreakColumn : sortTieBreakColumns())
+        columns.append(tieBreakColumn - offset);
+
+    const int count = topLevelItemCount();
+    QVector<QTreeWidgetItem *> items(count);
+    QVector<quint32> keys;
+    keys.reserve(count * columns.count());
+
+    for(int i = 0; i < count; ++i) {
+        const auto item = static_cast<PlaylistItem *>(topLevelItem(i));
+        items[i] = item;
+
+        for(const int keyColumn : columns)
+            keys.append(sortKey(store, item->trackRow(), keyColumn));
+    }
+
+    const PlaylistSorter sorter(keys, columns.count(), order == Qt::AscendingOrder);
+
+    // The collection is saved in its sort order, so at startup it usually
+    // needs no sorting at all.
+    if(sorter.isSorted())
+        return;
+
+    const int generation = m_sortGeneration;
+
+    QVector<quint64> storeChanges;
+    for(const int keyColumn : columns)
+        storeChanges.append(store.changeCount(keyColumn));
+
+    auto sortWatcher = new QFutureWatcher<QVector<int>>(this);
+    connect(sortWatcher, &QFutureWatcher<QVector<int>>::finished, this,
+            [this, sortWatcher, items, columns, column, order, generation, storeChanges]() {
+        sortWatcher->deleteLater();
+
+        if(generation != m_sortGeneration)
+            return;
+
+        // Items were added, removed or retagged while sorting, start over
+        // with them.
+        const TrackStore &store = CollectionList::instance()->trackStore();
+
+        bool unchanged = topLevelItemCount() == items.count();
+        for(int i = 0; unchanged && i < columns.count(); ++i)
+            unchanged = store.changeCount(columns[i]) == storeChanges[i];
+        for(int i = 0; unchanged && i < items.count(); ++i)
+            unchanged = topLevelItem(i) == items[i];
+
+        if(!unchanged) {
+            sortByColumn(column, order);
+            return;
+        }
+
+        applySortedRows(items, sortWatcher->result());
+    });
+
+    sortWatcher->setFuture(QtConcurrent::run([sorter]() { return sorter.sortedRows(); }));
+}
+
+void Playlist::applySortedRows(const QVector<QTreeWidgetItem *> &items, const QVector<int> &rows)
+{
+    QList<QTreeWidgetItem *> sortedItems;
+    sortedItems.reserve(rows.count());
+    for(const int row : rows)
+        sortedItems.append(items[row]);
+
+    QTreeWidgetItem *current = currentItem();
+    const QList<QTreeWidgetItem *> selected = QTreeWidget::selectedItems();
+
+    // Taking all of the items out and putting them back is one removal and
+    // one insertion for the view, rather than a move per item.  The
+    // selection is the same afterwards, so don't tell anyone it went away
+    // in between.
+    setUpdatesEnabled(false);
+    const bool blockDataChanged = m_blockDataChanged;
+    m_blockDataChanged = true;
+
+    {
+        const QSignalBlocker blocker(this);
+
+        invisibleRootItem()->takeChildren();
+        addTopLevelItems(sortedItems);
+
+        if(current)
+            setCurrentItem(current, 0, QItemSelectionModel::NoUpdate);
+        for(QTreeWidgetItem *item : selected)
+            item->setSelected(true);
+    }
+
+    m_blockDataChanged = blockDataChanged;
+    setUpdatesEnabled(true);
+}
+
 // This function is called during startup so it cannot rely on any virtual
 // functions that might be changed by a subclass (virtual functions relying on
 // superclasses are fine since the C++ runtime can statically dispatch those).
@@ -1240,6 +1511,8 @@ void Playlist::slotInitialize(int numColumnsToReserve)
     m_columnFixedWidths.resize(numColumns);
     m_weightDirty.resize(numColumns);
     m_columnWeights.resize(numColumns);
+    m_widthSquares.resize(numColumns);
+    m_widthCounts.resize(numColumns);
 
     //////////////////////////////////////////////////
     // setup header RMB menu
@@ -1301,7 +1574,7 @@ void Playlist::setupItem(PlaylistItem *item)
 
     QModelIndex index = indexFromItem(item);
     if(!m_search->isEmpty())
-        item->setHidden(!m_search->checkItem(&index));
+        setItemHidden(item, !m_search->checkItem(&index));
 
     if(topLevelItemCount() <= 2 && !manualResize()) {
         slotWeightDirty();
@@ -1386,6 +1659,7 @@ void Playlist::setup(int numColumnsToReserve)
     setEditTriggers(QAbstractItemView::EditKeyPressed); // Don't edit on double-click
 
     connect(header(), SIGNAL(sectionMoved(int,int,int)), this, SLOT(slotColumnOrderChanged(int,int,int)));
+    connect(header(), &QHeaderView::sectionClicked, this, &Playlist::slotHeaderClicked);
 
     connect(m_fetcher, SIGNAL(signalCoverChanged(int)), this, SLOT(slotCoverChanged(int)));
 
@@ -1395,14 +1669,14 @@ void Playlist::setup(int numColumnsToReserve)
 
     connect(this, &QTreeWidget::itemDoubleClicked, this, &Playlist::slotPlayCurrent);
 
-    // Use a timer to soak up the multiple dataChanged signals we're going to get
-    auto updateRequestor = new QTimer(this);
-    updateRequestor->setSingleShot(true);
-    updateRequestor->setInterval(10);
-
-    connect(model(), &QAbstractItemModel::dataChanged,
-            updateRequestor, static_cast<void (QTimer::*)()>(&QTimer::start));
-    connect(updateRequestor, &QTimer::timeout, this, &Playlist::slotUpdateTime);
+    // Added, changed or reordered items may be on screen without having been
+    // measured, see measureShownItems().
+    const auto shownItemsDirty = [this]() { m_shownItemsDirty = true; };
+    connect(model(), &QAbstractItemModel::rowsInserted, this, shownItemsDirty);
+    connect(model(), &QAbstractItemModel::rowsRemoved, this, shownItemsDirty);
+    connect(model(), &QAbstractItemModel::dataChanged, this, shownItemsDirty);
+    connect(model(), &QAbstractItemModel::layoutChanged, this, shownItemsDirty);
+    connect(model(), &QAbstractItemModel::modelReset, this, shownItemsDirty);
 
     // This apparently must be created very early in initialization for other
     // Playlist code requiring m_headerMenu.
@@ -1422,41 +1696,65 @@ void Playlist::setup(int numColumnsToReserve)
 
 void Playlist::loadFile(const QString &fileName, const QFileInfo &fileInfo)
 {
-    QFile file(fileName);
-    if(!file.open(QIODevice::ReadOnly))
-        return;
+    // A load still in progress (e.g. before a reload) is superseded.
+    if(m_fileLoader)
+        m_fileLoader->cancel();
+
+    CollectionList *collection = CollectionList::instance();
+    auto loader = new PlaylistFileLoader(fileName, fileInfo.absolutePath(),
+                                         collection->knownFiles());
+    m_fileLoader = loader;
+
+    connect(loader, &PlaylistFileLoader::entriesFound,
+            collection, &CollectionList::slotPlaylistEntriesFound);
+    connect(loader, &PlaylistFileLoader::entriesChecked,
+            collection, &CollectionList::slotPlaylistEntriesChecked);
+
+    // The watcher belongs to the loader rather than to us so that the loader
+    // outlives the playlist if it is removed while loading.
+    auto loadWatcher = new QFutureWatcher<void>(loader);
+    connect(loadWatcher, &QFutureWatcher<void>::finished, this, [this, loader]() {
+        if(m_fileLoader != loader)
+            return;
 
-    QTextStream stream(&file);
+        m_fileLoader = nullptr;
+
+        if(!loader->isCancelled())
+            addLoadedFiles(loader->entries());
+    });
+    connect(loadWatcher, &QFutureWatcher<void>::finished,
+            loader, &QObject::deleteLater);
+
+    loadWatcher->setFuture(QtConcurrent::run(loader, &PlaylistFileLoader::startLoading));
+}
+
+void Playlist::addLoadedFiles(const QVector<PlaylistFileLoader::Entry> &entries)
+{
+    CollectionList *collection = CollectionList::instance();
 
     // Turn off non-explicit sorting.
 
     setSortingEnabled(false);
+    m_sortedInBackground = false;
 
     m_disableColumnWidthUpdates = true;
     m_blockDataChanged = true;
 
     PlaylistItem *after = nullptr;
 
-    while(!stream.atEnd()) {
-        QString itemName = stream.readLine().trimmed();
-
-        QFileInfo item(itemName);
+    for(const auto &entry : entries) {
+        CollectionListItem *item = collection->lookup(entry.path);
 
-        if(item.isRelative())
-            item.setFile(QDir::cleanPath(fileInfo.absolutePath() + '/' + itemName));
+        if(!item && !entry.file.isNull())
+            item = collection->createItem(entry.file);
 
-        if(item.exists() && item.isFile() && item.isReadable() &&
-           MediaFiles::isMediaFile(item.fileName()))
-        {
-            after = createItem(FileHandle(item), after);
-        }
+        if(item)
+            after = createItem(item->file(), after);
     }
 
     m_blockDataChanged = false;
     m_disableColumnWidthUpdates = false;
 
-    file.close();
-
     playlistItemsChanged();
 }
 
@@ -1518,42 +1816,165 @@ void Playlist::calculateColumnWeights()
     if(m_disableColumnWidthUpdates)
         return;
 
-    const PlaylistItemList l = items();
-
-    QVector<double> averageWidth(columnCount());
-    double itemCount = l.size();
+    sampleColumnWidths();
 
-    QVector<int> cachedWidth;
+    if(m_columnWeights.isEmpty())
+        m_columnWeights.fill(-1, columnCount());
 
     // Here we're not using a real average, but averaging the squares of the
     // column widths and then using the square root of that value.  This gives
     // a nice weighting to the longer columns without doing something arbitrary
-    // like adding a fixed amount of padding.
-
-    foreach(PlaylistItem *item, l) {
-        cachedWidth = item->cachedWidths();
+    // like adding a fixed amount of padding.  The squares are added up as the
+    // widths are measured, see updateWidthStatistics().
 
+    foreach(int column, m_weightDirty) {
         // Extra columns start at 0, but those weights aren't shared with all
         // items.
-        for(int i = 0; i < columnOffset(); ++i) {
-            averageWidth[i] +=
-                std::pow(double(columnWidth(i)), 2.0) / itemCount;
+        if(column < columnOffset()) {
+            m_columnWeights[column] = columnWidth(column);
+            continue;
         }
 
+        const int count = m_widthCounts[column];
+        m_columnWeights[column] = count > 0
+            ? int(std::sqrt(double(m_widthSquares[column]) / count) + 0.5)
+            : 0;
+    }
+
+    m_weightDirty.clear();
+}
+
+void Playlist::measureShownItems()
+{
+    m_shownItemsDirty = false;
+
+    const int height = viewport()->height();
+
+    for(QTreeWidgetItem *item = itemAt(0, 0); item; item = itemBelow(item)) {
+        if(visualItemRect(item).top() >= height)
+            break;
+
+        const auto playlistItem = static_cast<PlaylistItem *>(item);
         for(int column = columnOffset(); column < columnCount(); ++column) {
-            averageWidth[column] +=
-                std::pow(double(cachedWidth[column - columnOffset()]), 2.0) / itemCount;
+            if(!isColumnHidden(column))
+                playlistItem->measureWidth(column - columnOffset());
         }
     }
+}
 
-    if(m_columnWeights.isEmpty())
-        m_columnWeights.fill(-1, columnCount());
+void Playlist::sampleColumnWidths()
+{
+    const int itemCount = topLevelItemCount();
+    const int needed = qMin(widthSampleSize, itemCount);
 
-    foreach(int column, m_weightDirty) {
-        m_columnWeights[column] = int(std::sqrt(averageWidth[column]) + 0.5);
+    QVector<int> columns;
+    for(int column = columnOffset(); column < columnCount(); ++column) {
+        if(!isColumnHidden(column) && m_widthCounts[column] < needed)
+            columns.append(column - columnOffset());
     }
 
-    m_weightDirty.clear();
+    if(columns.isEmpty())
+        return;
+
+    // Spread over the whole playlist, neighbouring items tend to be from the
+    // same album.
+    const int step = qMax(1, itemCount / widthSampleSize);
+
+    for(int i = 0; i < itemCount; i += step) {
+        const auto item = static_cast<PlaylistItem *>(topLevelItem(i));
+        for(const int column : qAsConst(columns))
+            item->measureWidth(column);
+    }
+}
+
+void Playlist::updateWidthStatistics(int column, int oldWidth, int newWidth)
+{
+    column += columnOffset();
+
+    if(oldWidth == newWidth || column >= m_widthCounts.count())
+        return;
+
+    if(oldWidth >= 0) {
+        m_widthSquares[column] -= qint64(oldWidth) * oldWidth;
+        --m_widthCounts[column];
+    }
+
+    if(newWidth >= 0) {
+        m_widthSquares[column] += qint64(newWidth) * newWidth;
+        ++m_widthCounts[column];
+    }
+
+    slotWeightDirty(column);
+}
+
+void Playlist::addWidthStatistics(const PlaylistItem *item)
+{
+    for(int column = 0; column <= PlaylistItem::lastColumn(); ++column)
+        updateWidthStatistics(column, -1, item->cachedWidth(column));
+}
+
+void Playlist::removeWidthStatistics(const PlaylistItem *item)
+{
+    for(int column = 0; column <= PlaylistItem::lastColumn(); ++column)
+        updateWidthStatistics(column, item->cachedWidth(column), -1);
+}
+
+void Playlist::Totals::add(int row, int sign)
+{
+    const TrackStore &store = CollectionList::instance()->trackStore();
+
+    count += sign;
+    seconds += sign * store.seconds(row);
+    bytes += sign * store.bytes(row);
+}
+
+void Playlist::updateTotals(const PlaylistItem *item, int sign)
+{
+    m_totals.add(item->trackRow(), sign);
+    if(!item->isHidden())
+        m_visibleTotals.add(item->trackRow(), sign);
+}
+
+void Playlist::setItemHidden(QTreeWidgetItem *item, bool hidden)
+{
+    if(item->isHidden() == hidden)
+        return;
+
+    item->setHidden(hidden);
+    m_shownItemsDirty = true;
+    m_visibleTotals.add(static_cast<PlaylistItem *>(item)->trackRow(), hidden ? -1 : 1);
+}
+
+void Playlist::columnWidthStatistics(QList<int> *widths, QList<int> *counts) const
+{
+    widths->clear();
+    counts->clear();
+
+    for(int column = 0; column < m_widthCounts.count(); ++column) {
+        const int count = m_widthCounts[column];
+        widths->append(count > 0 ? int(std::sqrt(double(m_widthSquares[column]) / count) + 0.5) : 0);
+        counts->append(count);
+    }
+}
+
+void Playlist::setColumnWidthStatistics(const QList<int> &widths, const QList<int> &counts)
+{
+    const int columns = qMin(widths.count(), counts.count());
+
+    if(m_widthCounts.count() < columns) {
+        m_widthSquares.resize(columns);
+        m_widthCounts.resize(columns);
+    }
+
+    // Counted as no more than one sample's worth of widths, so that what is
+    // measured from now on soon outweighs them.
+    for(int column = 0; column < columns; ++column) {
+        const int count = qBound(0, counts[column], widthSampleSize);
+        m_widthSquares[column] += qint64(widths[column]) * widths[column] * count;
+        m_widthCounts[column] += count;
+    }
+
+    slotWeightDirty();
 }
 
 void Playlist::addPlaylistFile(const QString &m3uFile)
@@ -1565,7 +1986,8 @@ void Playlist::addPlaylistFile(const QString &m3uFile)
 
 QFuture<void> Playlist::addFilesFromDirectory(const QString &dirPath)
 {
-    auto loader = new DirectoryLoader(dirPath);
+    auto loader = new DirectoryLoader(dirPath, directoryCache());
+    loader->setKnownFiles(knownFiles());
 
     connect(loader, &DirectoryLoader::loadedPlaylist, this,
         [this](const QString &m3uFile) {
@@ -1583,9 +2005,14 @@ QFuture<void> Playlist::addFilesFromDirectory(const QString &dirPath)
     auto future = QtConcurrent::run(loader, &DirectoryLoader::startLoading);
     auto loadWatcher = new QFutureWatcher<void>(this);
     connect(loadWatcher, &QFutureWatcher<void>::finished, this, [=]() {
+            // The loaded files were queued to this thread before loading
+            // finished, so their items have been created by now.
+            loader->recordScannedDirectories();
+            StringShare::purge();
             loader->deleteLater();
             loadWatcher->deleteLater();
         });
+    loadWatcher->setFuture(future);
 
     return future;
 }
@@ -1598,17 +2025,18 @@ QFuture<void> Playlist::addUntypedFile(const QString &file, PlaylistItem *after)
 
     const QFileInfo fileInfo(file);
     const QString canonicalPath = fileInfo.canonicalFilePath();
+    const MediaFiles::FileType fileType = MediaFiles::fileType(file);
 
     if(fileInfo.isFile() && fileInfo.isReadable() &&
-        MediaFiles::isMediaFile(file))
+        MediaFiles::isMediaType(fileType))
     {
-        FileHandle f(fileInfo);
+        FileHandle f(fileInfo, fileType);
         f.tag();
         createItem(f, after);
         return {};
     }
 
-    if(MediaFiles::isPlaylistFile(file)) {
+    if(fileType == MediaFiles::PlaylistFile) {
         addPlaylistFile(canonicalPath);
         return {};
     }
@@ -2049,34 +2477,40 @@ void Playlist::slotPlayCurrent()
     action("forward")->trigger();
 }
 
-void Playlist::slotUpdateTime()
+void Playlist::slotHeaderClicked(int column)
 {
-    int newTime = 0;
-    QTreeWidgetItemIterator it(this);
-    while(*it) {
-        const auto item = static_cast<const PlaylistItem*>(*it);
-        ++it;
-
-        newTime += item->file().tag()->seconds();
+    // With sorting enabled the view sorts by itself, which makes any
+    // background sort still running obsolete.
+    if(isSortingEnabled()) {
+        ++m_sortGeneration;
+        return;
     }
 
-    m_time = newTime;
+    // Playlists in the order they were saved or arranged in are left alone.
+    // After a background sort the click has flipped the indicator already.
+    if(m_sortedInBackground && column == header()->sortIndicatorSection())
+        sortByColumn(column, header()->sortIndicatorOrder());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // helper functions
 ////////////////////////////////////////////////////////////////////////////////
 
-QDataStream &operator<<(QDataStream &s, const Playlist &p)
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const Playlist &p)
 {
+    const PlaylistItemList items = const_cast<Playlist *>(&p)->items();
+
     s << p.name();
     s << p.fileName();
-    s << p.files();
+    s << quint32(items.count());
+
+    for(const PlaylistItem *item : items)
+        s.writeTrack(item->file());
 
     return s;
 }
 
-QDataStream &operator>>(QDataStream &s, Playlist &p)
+PlaylistDataStream &operator>>(PlaylistDataStream &s, Playlist &p)
 {
     p.read(s);
     return s;
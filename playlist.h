@@ -19,6 +19,7 @@
 #define JUK_PLAYLIST_H
 
 #include <QVector>
+#include <QHash>
 #include <QEvent>
 #include <QList>
 #include <QTreeWidget>
@@ -30,6 +31,7 @@
 #include "tagguesser.h"
 #include "playlistinterface.h"
 #include "filehandle.h"
+#include "playlistfileloader.h"
 #include "juk_debug.h"
 
 class KActionMenu;
@@ -42,6 +44,8 @@ class WebImageFetcher;
 class PlaylistItem;
 class PlaylistCollection;
 class CollectionListItem;
+class PlaylistDataStream;
+class DirectoryCache;
 
 typedef QVector<PlaylistItem *> PlaylistItemList;
 
@@ -78,7 +82,11 @@ public:
     virtual QString name() const override;
     virtual FileHandle currentFile() const override;
     virtual int count() const override { return model()->rowCount(); }
-    virtual int time() const override { return m_time; }
+    virtual int time() const override { return int(m_totals.seconds); }
+    virtual qint64 totalSize() const override { return m_totals.bytes; }
+    virtual int visibleCount() const override { return m_visibleTotals.count; }
+    virtual int visibleTime() const override { return int(m_visibleTotals.seconds); }
+    virtual qint64 visibleSize() const override { return m_visibleTotals.bytes; }
     virtual void playNext() override;
     virtual void playPrevious() override;
     virtual void stop() override;
@@ -215,8 +223,41 @@ public:
      */
     void showColumn(int c, bool updateSearch = true);
 
+    /**
+     * Sorts the playlist by \a column.  Large playlists are sorted in the
+     * background and reordered in one go once the sort has finished, or not
+     * at all if they are in order already (e.g. the collection as loaded
+     * from the cache); sorting then stays disabled so that the view does not
+     * sort them again itself.
+     */
     void sortByColumn(int column, Qt::SortOrder order = Qt::AscendingOrder);
 
+    /**
+     * Moves \a item to where it belongs in the current sort order, if the
+     * view does not keep itself sorted after a background sort.  Used when
+     * an item was added or retagged.
+     */
+    void updateSortPosition(PlaylistItem *item);
+
+    /**
+     * The weighted column widths are worked out from the sum of the squares of
+     * the text widths measured in each column, which is kept up to date as
+     * widths are measured and items come and go.  \a column does not include
+     * the column offset; a width of -1 means not measured.
+     */
+    void updateWidthStatistics(int column, int oldWidth, int newWidth);
+    void addWidthStatistics(const PlaylistItem *item);
+    void removeWidthStatistics(const PlaylistItem *item);
+
+    /**
+     * Adds the length and size of \a item to the totals of the playlist if
+     * \a sign is 1, or takes them out if it is -1.  The totals are kept up
+     * to date as items come and go, are retagged (see
+     * CollectionListItem::refresh()) or are hidden, so that time() and the
+     * like need not visit any item.
+     */
+    void updateTotals(const PlaylistItem *item, int sign);
+
     /**
      * This sets a name for the playlist that is \e different from the file name.
      */
@@ -281,6 +322,12 @@ public:
      */
     virtual int columnOffset() const { return 0; }
 
+    /**
+     * The columns that decide the order of items that are equal in the sort
+     * column, in the order they are tried, see PlaylistItem::compare().
+     */
+    const QVector<int> &sortTieBreakColumns() const;
+
     /**
      * Some subclasses of Playlist will be "read only" lists (i.e. the history
      * playlist).  This is a way for those subclasses to indicate that to the
@@ -320,7 +367,7 @@ public:
      */
     void applySharedSettings();
 
-    void read(QDataStream &s);
+    void read(PlaylistDataStream &s);
 
     static void setShuttingDown() { m_shuttingDown = true; }
 
@@ -437,13 +484,28 @@ protected:
     virtual void showEvent(QShowEvent *e) override;
     virtual void paintEvent(QPaintEvent *pe) override;
     virtual void resizeEvent(QResizeEvent *re) override;
+    virtual void scrollContentsBy(int dx, int dy) override;
 
     virtual void drawRow(QPainter *p, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
 
     virtual void insertItem(QTreeWidgetItem *item);
     virtual void takeItem(QTreeWidgetItem *item);
 
-    virtual bool hasItem(const QString &file) const { return m_members.contains(file); }
+    virtual bool hasItem(const QString &file) const;
+
+    /**
+     * Directories added to playlists that already hold every file of an
+     * unchanged directory (i.e. the CollectionList) may skip listing it
+     * again, see DirectoryCache.  Returns nullptr by default.
+     */
+    virtual DirectoryCache *directoryCache() { return nullptr; }
+
+    /**
+     * Files that don't need to be read again when a directory is added, with
+     * the modification time (in msecs since the epoch) as of when their tag
+     * was read.  Returns an empty map by default.
+     */
+    virtual QHash<QString, qint64> knownFiles() const { return QHash<QString, qint64>(); }
 
     /**
      * Do some final initialization of created items.  Notably ensure that they
@@ -459,6 +521,12 @@ protected:
      */
     void setDynamicListsFrozen(bool frozen);
 
+    /**
+     * Suppresses playlistItemsChanged() while many items are added at once.
+     * The caller should call playlistItemsChanged() when done.
+     */
+    void setBlockDataChanged(bool block) { m_blockDataChanged = block; }
+
     template <class ItemType, class SiblingType>
     ItemType *createItem(SiblingType *sibling, ItemType *after = nullptr);
 
@@ -515,9 +583,30 @@ private:
      * \a fileInfo should point to the same file as \a fileName.  This is a
      * little awkward API-wise, but keeps us from throwing away useful
      * information.
+     *
+     * The file is read and its entries resolved in the background; the items
+     * are added in one batch once that has finished.
      */
     void loadFile(const QString &fileName, const QFileInfo &fileInfo);
 
+    /**
+     * Hides or shows \a item, keeping the visible totals up to date.
+     */
+    void setItemHidden(QTreeWidgetItem *item, bool hidden);
+
+    /**
+     * Returns true if the items can be sorted by \a column from the keys in
+     * the TrackStore, see sortInBackground().
+     */
+    bool canSortInBackground(int column) const;
+
+    /**
+     * Gathers the sort keys of all items and sorts them with a PlaylistSorter
+     * on the thread pool, then reorders the items with applySortedRows().
+     */
+    void sortInBackground(int column, Qt::SortOrder order);
+    void applySortedRows(const QVector<QTreeWidgetItem *> &items, const QVector<int> &rows);
+
     /**
      * Writes \a text to \a item in \a column.  This is used by the inline tag
      * editor.  Returns false if the tag update failed.
@@ -546,6 +635,25 @@ private:
      */
     void calculateColumnWeights();
 
+    /**
+     * Measures the widths of the items on screen, and of a sample of the
+     * others for columns that do not have enough widths to go by yet.  Text
+     * is not measured otherwise.  The items on screen are only gone through
+     * again once scrolling, resizing or a change to the items made
+     * m_shownItemsDirty.
+     */
+    void measureShownItems();
+    void sampleColumnWidths();
+
+    /**
+     * The average text width of each column (as used for its weight) and
+     * the number of widths it was worked out from, so that the
+     * CollectionList can start with the weights it had last time instead of
+     * measuring anything.  The counts set are added to those measured.
+     */
+    void columnWidthStatistics(QList<int> *widths, QList<int> *counts) const;
+    void setColumnWidthStatistics(const QList<int> &widths, const QList<int> &counts);
+
     void addPlaylistFile(const QString &m3uFile);
     QFuture<void> addFilesFromDirectory(const QString &dirPath);
     QFuture<void> addUntypedFile(const QString &file, PlaylistItem *after = nullptr);
@@ -578,6 +686,11 @@ private:
      */
     CollectionListItem *collectionListItem(const FileHandle &file);
 
+    /**
+     * Adds the files found by the PlaylistFileLoader started in loadFile().
+     */
+    void addLoadedFiles(const QVector<PlaylistFileLoader::Entry> &entries);
+
     /**
      * This class is used internally to store settings that are shared by all
      * of the playlists, such as column order.  It is implemented as a singleton.
@@ -644,20 +757,35 @@ private slots:
     void columnResized(int column, int oldSize, int newSize);
 
     void slotPlayCurrent();
-    void slotUpdateTime();
+
+    /**
+     * Sorts in the background when the user clicks a header while sorting
+     * is disabled after a background sort.
+     */
+    void slotHeaderClicked(int column);
 
 private:
     friend class PlaylistItem;
 
     PlaylistCollection *m_collection = nullptr;
-    StringHash m_members;
+    TrackIdHash m_members; ///< FileHandle::persistentId() of the items
 
     // This is only defined if the playlist name is something other than the
     // file name.
     QString m_playlistName;
     QString m_fileName;
 
-    int  m_time            = 0;
+    struct Totals
+    {
+        int count      = 0;
+        qint64 seconds = 0;
+        qint64 bytes   = 0;
+
+        void add(int row, int sign);
+    };
+
+    Totals m_totals;
+    Totals m_visibleTotals;
     bool m_allowDuplicates = true;
 
     /**
@@ -666,18 +794,27 @@ private:
     QVector<int> m_columnWeights;
     QVector<int> m_columnFixedWidths;
     QVector<int> m_weightDirty;
+    QVector<qint64> m_widthSquares;
+    QVector<int> m_widthCounts;
     KActionMenu *m_columnVisibleAction = nullptr;
     bool m_columnWidthModeChanged      = false;
     bool m_disableColumnWidthUpdates   = true;
     bool m_widthsDirty                 = true;
+    bool m_shownItemsDirty             = true;
     bool m_applySharedSettings         = true;
 
     PlaylistSearch* m_search;
     bool m_searchEnabled = true;
 
     int  m_itemsLoading = 0; /// Count of pending file loads outstanding
+    PlaylistFileLoader *m_fileLoader = nullptr; /// The m3u file being loaded, if any
     bool m_blockDataChanged = false;
 
+    mutable QVector<int> m_sortTieBreakColumns;
+    mutable bool m_sortTieBreakColumnsDirty = true;
+    int m_sortGeneration = 0; /// Bumped to discard background sorts in progress
+    bool m_sortedInBackground = false; /// Sorted by sortInBackground(), see updateSortPosition()
+
     QAction *m_rmbEdit  = nullptr;
     QMenu *m_rmbMenu    = nullptr;
     QMenu *m_headerMenu = nullptr;
@@ -698,8 +835,8 @@ typedef QVector<Playlist *> PlaylistList;
 
 bool processEvents();
 
-QDataStream &operator<<(QDataStream &s, const Playlist &p);
-QDataStream &operator>>(QDataStream &s, Playlist &p);
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const Playlist &p);
+PlaylistDataStream &operator>>(PlaylistDataStream &s, Playlist &p);
 
 // template method implementations
 
@@ -707,7 +844,7 @@ template <class ItemType>
 ItemType *Playlist::createItem(const FileHandle &file, QTreeWidgetItem *after)
 {
     CollectionListItem *item = collectionListItem(file);
-    if(item && (!m_members.insert(file.absFilePath()) || m_allowDuplicates)) {
+    if(item && (!m_members.insert(item->file().persistentId()) || m_allowDuplicates)) {
         auto i = new ItemType(item, this, after);
         setupItem(i);
         return i;
@@ -721,7 +858,7 @@ ItemType *Playlist::createItem(SiblingType *sibling, ItemType *after)
 {
     m_disableColumnWidthUpdates = true;
 
-    if(!m_members.insert(sibling->file().absFilePath()) || m_allowDuplicates) {
+    if(!m_members.insert(sibling->file().persistentId()) || m_allowDuplicates) {
         after = new ItemType(sibling->collectionItem(), this, after);
         setupItem(after);
     }
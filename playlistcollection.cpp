@@ -24,13 +24,11 @@
 #include <kactionmenu.h>
 #include <kconfiggroup.h>
 #include <KSharedConfig>
-#include <kfileitem.h>
 
 #include <config-juk.h>
 
 #include <QAction>
 #include <QIcon>
-#include <QMutableListIterator>
 #include <QObject>
 #include <QPixmap>
 #include <QDir>
@@ -42,6 +40,7 @@
 #include <dirent.h>
 
 #include "collectionlist.h"
+#include "cache.h"
 #include "actioncollection.h"
 #include "advancedsearchdialog.h"
 #include "coverinfo.h"
@@ -104,17 +103,16 @@ PlaylistCollection::PlaylistCollection(PlayerManager *player, QStackedWidget *pl
 
     m_actionHandler = new ActionHandler(this);
 
-    // KDirLister's auto error handling seems to crash JuK during startup in
-    // readConfig().
-
-    m_dirLister.setAutoErrorHandlingEnabled(false, playlistStack);
     readConfig();
 }
 
 PlaylistCollection::~PlaylistCollection()
 {
     saveConfig();
-    CollectionList::instance()->saveItemsToCache();
+
+    // Everything is already in the cache or its journal, which only needs
+    // to be closed.
+    Cache::instance()->journal()->close();
     delete m_actionHandler;
     Playlist::setShuttingDown();
 }
@@ -139,6 +137,26 @@ int PlaylistCollection::time() const
     return currentPlaylist()->time();
 }
 
+qint64 PlaylistCollection::totalSize() const
+{
+    return currentPlaylist()->totalSize();
+}
+
+int PlaylistCollection::visibleCount() const
+{
+    return currentPlaylist()->visibleCount();
+}
+
+int PlaylistCollection::visibleTime() const
+{
+    return currentPlaylist()->visibleTime();
+}
+
+qint64 PlaylistCollection::visibleSize() const
+{
+    return currentPlaylist()->visibleSize();
+}
+
 void PlaylistCollection::playFirst()
 {
     m_playing = true;
@@ -375,7 +393,6 @@ void PlaylistCollection::addFolder()
     DirectoryList l(m_folderList, m_excludedFolderList, m_importPlaylists, JuK::JuKInstance());
 
     if(l.exec() == QDialog::Accepted) {
-        m_dirLister.blockSignals(true);
         DirectoryList::Result result = l.dialogResult();
 
         const bool reload = m_importPlaylists != result.addPlaylists;
@@ -384,15 +401,15 @@ void PlaylistCollection::addFolder()
         m_excludedFolderList = canonicalizeFolderPaths(result.excludedDirs);
 
         foreach(const QString &dir, result.addedDirs) {
-            m_dirLister.openUrl(QUrl::fromLocalFile(dir), KDirLister::Keep);
             m_folderList.append(dir);
         }
 
         foreach(const QString &dir, result.removedDirs) {
-            m_dirLister.stop(QUrl::fromLocalFile(dir));
             m_folderList.removeAll(dir);
         }
 
+        m_libraryWatcher.setFolders(m_folderList, m_excludedFolderList);
+
         if(reload) {
             open(m_folderList);
         }
@@ -401,8 +418,6 @@ void PlaylistCollection::addFolder()
         }
 
         saveConfig();
-
-        m_dirLister.blockSignals(false);
     }
 }
 
@@ -728,19 +743,20 @@ void PlaylistCollection::clearShowMore(bool raisePlaylist)
 
 void PlaylistCollection::enableDirWatch(bool enable)
 {
-    auto collection = CollectionList::instance();
+    // Changes from before e.g. renaming files are still applied, the ones
+    // made by JuK itself in the meantime are not.
+    if(!enable)
+        m_libraryWatcher.flush();
 
-    m_dirLister.disconnect(object());
+    m_libraryWatcher.disconnect(object());
     if(enable) {
-        QObject::connect(&m_dirLister, &KDirLister::newItems,
-                object(), [this](const KFileItemList &items) {
-                    this->newItems(items);
+        QObject::connect(&m_libraryWatcher, &LibraryWatcher::changesReady,
+                object(), [this](const LibraryChanges &changes) {
+                    this->libraryChanged(changes);
                 });
-        QObject::connect(&m_dirLister, &KDirLister::refreshItems,
-                collection, &CollectionList::slotRefreshItems);
-        QObject::connect(&m_dirLister, &KDirLister::itemsDeleted,
-                collection, &CollectionList::slotDeleteItems);
     }
+
+    m_libraryWatcher.setEnabled(enable);
 }
 
 QString PlaylistCollection::playlistNameDialog(const QString &caption,
@@ -814,7 +830,7 @@ void PlaylistCollection::dirChanged(const QString &path)
             return;
     }
 
-    CollectionList::instance()->addFiles(QStringList(canonicalPath));
+    m_libraryWatcher.addChangedPath(canonicalPath);
 }
 
 Playlist *PlaylistCollection::playlistByName(const QString &name) const
@@ -828,30 +844,18 @@ Playlist *PlaylistCollection::playlistByName(const QString &name) const
     return 0;
 }
 
-void PlaylistCollection::newItems(const KFileItemList &list) const
+void PlaylistCollection::libraryChanged(const LibraryChanges &changes)
 {
-    // Make fast-path for the normal case
-    if(m_excludedFolderList.isEmpty()) {
-        CollectionList::instance()->slotNewItems(list);
-        return;
-    }
-
-    // Slow case: Directories to exclude from consideration
-
-    KFileItemList filteredList(list);
-
-    foreach(const QString &excludedFolder, m_excludedFolderList) {
-        QMutableListIterator<KFileItem> filteredListIterator(filteredList);
-
-        while(filteredListIterator.hasNext()) {
-            const KFileItem fileItem = filteredListIterator.next();
+    auto collection = CollectionList::instance();
 
-            if(fileItem.url().path().startsWith(excludedFolder))
-                filteredListIterator.remove();
-        }
+    // Events were lost, so catch up with new files the way the startup scan
+    // does and look for changed and removed ones.
+    if(changes.rescanNeeded) {
+        collection->addFiles(m_folderList);
+        collection->slotCheckCache();
     }
 
-    CollectionList::instance()->slotNewItems(filteredList);
+    collection->applyLibraryChanges(changes);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -867,9 +871,7 @@ void PlaylistCollection::readConfig()
     m_excludedFolderList = canonicalizeFolderPaths(
             config.readEntry("ExcludeDirectoryList", QStringList()));
 
-    for(const auto &folder : m_folderList) {
-        m_dirLister.openUrl(QUrl::fromUserInput(folder), KDirLister::Keep);
-    }
+    m_libraryWatcher.setFolders(m_folderList, m_excludedFolderList);
 }
 
 void PlaylistCollection::saveConfig()
@@ -19,8 +19,8 @@
 
 #include "stringhash.h"
 #include "playlistinterface.h"
+#include "librarywatcher.h"
 
-#include <KDirLister>
 #include <KLocalizedString>
 
 #include <QPointer>
@@ -62,6 +62,10 @@ public:
     virtual FileHandle currentFile() const override;
     virtual int count() const override;
     virtual int time() const override;
+    virtual qint64 totalSize() const override;
+    virtual int visibleCount() const override;
+    virtual int visibleTime() const override;
+    virtual qint64 visibleSize() const override;
     virtual void playNext() override;
     virtual void playPrevious() override;
     virtual void stop() override;
@@ -135,7 +139,12 @@ public:
      */
     QObject *object() const;
 
-    void newItems(const KFileItemList &list) const;
+    /**
+     * Passes a batch of changes below the music folders on to the collection.
+     */
+    void libraryChanged(const LibraryChanges &changes);
+
+    const LibraryWatcher &libraryWatcher() const { return m_libraryWatcher; }
 
     /**
      * This is the current playlist in all things relating to the player.  It
@@ -203,7 +212,7 @@ private:
     ActionHandler    *m_actionHandler;
     PlayerManager    *m_playerManager;
 
-    KDirLister  m_dirLister;
+    LibraryWatcher m_libraryWatcher;
     StringHash  m_playlistNames;
     StringHash  m_playlistFiles;
     QStringList m_folderList;
@@ -277,8 +286,6 @@ private slots:
     void slotEnableDirWatch(bool enable)             { m_collection->enableDirWatch(enable); }
     void slotDirChanged(const QString &path)         { m_collection->dirChanged(path); }
 
-    void slotNewItems(const KFileItemList &list)     { m_collection->newItems(list); }
-
 signals:
     void signalSelectedItemsChanged();
     void signalCountChanged();
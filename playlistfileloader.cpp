@@ -0,0 +1,130 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistfileloader.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "mediafiles.h"
+#include "juk_debug.h"
+
+// Entries checked per work item.  Each new file costs a tag read, so keep
+// the chunks small enough to spread a large playlist over the thread pool.
+static const int CHUNK_SIZE = 128;
+
+PlaylistFileLoader::PlaylistFileLoader(const QString &fileName, const QString &directory,
+                                       const QHash<QString, qint64> &knownFiles,
+                                       QObject *parent)
+    : QObject(parent)
+    , m_fileName(fileName)
+    , m_directory(directory)
+    , m_knownFiles(knownFiles)
+{
+}
+
+void PlaylistFileLoader::startLoading()
+{
+    QFile file(m_fileName);
+    if(!file.open(QIODevice::ReadOnly)) {
+        qCWarning(JUK_LOG) << "Unable to read playlist" << m_fileName;
+        return;
+    }
+
+    QTextStream stream(&file);
+
+    if(m_fileName.endsWith(QLatin1String(".m3u8"), Qt::CaseInsensitive))
+        stream.setCodec("UTF-8");
+
+    while(!stream.atEnd()) {
+        const QString line = stream.readLine().trimmed();
+
+        // Comments and extended m3u directives such as #EXTINF
+        if(!line.isEmpty() && !line.startsWith(QLatin1Char('#')))
+            m_lines.append(line);
+    }
+
+    file.close();
+
+    m_entries.resize(m_lines.count());
+    emit entriesFound(m_lines.count());
+
+    QVector<QPair<int, int>> chunks;
+    for(int begin = 0; begin < m_lines.count(); begin += CHUNK_SIZE)
+        chunks.append(qMakePair(begin, qMin(begin + CHUNK_SIZE, m_lines.count())));
+
+    QtConcurrent::blockingMap(chunks, [this](const QPair<int, int> &chunk) {
+        checkEntries(chunk.first, chunk.second);
+    });
+
+    // Drop the unusable entries, keeping the order of the rest.
+    const auto end = std::remove_if(m_entries.begin(), m_entries.end(), [](const Entry &entry) {
+        return entry.path.isEmpty();
+    });
+    m_entries.erase(end, m_entries.end());
+    m_lines.clear();
+}
+
+void PlaylistFileLoader::checkEntries(int begin, int end)
+{
+    // Each chunk only writes to its own entries, which were allocated before
+    // the chunks started, so no locking is needed.
+    Entry *entries = m_entries.data();
+
+    for(int i = begin; i < end && !isCancelled(); ++i) {
+        const QString &line = m_lines[i];
+        const QString path = QDir::isRelativePath(line)
+            ? QDir::cleanPath(m_directory + QLatin1Char('/') + line)
+            : QDir::cleanPath(line);
+
+        // Most playlists are written with the same paths as the collection
+        // uses, which saves resolving them.
+        if(m_knownFiles.contains(path)) {
+            entries[i].path = path;
+            continue;
+        }
+
+        const QFileInfo fileInfo(path);
+        if(!fileInfo.isFile() || !fileInfo.isReadable())
+            continue;
+
+        const QString canonicalPath = fileInfo.canonicalFilePath();
+        if(m_knownFiles.contains(canonicalPath)) {
+            entries[i].path = canonicalPath;
+            continue;
+        }
+
+        const MediaFiles::FileType type = MediaFiles::fileType(path);
+        if(!MediaFiles::isMediaType(type))
+            continue;
+
+        FileHandle mediaFile(canonicalPath, type, fileInfo.lastModified(), fileInfo.size(), 0);
+        mediaFile.scanTag();
+
+        entries[i].path = canonicalPath;
+        entries[i].file = mediaFile;
+    }
+
+    emit entriesChecked(end - begin);
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_PLAYLISTFILELOADER_H
+#define JUK_PLAYLISTFILELOADER_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+
+#include "filehandle.h"
+
+/**
+ * Reads the entries of an m3u playlist file and finds the media files they
+ * point to, without touching the GUI thread.  Entries are resolved, checked
+ * and their tags read in parallel chunks; files that are already in the
+ * collection are only looked up by path, so that the GUI thread can reuse
+ * their items and no tag is read twice.
+ *
+ * Intended for use in a separate thread as a worker object, see CacheLoader.
+ * The entries are available in playlist order once startLoading() returns.
+ */
+class PlaylistFileLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Entry
+    {
+        QString path; ///< Canonical path, or empty if the entry is unusable
+        FileHandle file; ///< Null if the file is already in the collection
+    };
+
+    /**
+     * Relative entries in @p fileName are resolved against @p directory.
+     * @p knownFiles are the files of the collection, see
+     * Playlist::knownFiles().
+     */
+    PlaylistFileLoader(const QString &fileName, const QString &directory,
+                       const QHash<QString, qint64> &knownFiles,
+                       QObject *parent = nullptr);
+
+    /**
+     * Stops loading after the chunks currently being checked.  Thread-safe.
+     */
+    void cancel() { m_cancelled.storeRelease(1); }
+    bool isCancelled() const { return m_cancelled.loadAcquire() != 0; }
+
+    /**
+     * The usable entries of the playlist, in order.  Only valid once loading
+     * has finished.
+     */
+    const QVector<Entry> &entries() const { return m_entries; }
+
+public slots:
+    void startLoading();
+
+signals:
+    /**
+     * Emitted once the file has been read, with the number of entries that
+     * will be checked.
+     */
+    void entriesFound(int count);
+
+    /**
+     * Emitted as entries have been checked, including those skipped after a
+     * cancel(), so that the counts add up to those of entriesFound().
+     */
+    void entriesChecked(int count);
+
+private:
+    void checkEntries(int begin, int end);
+
+    QString m_fileName;
+    QString m_directory;
+    QHash<QString, qint64> m_knownFiles;
+    QStringList m_lines;
+    QVector<Entry> m_entries;
+    QAtomicInt m_cancelled;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -37,6 +37,19 @@ public:
     virtual int time() const = 0;
     virtual int count() const = 0;
 
+    /**
+     * The size of the files of all items, in bytes.
+     */
+    virtual qint64 totalSize() const = 0;
+
+    /**
+     * Like count(), time() and totalSize(), but only for the items a search
+     * leaves visible.
+     */
+    virtual int visibleCount() const = 0;
+    virtual int visibleTime() const = 0;
+    virtual qint64 visibleSize() const = 0;
+
     virtual void playNext() = 0;
     virtual void playPrevious() = 0;
     virtual void stop() = 0;
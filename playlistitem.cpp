@@ -42,6 +42,11 @@ static int naturalCompare(const QString &first, const QString &second)
     return collator.compare(first, second);
 }
 
+static int compareNumbers(int first, int second)
+{
+    return first > second ? 1 : (first < second ? -1 : 0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PlaylistItem public methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -61,6 +66,13 @@ PlaylistItem::~PlaylistItem()
             playlist()->setPlaying(0);
     }
 
+    // The CollectionListItem takes its widths and totals out itself before
+    // giving up its row.
+    if(m_collectionItem != this) {
+        playlist()->removeWidthStatistics(this);
+        playlist()->updateTotals(this, -1);
+    }
+
     playlist()->updateDeletedItem(this);
     emit playlist()->signalAboutToRemove(this);
 
@@ -70,8 +82,15 @@ PlaylistItem::~PlaylistItem()
 
 void PlaylistItem::setFile(const FileHandle &file)
 {
+    const quint64 id = d->fileHandle.persistentId();
+
     m_collectionItem->updateCollectionDict(d->fileHandle.absFilePath(), file.absFilePath());
     d->fileHandle = file;
+
+    // Still the same track, whatever was read from the file.
+    if(d->fileHandle.persistentId() == 0)
+        d->fileHandle.setPersistentId(id);
+
     refresh();
 }
 
@@ -129,6 +148,25 @@ QString PlaylistItem::text(int column) const
     }
 }
 
+QVariant PlaylistItem::data(int column, int role) const
+{
+    if(role != Qt::DisplayRole && role != Qt::EditRole && role != SortKeyRole)
+        return QTreeWidgetItem::data(column, role);
+
+    const int offset = playlist()->columnOffset();
+
+    if(column < offset || column > lastColumn() + offset)
+        return role == SortKeyRole ? QVariant() : QTreeWidgetItem::data(column, role);
+
+    if(role == SortKeyRole) {
+        if(!TrackStore::hasSortKey(column - offset))
+            return QVariant();
+        return CollectionList::instance()->trackStore().sortKey(d->row, column - offset);
+    }
+
+    return text(column);
+}
+
 void PlaylistItem::setText(int column, const QString &text)
 {
     QTreeWidgetItem::setText(column, text);
@@ -190,9 +228,15 @@ Playlist *PlaylistItem::playlist() const
     return static_cast<Playlist *>(treeWidget());
 }
 
-QVector<int> PlaylistItem::cachedWidths() const
+int PlaylistItem::cachedWidth(int column) const
+{
+    return CollectionList::instance()->trackStore().width(d->row, column);
+}
+
+void PlaylistItem::measureWidth(int column)
 {
-    return d->cachedWidths;
+    if(cachedWidth(column) < 0)
+        m_collectionItem->updateWidth(column);
 }
 
 void PlaylistItem::refresh()
@@ -243,12 +287,19 @@ PlaylistItem::PlaylistItem(CollectionList *parent) :
     setFlags(flags() | Qt::ItemIsEditable | Qt::ItemIsDragEnabled);
 }
 
+PlaylistItem::PlaylistItem() :
+    QTreeWidgetItem(),
+    m_watched(0)
+{
+    d = new Data;
+    m_collectionItem = static_cast<CollectionListItem *>(this);
+    setFlags(flags() | Qt::ItemIsEditable | Qt::ItemIsDragEnabled);
+}
+
 int PlaylistItem::compare(const QTreeWidgetItem *item, int column, bool ascending) const
 {
     // reimplemented from QListViewItem
 
-    int offset = playlist()->columnOffset();
-
     if(!item)
         return 0;
 
@@ -265,18 +316,14 @@ int PlaylistItem::compare(const QTreeWidgetItem *item, int column, bool ascendin
         return c;
     else {
         // Loop through the columns doing comparisons until something is differnt.
-        // If all else is the same, compare the track name.
-
-        int last = !playlist()->isColumnHidden(AlbumColumn + offset) ? TrackNumberColumn : ArtistColumn;
+        // The last one is the track name.
 
-        for(int i = ArtistColumn; i <= last; i++) {
-            if(!playlist()->isColumnHidden(i + offset)) {
-                c = compare(this, playlistItem, i, ascending);
-                if(c != 0)
-                    return c;
-            }
+        for(const int tieBreakColumn : playlist()->sortTieBreakColumns()) {
+            c = compare(this, playlistItem, tieBreakColumn, ascending);
+            if(c != 0)
+                return c;
         }
-        return compare(this, playlistItem, TrackColumn + offset, ascending);
+        return 0;
     }
 }
 
@@ -293,31 +340,17 @@ int PlaylistItem::compare(const PlaylistItem *firstItem, const PlaylistItem *sec
         return naturalCompare(first, second);
     }
 
+    const TrackStore &store = CollectionList::instance()->trackStore();
+    const int firstRow = firstItem->d->row;
+    const int secondRow = secondItem->d->row;
+
     switch(column - offset) {
     case TrackNumberColumn:
-        if(firstItem->d->fileHandle.tag()->track() > secondItem->d->fileHandle.tag()->track())
-            return 1;
-        else if(firstItem->d->fileHandle.tag()->track() < secondItem->d->fileHandle.tag()->track())
-            return -1;
-        else
-            return 0;
-        break;
+        return compareNumbers(store.track(firstRow), store.track(secondRow));
     case LengthColumn:
-        if(firstItem->d->fileHandle.tag()->seconds() > secondItem->d->fileHandle.tag()->seconds())
-            return 1;
-        else if(firstItem->d->fileHandle.tag()->seconds() < secondItem->d->fileHandle.tag()->seconds())
-            return -1;
-        else
-            return 0;
-        break;
+        return compareNumbers(store.seconds(firstRow), store.seconds(secondRow));
     case BitrateColumn:
-        if(firstItem->d->fileHandle.tag()->bitrate() > secondItem->d->fileHandle.tag()->bitrate())
-            return 1;
-        else if(firstItem->d->fileHandle.tag()->bitrate() < secondItem->d->fileHandle.tag()->bitrate())
-            return -1;
-        else
-            return 0;
-        break;
+        return compareNumbers(store.bitrate(firstRow), store.bitrate(secondRow));
     case CoverColumn:
         if(firstItem->d->fileHandle.coverInfo()->coverId() == secondItem->d->fileHandle.coverInfo()->coverId())
             return 0;
@@ -327,8 +360,7 @@ int PlaylistItem::compare(const PlaylistItem *firstItem, const PlaylistItem *sec
             return 1;
         break;
     default:
-        return naturalCompare(firstItem->d->metadata[column - offset],
-                              secondItem->d->metadata[column - offset]);
+        return store.compareSortKeys(firstRow, secondRow, column - offset);
     }
 }
 
@@ -360,12 +392,17 @@ void PlaylistItem::setup(CollectionListItem *item)
     item->addChildItem(this);
     setFlags(flags() | Qt::ItemIsEditable | Qt::ItemIsDragEnabled);
 
+    // The text itself comes from the shared data, see data().
+
     int offset = playlist()->columnOffset();
     int columns = lastColumn() + offset + 1;
 
     for(int i = offset; i < columns; i++) {
-        setText(i, text(i));
+        playlist()->slotWeightDirty(i);
     }
+
+    playlist()->addWidthStatistics(this);
+    playlist()->updateTotals(this, 1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -63,6 +63,14 @@ public:
                       FileNameColumn    = 10,
                       FullPathColumn    = 11 };
 
+    /**
+     * data() returns the lowercased text of columns that have a sort key in
+     * the TrackStore for this role, and nothing for other columns.  Lets
+     * searches that ignore case compare the interned keys instead of
+     * building and lowercasing the text of every item.
+     */
+    enum { SortKeyRole = Qt::UserRole + 1 };
+
     /**
      * A helper class to implement guarded pointer semantics.
      */
@@ -97,6 +105,13 @@ public:
     virtual QString text(int column) const;
     virtual void setText(int column, const QString &text);
 
+    /**
+     * The display text of the tag columns is taken from the shared track data
+     * when the view asks for it rather than being copied into every item, see
+     * text().  Other columns and roles are stored in the item as usual.
+     */
+    virtual QVariant data(int column, int role) const override;
+
     void setPlaying(bool playing = true, bool master = true);
 
     void guessTagInfo(TagGuesser::Type type);
@@ -114,9 +129,23 @@ public:
 
     /**
      * The widths of items are cached when they're updated for us in computations
-     * in the "weighted" listview column width mode.
+     * in the "weighted" listview column width mode.  \a column does not
+     * include the playlist's column offset.  Returns -1 until the width has
+     * been measured, see measureWidth().
      */
-    QVector<int> cachedWidths() const;
+    int cachedWidth(int column) const;
+
+    /**
+     * Measures the text width of \a column, unless that has been done
+     * already.  Text is only measured for items that are shown or sampled,
+     * see Playlist::calculateColumnWeights().
+     */
+    void measureWidth(int column);
+
+    /**
+     * The row of the track in the CollectionList's TrackStore.
+     */
+    int trackRow() const { return d->row; }
 
     /**
      * This just refreshes from the in memory data.  This may seem pointless at
@@ -167,6 +196,12 @@ protected:
      */
     PlaylistItem(CollectionList *parent);
 
+    /**
+     * Creates a CollectionList item that is not inserted into the list yet, so
+     * that many items can be added at once with addTopLevelItems().
+     */
+    PlaylistItem();
+
     /**
      * See the class documentation for an explanation of construction and deletion
      * of PlaylistItems.
@@ -189,8 +224,7 @@ protected:
     struct Data : public QSharedData
     {
         FileHandle fileHandle; // Set within CollectionList
-        QVector<QString> metadata; ///< Artist, album, or genre tags.  Other columns unfilled
-        QVector<int> cachedWidths;
+        int row = -1; ///< Sort keys, widths and numbers are kept in the TrackStore
     };
 
     using DataPtr = QExplicitlySharedDataPointer<Data>;
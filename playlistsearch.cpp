@@ -144,6 +144,7 @@ PlaylistSearch::Component::Component(const QString &query,
                                      const ColumnList &columns,
                                      MatchMode mode) :
     m_query(query),
+    m_lowerQuery(query.toLower()),
     m_columns(columns),
     m_mode(mode),
     m_searchAllVisible(columns.isEmpty()),
@@ -167,54 +168,26 @@ PlaylistSearch::Component::Component(const QRegExp &query, const ColumnList& col
 bool PlaylistSearch::Component::matches(int row, QModelIndex parent, QAbstractItemModel* model) const
 {
     for(int column : m_columns){
-        const QString str = model->index(row, column, parent).data().toString();
-        if(m_re){
-            return str.contains(m_queryRe);
-        }
-
-        switch(m_mode) {
-        case Contains:
-            if(str.contains(m_query, m_caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive))
-                return true;
-            break;
-        case Exact:
-            if(str.length() == m_query.length()) {
-                if(m_caseSensitive) {
-                    if(str == m_query)
-                        return true;
-                }
-                else if(str.toLower() == m_query.toLower())
-                    return true;
-            }
-            break;
-        case ContainsWord:
-        {
-            int i = str.indexOf(m_query, 0, m_caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive );
-
-            if(i >= 0) {
-
-                // If we found the pattern and the lengths are the same, then
-                // this is a match.
-
-                if(str.length() == m_query.length())
-                    return true;
-
-                // First: If the match starts at the beginning of the text or the
-                // character before the match is not a word character
-
-                // AND
-
-                // Second: Either the pattern was found at the end of the text,
-                // or the text following the match is a non-word character
-
-                // ...then we have a match
-
-                if((i == 0 || !str.at(i - 1).isLetterOrNumber()) &&
-                    (i + m_query.length() == str.length() || !str.at(i + m_query.length()).isLetterOrNumber()))
+        const QModelIndex index = model->index(row, column, parent);
+
+        // Searches that ignore case can use the lowercased sort keys of the
+        // TrackStore for the text columns, see PlaylistItem::SortKeyRole.
+        if(!m_re && !m_caseSensitive) {
+            const QString key = index.data(PlaylistItem::SortKeyRole).toString();
+            if(!key.isEmpty()) {
+                if(matchesText(key, m_lowerQuery, Qt::CaseSensitive))
                     return true;
+                continue;
             }
         }
+
+        const QString str = index.data().toString();
+        if(m_re){
+            return str.contains(m_queryRe);
         }
+
+        if(matchesText(str, m_query, m_caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive))
+            return true;
     };
     return false;
 }
@@ -230,6 +203,51 @@ bool PlaylistSearch::Component::operator==(const Component &v) const
         m_re == v.m_re;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Component private methods
+////////////////////////////////////////////////////////////////////////////////
+
+bool PlaylistSearch::Component::matchesText(const QString &str, const QString &query,
+                                            Qt::CaseSensitivity caseSensitivity) const
+{
+    switch(m_mode) {
+    case Contains:
+        return str.contains(query, caseSensitivity);
+    case Exact:
+        return str.length() == query.length() &&
+            str.compare(query, caseSensitivity) == 0;
+    case ContainsWord:
+    {
+        int i = str.indexOf(query, 0, caseSensitivity);
+
+        if(i >= 0) {
+
+            // If we found the pattern and the lengths are the same, then
+            // this is a match.
+
+            if(str.length() == query.length())
+                return true;
+
+            // First: If the match starts at the beginning of the text or the
+            // character before the match is not a word character
+
+            // AND
+
+            // Second: Either the pattern was found at the end of the text,
+            // or the text following the match is a non-word character
+
+            // ...then we have a match
+
+            if((i == 0 || !str.at(i - 1).isLetterOrNumber()) &&
+                (i + query.length() == str.length() || !str.at(i + query.length()).isLetterOrNumber()))
+                return true;
+        }
+    }
+    }
+
+    return false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // helper functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -118,7 +118,11 @@ public:
     bool operator==(const Component &v) const;
 
 private:
+    bool matchesText(const QString &str, const QString &query,
+                     Qt::CaseSensitivity caseSensitivity) const;
+
     QString m_query;
+    QString m_lowerQuery;
     QRegExp m_queryRe;
     mutable ColumnList m_columns;
     MatchMode m_mode;
@@ -0,0 +1,125 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistsorter.h"
+
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <numeric>
+
+// Below this, splitting the rows up costs more than it saves.
+static const int minimumRunLength = 4096;
+
+namespace {
+
+struct Run
+{
+    int begin;
+    int middle;
+    int end;
+};
+
+}
+
+PlaylistSorter::PlaylistSorter(const QVector<quint32> &keys, int keyCount, bool ascending) :
+    m_keys(keys),
+    m_keyCount(keyCount),
+    m_ascending(ascending)
+{
+}
+
+QVector<int> PlaylistSorter::sortedRows() const
+{
+    const int count = m_keyCount > 0 ? m_keys.count() / m_keyCount : 0;
+
+    QVector<int> rows(count);
+    std::iota(rows.begin(), rows.end(), 0);
+
+    const auto lessThan = [this](int first, int second) {
+        return this->lessThan(first, second);
+    };
+
+    const int runCount = qBound(1, count / minimumRunLength,
+                                qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+
+    QVector<Run> runs;
+    runs.reserve(runCount);
+    for(int i = 0; i < runCount; ++i) {
+        const int begin = int(qint64(count) * i / runCount);
+        const int end = int(qint64(count) * (i + 1) / runCount);
+        runs.append({ begin, end, end });
+    }
+
+    int *data = rows.data();
+
+    QtConcurrent::blockingMap(runs, [data, &lessThan](const Run &run) {
+        std::sort(data + run.begin, data + run.end, lessThan);
+    });
+
+    while(runs.count() > 1) {
+        QVector<Run> merges;
+        merges.reserve((runs.count() + 1) / 2);
+
+        for(int i = 0; i + 1 < runs.count(); i += 2)
+            merges.append({ runs[i].begin, runs[i].end, runs[i + 1].end });
+
+        QtConcurrent::blockingMap(merges, [data, &lessThan](const Run &run) {
+            std::inplace_merge(data + run.begin, data + run.middle, data + run.end, lessThan);
+        });
+
+        for(Run &merged : merges)
+            merged.middle = merged.end;
+
+        // An odd run out is merged in the next round.
+        if(runs.count() % 2)
+            merges.append(runs.last());
+
+        runs = merges;
+    }
+
+    return rows;
+}
+
+bool PlaylistSorter::isSorted() const
+{
+    const int count = m_keyCount > 0 ? m_keys.count() / m_keyCount : 0;
+
+    for(int row = 1; row < count; ++row) {
+        if(lessThan(row, row - 1))
+            return false;
+    }
+
+    return true;
+}
+
+bool PlaylistSorter::lessThan(int first, int second) const
+{
+    const quint32 *firstKeys = m_keys.constData() + qint64(first) * m_keyCount;
+    const quint32 *secondKeys = m_keys.constData() + qint64(second) * m_keyCount;
+
+    for(int i = 0; i < m_keyCount; ++i) {
+        if(firstKeys[i] != secondKeys[i])
+            return m_ascending ? firstKeys[i] < secondKeys[i] : firstKeys[i] > secondKeys[i];
+    }
+
+    // The row number as the last key makes the order total, so an unstable
+    // sort of the runs still keeps equal rows in their order.
+    return first < second;
+}
+
+// vim: set et sw=4 tw=0 sta:
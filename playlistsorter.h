@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_PLAYLISTSORTER_H
+#define JUK_PLAYLISTSORTER_H
+
+#include <QVector>
+
+/**
+ * Sorts the rows of a playlist by integer keys gathered beforehand, so that
+ * the sort itself does not need to touch any item and can run outside of the
+ * GUI thread.  Each row has the same number of keys, the sort column first
+ * and then the tie-break columns, see Playlist::sortTieBreakColumns().
+ *
+ * The rows are split into one run per pool thread, the runs are sorted in
+ * parallel and then merged pairwise, again in parallel.
+ */
+class PlaylistSorter
+{
+public:
+    /**
+     * @p keys holds @p keyCount keys for each row, row after row.  Rows are
+     * compared key by key, with the whole comparison reversed if
+     * @p ascending is false.  Rows with equal keys keep their order.
+     */
+    PlaylistSorter(const QVector<quint32> &keys, int keyCount, bool ascending);
+
+    /**
+     * The row numbers in sorted order.  Thread-safe.
+     */
+    QVector<int> sortedRows() const;
+
+    /**
+     * Returns true if the rows are in order already, which is much cheaper
+     * to find out than sorting them.
+     */
+    bool isSorted() const;
+
+    /**
+     * Turns a signed value into a key that sorts the same way.
+     */
+    static quint32 numberKey(int value) { return quint32(value) ^ 0x80000000u; }
+
+private:
+    bool lessThan(int first, int second) const;
+
+    QVector<quint32> m_keys;
+    int m_keyCount;
+    bool m_ascending;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
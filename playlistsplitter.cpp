@@ -300,6 +300,9 @@ void PlaylistSplitter::slotShowSearchResults()
     PlaylistList playlists;
     playlists.append(visiblePlaylist());
     visiblePlaylist()->setSearch(m_searchWidget->search(playlists));
+
+    // The status bar shows the totals of the search results.
+    emit currentPlaylistChanged(*visiblePlaylist());
 }
 
 void PlaylistSplitter::slotPlaylistSelectionChanged()
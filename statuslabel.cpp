@@ -27,6 +27,7 @@
 #include <QIcon>
 #include <QFrame>
 #include <QEvent>
+#include <QProgressBar>
 #include <QPushButton>
 #include <QStatusBar>
 
@@ -49,6 +50,12 @@ static QString formatTime(qint64 milliseconds)
     return fmt.formatDuration(milliseconds);
 }
 
+static QString formatSize(qint64 bytes)
+{
+    static const KFormat fmt;
+    return fmt.formatByteSize(double(bytes));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // public methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -62,6 +69,11 @@ StatusLabel::StatusLabel(const PlaylistInterface &currentPlaylist, QStatusBar *p
     m_playlistLabel->setAlignment(Qt::AlignLeft | Qt::AlignVCenter);
     parent->addWidget(m_playlistLabel, 1);
 
+    m_progressBar = new QProgressBar(this);
+    m_progressBar->setMaximumWidth(fontMetrics().boundingRect(QLatin1Char('M')).width() * 25);
+    m_progressBar->hide();
+    parent->addWidget(m_progressBar);
+
     m_trackLabel = new QLabel(this);
     m_trackLabel->setAlignment(Qt::AlignRight | Qt::AlignVCenter);
     m_trackLabel->setTextFormat(Qt::PlainText);
@@ -111,14 +123,36 @@ void StatusLabel::slotCurrentPlaylistHasChanged(const PlaylistInterface &current
         return;
     }
 
+    // Only what a search leaves of the playlist is counted.
+    const int count = currentPlaylist.count();
+    const int visibleCount = currentPlaylist.visibleCount();
+    const QString items = visibleCount == count
+        ? i18np("1 item", "%1 items", count)
+        : i18np("1 of %2 items", "%1 of %2 items", visibleCount, count);
+
     m_playlistLabel->setText(currentPlaylist.name());
     m_trackLabel->setText(
-            i18np("1 item", "%1 items", currentPlaylist.count()) +
+            items +
+            QStringLiteral(" - ") +
+            formatTime(qint64(1000) * currentPlaylist.visibleTime()) +
             QStringLiteral(" - ") +
-            formatTime(qint64(1000) * currentPlaylist.time())
+            formatSize(currentPlaylist.visibleSize())
             );
 }
 
+void StatusLabel::showProgress(const QString &text, int done, int total)
+{
+    if(total <= 0 || done >= total) {
+        m_progressBar->hide();
+        return;
+    }
+
+    m_progressBar->setRange(0, total);
+    m_progressBar->setValue(done);
+    m_progressBar->setFormat(text + QStringLiteral(" %p%"));
+    m_progressBar->show();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // private methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -24,6 +24,7 @@ class KSqueezedTextLabel;
 
 class QEvent;
 class QLabel;
+class QProgressBar;
 
 class FileHandle;
 class PlaylistInterface;
@@ -46,6 +47,13 @@ public slots:
     void setItemTotalTime(qint64 time_msec) { m_itemTotalTime = time_msec; }
     void setItemCurrentTime(qint64 time_msec) { m_itemCurrentTime = time_msec; updateTime(); }
 
+    /**
+     * Shows the progress of a background task as \a done out of \a total,
+     * labeled with \a text.  The progress bar is hidden again once \a done
+     * reaches \a total.
+     */
+    void showProgress(const QString &text, int done, int total);
+
 private:
     void updateTime();
     virtual bool eventFilter(QObject *o, QEvent *e) override;
@@ -53,6 +61,7 @@ private:
     KSqueezedTextLabel *m_playlistLabel = nullptr;
     QLabel             *m_trackLabel    = nullptr;
     QLabel             *m_itemTimeLabel = nullptr;
+    QProgressBar       *m_progressBar   = nullptr;
 
     int  m_itemTotalTime     = 0;
     int  m_itemCurrentTime   = 0;
@@ -40,6 +40,7 @@ public:
 };
 
 typedef Hash<QString> StringHash;
+typedef Hash<quint64> TrackIdHash;
 
 #endif
 
@@ -1,5 +1,6 @@
 /**
  * Copyright (C) 2003 Maksim Orlovich <maksim.orlovich@kdemail.net>
+ * Copyright (C) 2020 The JuK Authors
  *
  * This program is free software; you can redistribute it and/or modify it under
  * the terms of the GNU General Public License as published by the Free Software
@@ -13,55 +14,217 @@
  * You should have received a copy of the GNU General Public License along with
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+
+
 #include "stringshare.h"
 
-#include <QHash>
+#include <QMultiHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
 
-const int SIZE = 5003;
+#include "juk_debug.h"
 
-StringShare::Data* StringShare::s_data = 0;
+// Entries are kept in chunks that never move, so that string() can read them
+// without locking while other threads add strings.
+static const int CHUNK_BITS = 12;
+static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+static const int MAX_CHUNKS = 1 << 12;
 
-/**
- * We store the strings in a simple direct-mapped (i.e. no collision handling,
- * just replace) hash, which contain strings or null objects. This costs only
- * 4 bytes per slot on 32-bit archs, so with the default constant size we only
- * really use 40K or so.
- *
- * The end result is that many strings end up pointing to the same underlying data
- * object, instead of each one having its own little copy.
- *
- * More importantly, the way the tryShare function is coded ensures that
- * most-recently inserted text stays in the cache, which gives a better chance
- * of continuing to share data. (Even if something old ("foo") that was shared
- * gets kicked out, all the other "foo"s will still be sharing each other's
- * data.
- */
+// Strings that are only shared through tryShare() are dropped once unused;
+// look for them whenever the table has doubled since the last time.
+static const int MIN_PURGE_SIZE = 4096;
+
+// Taken by reference by QVector::append() and friends.
+const StringShare::Id StringShare::EmptyId;
+
+namespace {
+
+struct Entry
+{
+    QString string;
+    quint32 references = 0;
+};
+
+} // namespace
 
 struct StringShare::Data
 {
-    QString  qstringHash [SIZE];
+    // Tags are read by the DirectoryLoader threads as well.
+    QMutex lock;
+    Entry *chunks[MAX_CHUNKS] = {};
+    int chunkCount = 0;
+    quint32 entryCount = 0;  ///< Entries handed out, including free ones
+    QVector<Id> freeIds;
+    QMultiHash<uint, Id> ids;
+    int sizeAfterPurge = 0;
+    bool full = false;
+    Statistics statistics;
+
+    Entry &entry(Id id)
+    {
+        return chunks[(id - 1) >> CHUNK_BITS][(id - 1) & (CHUNK_SIZE - 1)];
+    }
+
+    Id find(const QString &in, uint hash)
+    {
+        for(auto it = ids.constFind(hash); it != ids.constEnd() && it.key() == hash; ++it) {
+            if(entry(it.value()).string == in)
+                return it.value();
+        }
+
+        return EmptyId;
+    }
+
+    Id insert(const QString &in, uint hash)
+    {
+        Id id;
+
+        if(!freeIds.isEmpty())
+            id = freeIds.takeLast();
+        else {
+            if(entryCount == quint32(chunkCount) * CHUNK_SIZE) {
+                if(chunkCount == MAX_CHUNKS) {
+                    if(!full) {
+                        qCWarning(JUK_LOG) << "String table is full at" << entryCount
+                                           << "strings, new ones are not shared";
+                        full = true;
+                    }
+                    return EmptyId;
+                }
+                chunks[chunkCount++] = new Entry[CHUNK_SIZE];
+            }
+            id = ++entryCount;
+        }
+
+        entry(id).string = in;
+        ids.insert(hash, id);
+        ++statistics.strings;
+
+        return id;
+    }
+
+    Id lookup(const QString &in)
+    {
+        const uint hash = qHash(in);
+        ++statistics.lookups;
+
+        Id id = find(in, hash);
+
+        if(id != EmptyId) {
+            const QString &shared = entry(id).string;
+            if(shared.constData() != in.constData())
+                statistics.bytesSaved += in.size() * qint64(sizeof(QChar));
+            return id;
+        }
+
+        return insert(in, hash);
+    }
 };
 
-StringShare::Data* StringShare::data()
+StringShare::Data *StringShare::data()
 {
-    if (!s_data)
-        s_data = new Data;
-    return s_data;
+    static Data *const dat = new Data;
+    return dat;
 }
 
-QString StringShare::tryShare(const QString& in)
+QString StringShare::tryShare(const QString &in)
 {
-    uint index = qHash(in) % SIZE;
+    if(in.isEmpty())
+        return in;
 
-    Data* dat = data();
-    if (dat->qstringHash[index] == in) //Match
-        return dat->qstringHash[index];
-    else
-    {
-        //Else replace whatever was there before
-        dat->qstringHash[index] = in;
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    const Id id = d->lookup(in);
+    if(id == EmptyId)
         return in;
+
+    return d->entry(id).string;
+}
+
+StringShare::Id StringShare::acquire(const QString &in)
+{
+    if(in.isEmpty())
+        return EmptyId;
+
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    const Id id = d->lookup(in);
+    if(id != EmptyId)
+        ++d->entry(id).references;
+
+    return id;
+}
+
+void StringShare::release(Id id)
+{
+    if(id == EmptyId)
+        return;
+
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    Entry &entry = d->entry(id);
+    if(entry.references > 0)
+        --entry.references;
+
+    // Unreferenced strings stay until the next purge, copies from tryShare()
+    // may still be around.
+}
+
+void StringShare::retain(Id id)
+{
+    if(id == EmptyId)
+        return;
+
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    ++d->entry(id).references;
+}
+
+const QString &StringShare::string(Id id)
+{
+    static const QString empty;
+
+    if(id == EmptyId)
+        return empty;
+
+    return data()->entry(id).string;
+}
+
+StringShare::Statistics StringShare::statistics()
+{
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    return d->statistics;
+}
+
+void StringShare::purge() // static
+{
+    Data *d = data();
+    QMutexLocker locker(&d->lock);
+
+    if(d->statistics.strings < qMax(MIN_PURGE_SIZE, 2 * d->sizeAfterPurge))
+        return;
+
+    for(Id id = 1; id <= d->entryCount; ++id) {
+        Entry &entry = d->entry(id);
+
+        // Only the table itself still uses the string.
+        if(entry.references == 0 && !entry.string.isNull() && entry.string.isDetached()) {
+            d->ids.remove(qHash(entry.string), id);
+            entry.string = QString();
+            d->freeIds.append(id);
+            --d->statistics.strings;
+        }
     }
+
+    d->sizeAfterPurge = d->statistics.strings;
+    d->full = false;
 }
 
 // vim: set et sw=4 tw=0 sta:
@@ -1,5 +1,6 @@
 /**
  * Copyright (C) 2003 Maksim Orlovich <maksim.orlovich@kdemail.net>
+ * Copyright (C) 2020 The JuK Authors
  *
  * This program is free software; you can redistribute it and/or modify it under
  * the terms of the GNU General Public License as published by the Free Software
@@ -14,24 +15,83 @@
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #ifndef STRING_SHARE_H
 #define STRING_SHARE_H
 
-class QString;
+#include <QString>
 
 /**
- * This class attempts to normalize repeated occurrences of strings to use
- *the same shared object, if possible, by using a small hash
+ * Interns strings that repeat throughout the collection (artists, albums,
+ * genres, sort keys) so that every occurrence uses the same shared object.
+ *
+ * Each distinct string is kept once and numbered with a compact 32-bit ID.
+ * Holders of an ID returned by acquire() keep the string alive until they
+ * release() it.  Strings only handed out by tryShare() are kept as long as a
+ * copy is still in use somewhere, which is noticed through QString's own
+ * reference count when the table is purged, see purge().  All methods are
+ * thread-safe.
  */
 class StringShare
 {
     struct Data;
 public:
-    static QString tryShare(const QString& in);
+    typedef quint32 Id;
+
+    /**
+     * The ID of the empty string, which is never stored.
+     */
+    static const Id EmptyId = 0;
+
+    struct Statistics
+    {
+        int strings = 0;        ///< Distinct strings currently interned
+        qint64 lookups = 0;     ///< Strings passed to tryShare() or acquire()
+        qint64 bytesSaved = 0;  ///< Character data not duplicated thanks to sharing
+
+        /**
+         * The average number of lookups per distinct string.
+         */
+        double dedupRatio() const { return strings > 0 ? double(lookups) / strings : 0.0; }
+    };
+
+    /**
+     * Returns the interned copy of @p in, interning it if it is new.  No
+     * reference is taken.
+     */
+    static QString tryShare(const QString &in);
+
+    /**
+     * Interns @p in and takes a reference to it, returning its ID.  Every
+     * acquire() must be matched by a release().  Returns EmptyId if the table
+     * is full, in which case the caller has to keep @p in itself.
+     */
+    static Id acquire(const QString &in);
+    static void release(Id id);
+
+    /**
+     * Takes another reference to @p id, which the caller already holds.
+     */
+    static void retain(Id id);
+
+    /**
+     * Returns the string with ID @p id.  The caller must hold a reference to
+     * it; no lock is taken.
+     */
+    static const QString &string(Id id);
+
+    static Statistics statistics();
+
+    /**
+     * Drops the strings that are neither referenced nor copied anywhere any
+     * more, once the table has doubled since the last purge.  This walks the
+     * whole table under the lock, so it is left to the GUI thread when it is
+     * done adding tracks rather than done by the threads reading tags.
+     */
+    static void purge();
 
 private:
-    static Data* data();
-    static Data* s_data;
+    static Data *data();
 };
 
 #endif
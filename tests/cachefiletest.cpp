@@ -0,0 +1,302 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachefile.h"
+#include "cache.h"
+#include "mediafiles.h"
+#include <QTest>
+#include <QBuffer>
+#include <QCryptographicHash>
+
+#include <cstring>
+
+class CacheFileTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRoundTrip();
+    void testMagic();
+    void testDamagedHeader();
+    void testDamagedDigests();
+    void testTruncated();
+    void testDamagedRecord();
+    void testDamagedPath();
+    void testUpgradedRecords();
+
+private:
+    static CacheTrackRecord record(int track);
+    static QString path(int track);
+    static void addTrack(CacheFileWriter *writer, int track, const CacheTrackRecord &record);
+    static QByteArray write(const CacheFileWriter &writer);
+    static QByteArray buildCache(int trackCount);
+    static CacheFileHeader header(const QByteArray &cache);
+    static void flipBit(QByteArray *cache, quint64 offset);
+    static const uchar *bytes(const QByteArray &cache);
+};
+
+void CacheFileTest::testRoundTrip()
+{
+    const QByteArray cache = buildCache(3);
+
+    CacheFileView view;
+    QVERIFY(view.open(bytes(cache), cache.size()));
+
+    QCOMPARE(view.version(), quint32(Cache::playlistItemsCacheVersion));
+    QCOMPARE(view.trackCount(), 3u);
+    QCOMPARE(view.damagedBlockCount(), 0);
+
+    for(quint32 i = 0; i < view.trackCount(); ++i) {
+        QVERIFY(view.isTrackIntact(i));
+        QCOMPARE(view.trackPath(i), path(int(i)));
+
+        const CacheTrackRecord &stored = view.track(i);
+        const CacheTrackRecord expected = record(int(i));
+
+        QCOMPARE(stored.track, expected.track);
+        QCOMPARE(stored.year, expected.year);
+        QCOMPARE(stored.seconds, expected.seconds);
+        QCOMPARE(stored.bitrate, expected.bitrate);
+        QCOMPARE(stored.flags, expected.flags);
+        QCOMPARE(stored.fileType, expected.fileType);
+        QCOMPARE(stored.modificationTime, expected.modificationTime);
+        QCOMPARE(stored.size, expected.size);
+        QCOMPARE(stored.inode, expected.inode);
+        QCOMPARE(stored.id, expected.id);
+
+        QCOMPARE(view.strings().string(stored.title), QString::fromLatin1("Title %1").arg(i));
+        QCOMPARE(view.strings().string(stored.artist), QString::fromLatin1("Artist"));
+        QCOMPARE(view.strings().string(stored.album), QString::fromLatin1("Album %1").arg(i % 2));
+        QCOMPARE(stored.genre, 0u);
+        QVERIFY(view.strings().string(stored.genre).isEmpty());
+    }
+
+    // Repeated strings are stored once and wrapped once
+    QCOMPARE(view.track(0).artist, view.track(2).artist);
+    QCOMPARE(view.track(0).album, view.track(2).album);
+    QCOMPARE(view.strings().string(view.track(0).artist).constData(),
+             view.strings().string(view.track(1).artist).constData());
+}
+
+void CacheFileTest::testMagic()
+{
+    QVERIFY(CacheFileView::hasMagic(buildCache(1)));
+    QVERIFY(!CacheFileView::hasMagic(QByteArray("JuK")));
+
+    QByteArray legacy;
+    QDataStream s(&legacy, QIODevice::WriteOnly);
+    s << qint32(2) << QString::fromLatin1("/music/legacy.mp3");
+    QVERIFY(!CacheFileView::hasMagic(legacy));
+}
+
+void CacheFileTest::testDamagedHeader()
+{
+    QByteArray cache = buildCache(3);
+    flipBit(&cache, offsetof(CacheFileHeader, trackCount));
+
+    CacheFileView view;
+    QVERIFY(!view.open(bytes(cache), cache.size()));
+    QVERIFY(!view.isOpen());
+}
+
+void CacheFileTest::testDamagedDigests()
+{
+    QByteArray cache = buildCache(3);
+    flipBit(&cache, header(cache).blockDigestsOffset);
+
+    CacheFileView view;
+    QVERIFY(!view.open(bytes(cache), cache.size()));
+}
+
+void CacheFileTest::testTruncated()
+{
+    const QByteArray cache = buildCache(3);
+
+    CacheFileView view;
+    QVERIFY(!view.open(bytes(cache), cache.size() - 1));
+    QVERIFY(!view.open(bytes(cache), sizeof(CacheFileHeader) - 1));
+    QVERIFY(!view.open(nullptr, 0));
+}
+
+void CacheFileTest::testDamagedRecord()
+{
+    // Enough tracks for the records to span several blocks
+    const int trackCount = 5000;
+    QByteArray cache = buildCache(trackCount);
+    const CacheFileHeader h = header(cache);
+
+    const quint32 last = trackCount - 1;
+    const quint64 lastRecord = h.recordsOffset + quint64(last) * sizeof(CacheTrackRecord);
+    const quint64 damagedBlock = (lastRecord - h.headerSize) / h.blockSize;
+
+    // The record of track 0, every string and every path come before the
+    // damaged block.
+    QVERIFY((h.recordsOffset + sizeof(CacheTrackRecord) - 1 - h.headerSize) / h.blockSize < damagedBlock);
+    QVERIFY((h.stringDataOffset + h.stringDataSize - 1 - h.headerSize) / h.blockSize < damagedBlock);
+    QVERIFY((h.pathsOffset + trackCount * sizeof(quint32) - 1 - h.headerSize) / h.blockSize < damagedBlock);
+
+    flipBit(&cache, lastRecord + offsetof(CacheTrackRecord, seconds));
+
+    CacheFileView view;
+    QVERIFY(view.open(bytes(cache), cache.size()));
+    QCOMPARE(view.damagedBlockCount(), 0);
+
+    QVERIFY(view.isTrackIntact(0));
+    QVERIFY(!view.isTrackIntact(last));
+    QCOMPARE(view.damagedBlockCount(), 1);
+
+    // The path is kept apart, so the track can still be read from disk
+    QCOMPARE(view.trackPath(last), path(int(last)));
+
+    // Checked once only
+    QVERIFY(!view.isTrackIntact(last));
+    QCOMPARE(view.damagedBlockCount(), 1);
+}
+
+void CacheFileTest::testDamagedPath()
+{
+    const int trackCount = 5000;
+    QByteArray cache = buildCache(trackCount);
+    const CacheFileHeader h = header(cache);
+
+    // Damage the last character of the string data, which belongs to the
+    // path of the last track.
+    flipBit(&cache, h.stringDataOffset + h.stringDataSize - sizeof(QChar));
+
+    CacheFileView view;
+    QVERIFY(view.open(bytes(cache), cache.size()));
+
+    QVERIFY(view.trackPath(trackCount - 1).isNull());
+    QCOMPARE(view.trackPath(0), path(0));
+    QVERIFY(view.damagedBlockCount() > 0);
+}
+
+void CacheFileTest::testUpgradedRecords()
+{
+    // Version 6 records have the layout of the current ones, but their flags
+    // and file type were still reserved, so whatever they hold is replaced.
+    CacheFileWriter writer;
+
+    addTrack(&writer, 0, record(0));
+
+    CacheTrackRecord silent = record(1);
+    silent.seconds = 0;
+    silent.bitrate = 0;
+    addTrack(&writer, 1, silent);
+
+    QByteArray cache = write(writer);
+    CacheFileHeader h = header(cache);
+    h.version = 6;
+
+    // Recompute the header digest
+    std::memset(h.headerDigest, 0, sizeof(h.headerDigest));
+    const QByteArray digest = QCryptographicHash::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char *>(&h), sizeof(h)),
+        QCryptographicHash::Md5);
+    std::memcpy(h.headerDigest, digest.constData(), sizeof(h.headerDigest));
+    std::memcpy(cache.data(), &h, sizeof(h));
+
+    CacheFileView view;
+    QVERIFY(view.open(bytes(cache), cache.size()));
+    QCOMPARE(view.version(), 6u);
+
+    QCOMPARE(view.track(0).flags, quint16(CacheTrackRecord::AudioPropertiesRead));
+    QCOMPARE(view.track(1).flags, quint16(0));
+    QCOMPARE(view.track(0).fileType, quint16(MediaFiles::UnknownFile));
+    QCOMPARE(view.track(0).seconds, record(0).seconds);
+    QCOMPARE(view.track(1).id, record(1).id);
+
+    QVERIFY(view.isTrackIntact(1));
+    QCOMPARE(view.trackPath(1), path(1));
+}
+
+CacheTrackRecord CacheFileTest::record(int track) // static
+{
+    CacheTrackRecord record;
+    std::memset(&record, 0, sizeof(record));
+
+    record.track   = track + 1;
+    record.year    = 1990 + track;
+    record.seconds = 180 + track;
+    record.bitrate = 192;
+    record.flags   = CacheTrackRecord::AudioPropertiesRead;
+    record.fileType = quint16(MediaFiles::VorbisFile);
+    record.modificationTime = 1577836800000 + track;
+    record.size    = 4000000 + track;
+    record.inode   = 100 + quint64(track);
+    record.id      = 0x100000000ull + quint64(track);
+
+    return record;
+}
+
+QString CacheFileTest::path(int track) // static
+{
+    return QString::fromLatin1("/music/Some Artist/Some Album/%1 - A track with a long name.ogg")
+        .arg(track, 5, 10, QLatin1Char('0'));
+}
+
+void CacheFileTest::addTrack(CacheFileWriter *writer, int track, const CacheTrackRecord &record) // static
+{
+    writer->addTrack(path(track), record,
+                     QString::fromLatin1("Title %1").arg(track), QString::fromLatin1("Artist"),
+                     QString::fromLatin1("Album %1").arg(track % 2), QString(), QString());
+}
+
+QByteArray CacheFileTest::write(const CacheFileWriter &writer) // static
+{
+    QByteArray cache;
+    QBuffer buffer(&cache);
+    buffer.open(QIODevice::WriteOnly);
+    if(!writer.write(&buffer))
+        qFatal("Unable to write the cache");
+
+    return cache;
+}
+
+QByteArray CacheFileTest::buildCache(int trackCount) // static
+{
+    CacheFileWriter writer;
+    writer.reserve(trackCount);
+
+    for(int i = 0; i < trackCount; ++i)
+        addTrack(&writer, i, record(i));
+
+    return write(writer);
+}
+
+CacheFileHeader CacheFileTest::header(const QByteArray &cache) // static
+{
+    CacheFileHeader header;
+    std::memcpy(&header, cache.constData(), sizeof(header));
+    return header;
+}
+
+void CacheFileTest::flipBit(QByteArray *cache, quint64 offset) // static
+{
+    (*cache)[int(offset)] = char((*cache)[int(offset)] ^ 1);
+}
+
+const uchar *CacheFileTest::bytes(const QByteArray &cache) // static
+{
+    // QByteArray data is 8-byte aligned, as the records need.
+    return reinterpret_cast<const uchar *>(cache.constData());
+}
+
+QTEST_GUILESS_MAIN(CacheFileTest)
+
+// vim: set et sw=4 tw=0 sta:
+
+#include "cachefiletest.moc"
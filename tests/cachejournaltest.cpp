@@ -0,0 +1,234 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachejournalformat.h"
+#include <QTest>
+#include <QBuffer>
+#include <QDataStream>
+
+class CacheJournalTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testHeader_data();
+    void testHeader();
+    void testReplay();
+    void testTornEntry_data();
+    void testTornEntry();
+    void testDamagedEntry();
+    void testAppendAfterReplay();
+
+private:
+    static QList<QByteArray> payloads();
+    static QByteArray journal(const QList<QByteArray> &payloads);
+
+    /**
+     * Reads the entries of @p journal like CacheJournal::replay() does and
+     * returns their payloads.  @p validSize is set to the end of the last
+     * intact entry.
+     */
+    static QList<QByteArray> replay(const QByteArray &journal, qint64 *validSize);
+};
+
+void CacheJournalTest::testHeader_data()
+{
+    QTest::addColumn<quint32>("magic");
+    QTest::addColumn<qint32>("version");
+    QTest::addColumn<qint32>("expected");
+
+    const quint32 magic = 0x4A754B4A;
+
+    QTest::newRow("current") << magic << CacheJournalFormat::currentVersion << CacheJournalFormat::currentVersion;
+    QTest::newRow("version 1") << magic << 1 << 1;
+    QTest::newRow("version 2") << magic << 2 << 2;
+    QTest::newRow("version 3") << magic << 3 << 3;
+    QTest::newRow("version 0") << magic << 0 << 0;
+    QTest::newRow("newer") << magic << CacheJournalFormat::currentVersion + 1 << 0;
+    QTest::newRow("bad magic") << (magic ^ 1) << CacheJournalFormat::currentVersion << 0;
+}
+
+void CacheJournalTest::testHeader()
+{
+    QFETCH(quint32, magic);
+    QFETCH(qint32, version);
+    QFETCH(qint32, expected);
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << magic << version;
+
+    QDataStream in(data);
+    QCOMPARE(CacheJournalFormat::readHeader(in), expected);
+
+    // Too short to hold a header at all
+    QDataStream truncated(data.left(6));
+    QCOMPARE(CacheJournalFormat::readHeader(truncated), 0);
+}
+
+void CacheJournalTest::testReplay()
+{
+    const QByteArray header = CacheJournalFormat::header();
+    QCOMPARE(qint64(header.size()), CacheJournalFormat::headerSize);
+
+    QDataStream s(header);
+    QCOMPARE(CacheJournalFormat::readHeader(s), CacheJournalFormat::currentVersion);
+
+    const QByteArray data = journal(payloads());
+
+    qint64 validSize = 0;
+    QCOMPARE(replay(data, &validSize), payloads());
+    QCOMPARE(validSize, qint64(data.size()));
+
+    // A journal without entries
+    QVERIFY(replay(header, &validSize).isEmpty());
+    QCOMPARE(validSize, CacheJournalFormat::headerSize);
+}
+
+void CacheJournalTest::testTornEntry_data()
+{
+    QTest::addColumn<int>("missing");
+
+    // Everything from a single byte of the payload to all of it and the
+    // size and checksum in front of it.
+    const int lastEntrySize = CacheJournalFormat::entry(payloads().last()).size();
+
+    QTest::newRow("last byte") << 1;
+    QTest::newRow("half the payload") << payloads().last().size() / 2;
+    QTest::newRow("the payload") << payloads().last().size();
+    QTest::newRow("part of the checksum") << payloads().last().size() + 1;
+    QTest::newRow("part of the size") << lastEntrySize - 2;
+    QTest::newRow("all but one byte") << lastEntrySize - 1;
+}
+
+void CacheJournalTest::testTornEntry()
+{
+    QFETCH(int, missing);
+
+    const QList<QByteArray> written = payloads();
+    const QByteArray complete = journal(written);
+    const QByteArray torn = complete.left(complete.size() - missing);
+
+    qint64 validSize = 0;
+    const QList<QByteArray> replayed = replay(torn, &validSize);
+
+    QCOMPARE(replayed, written.mid(0, written.size() - 1));
+    QCOMPARE(validSize, qint64(journal(replayed).size()));
+}
+
+void CacheJournalTest::testDamagedEntry()
+{
+    const QList<QByteArray> written = payloads();
+    QByteArray data = journal(written);
+
+    // Damage the payload of the second entry; it and everything after it
+    // have to go.
+    const qint64 secondEntry = journal(written.mid(0, 1)).size();
+    const int payloadStart = int(secondEntry) + int(sizeof(quint32) + sizeof(quint16));
+    data[payloadStart] = char(data[payloadStart] ^ 1);
+
+    qint64 validSize = 0;
+    QCOMPARE(replay(data, &validSize), written.mid(0, 1));
+    QCOMPARE(validSize, secondEntry);
+
+    // A size running past the end of the journal
+    QByteArray oversized;
+    QDataStream s(&oversized, QIODevice::WriteOnly);
+    s << quint32(1024 * 1024) << quint16(0);
+    data = journal(written.mid(0, 1)) + oversized;
+
+    QCOMPARE(replay(data, &validSize), written.mid(0, 1));
+    QCOMPARE(validSize, secondEntry);
+}
+
+void CacheJournalTest::testAppendAfterReplay()
+{
+    // CacheJournal::open() cuts a torn journal back to its valid size before
+    // appending, so new entries are not hidden behind the torn one.
+    const QList<QByteArray> written = payloads();
+    const QByteArray complete = journal(written);
+
+    qint64 validSize = 0;
+    replay(complete.left(complete.size() - 3), &validSize);
+
+    const QByteArray appended = QByteArray("appended after a crash");
+    const QByteArray data = complete.left(int(validSize)) + CacheJournalFormat::entry(appended);
+
+    QList<QByteArray> expected = written.mid(0, written.size() - 1);
+    expected.append(appended);
+
+    QCOMPARE(replay(data, &validSize), expected);
+    QCOMPARE(validSize, qint64(data.size()));
+}
+
+QList<QByteArray> CacheJournalTest::payloads() // static
+{
+    QList<QByteArray> payloads;
+
+    for(int i = 0; i < 5; ++i) {
+        QByteArray payload;
+        QDataStream s(&payload, QIODevice::WriteOnly);
+        s << qint8(1) << QString::fromLatin1("/music/track %1.ogg").arg(i) << quint64(1000 + i);
+        payloads.append(payload);
+    }
+
+    // Empty payloads are valid as well
+    payloads.append(QByteArray());
+    payloads.append(QByteArray(300, 'x'));
+
+    return payloads;
+}
+
+QByteArray CacheJournalTest::journal(const QList<QByteArray> &payloads) // static
+{
+    QByteArray journal = CacheJournalFormat::header();
+
+    for(const QByteArray &payload : payloads)
+        journal += CacheJournalFormat::entry(payload);
+
+    return journal;
+}
+
+QList<QByteArray> CacheJournalTest::replay(const QByteArray &journal, qint64 *validSize) // static
+{
+    QList<QByteArray> payloads;
+
+    QBuffer buffer;
+    buffer.setData(journal);
+    buffer.open(QIODevice::ReadOnly);
+
+    QDataStream s(&buffer);
+    *validSize = 0;
+
+    if(CacheJournalFormat::readHeader(s) == 0)
+        return payloads;
+
+    *validSize = buffer.pos();
+
+    QByteArray payload;
+    while(CacheJournalFormat::readEntry(s, &payload)) {
+        payloads.append(payload);
+        *validSize = buffer.pos();
+    }
+
+    return payloads;
+}
+
+QTEST_GUILESS_MAIN(CacheJournalTest)
+
+// vim: set et sw=4 tw=0 sta:
+
+#include "cachejournaltest.moc"
@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistsorter.h"
+#include <QTest>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <numeric>
+
+class PlaylistSorterTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanupTestCase();
+
+    void testSortedRows_data();
+    void testSortedRows();
+    void testIsSorted();
+    void testNumberKey();
+
+private:
+    static QVector<quint32> randomKeys(int rows, int keyCount, quint32 range);
+    static QVector<int> stableSortedRows(const QVector<quint32> &keys, int keyCount, bool ascending);
+
+    int m_threadCount = QThreadPool::globalInstance()->maxThreadCount();
+};
+
+void PlaylistSorterTest::cleanupTestCase()
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(m_threadCount);
+}
+
+void PlaylistSorterTest::testSortedRows_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::addColumn<int>("keyCount");
+    QTest::addColumn<quint32>("range");
+    QTest::addColumn<bool>("ascending");
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("empty") << 0 << 1 << 10u << true << 4;
+    QTest::newRow("one row") << 1 << 2 << 10u << true << 4;
+    QTest::newRow("single run") << 1000 << 1 << 100u << true << 4;
+    QTest::newRow("single run, descending") << 1000 << 1 << 100u << false << 4;
+    QTest::newRow("tie-breaks") << 1000 << 3 << 3u << true << 4;
+
+    // At least 4096 rows per run, so these are split and merged
+    QTest::newRow("two runs") << 2 * 4096 << 2 << 50u << true << 2;
+    QTest::newRow("odd run count") << 3 * 4096 + 17 << 2 << 50u << true << 3;
+    QTest::newRow("odd run count, descending") << 3 * 4096 + 17 << 2 << 50u << false << 3;
+    QTest::newRow("four runs") << 4 * 4096 << 3 << 5u << true << 4;
+    QTest::newRow("more threads than runs") << 5 * 4096 << 1 << 1000u << false << 16;
+    QTest::newRow("one thread") << 3 * 4096 << 2 << 50u << true << 1;
+}
+
+void PlaylistSorterTest::testSortedRows()
+{
+    QFETCH(int, rows);
+    QFETCH(int, keyCount);
+    QFETCH(quint32, range);
+    QFETCH(bool, ascending);
+    QFETCH(int, threads);
+
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+    const QVector<quint32> keys = randomKeys(rows, keyCount, range);
+    const PlaylistSorter sorter(keys, keyCount, ascending);
+
+    // Rows with equal keys must keep their order, so there is only one
+    // correct result.
+    QCOMPARE(sorter.sortedRows(), stableSortedRows(keys, keyCount, ascending));
+}
+
+void PlaylistSorterTest::testIsSorted()
+{
+    QVERIFY(PlaylistSorter(QVector<quint32>(), 1, true).isSorted());
+    QVERIFY(PlaylistSorter(QVector<quint32> { 7 }, 1, false).isSorted());
+
+    const QVector<quint32> ascending { 1, 2, 2, 3 };
+    QVERIFY(PlaylistSorter(ascending, 1, true).isSorted());
+    QVERIFY(!PlaylistSorter(ascending, 1, false).isSorted());
+
+    // Equal keys are in order either way
+    const QVector<quint32> equal { 5, 5, 5 };
+    QVERIFY(PlaylistSorter(equal, 1, true).isSorted());
+    QVERIFY(PlaylistSorter(equal, 1, false).isSorted());
+
+    // Two keys per row: the second only breaks ties of the first
+    QVERIFY(PlaylistSorter(QVector<quint32> { 1, 9,  2, 0,  2, 1 }, 2, true).isSorted());
+    QVERIFY(!PlaylistSorter(QVector<quint32> { 1, 9,  2, 1,  2, 0 }, 2, true).isSorted());
+
+    // Whatever sortedRows() returns is sorted
+    const int keyCount = 2;
+    const QVector<quint32> keys = randomKeys(5000, keyCount, 20);
+    const QVector<int> rows = PlaylistSorter(keys, keyCount, true).sortedRows();
+
+    QVector<quint32> sortedKeys;
+    sortedKeys.reserve(keys.count());
+    for(int row : rows) {
+        for(int i = 0; i < keyCount; ++i)
+            sortedKeys.append(keys[row * keyCount + i]);
+    }
+
+    QVERIFY(!PlaylistSorter(keys, keyCount, true).isSorted());
+    QVERIFY(PlaylistSorter(sortedKeys, keyCount, true).isSorted());
+}
+
+void PlaylistSorterTest::testNumberKey()
+{
+    const QVector<int> values { -2147483647 - 1, -1000, -1, 0, 1, 42, 2147483647 };
+
+    for(int i = 1; i < values.count(); ++i)
+        QVERIFY(PlaylistSorter::numberKey(values[i - 1]) < PlaylistSorter::numberKey(values[i]));
+}
+
+QVector<quint32> PlaylistSorterTest::randomKeys(int rows, int keyCount, quint32 range) // static
+{
+    // A fixed seed keeps failures reproducible.
+    quint32 state = 12345;
+
+    QVector<quint32> keys(rows * keyCount);
+    for(quint32 &key : keys) {
+        state = state * 1103515245u + 12345u;
+        key = (state >> 16) % range;
+    }
+
+    return keys;
+}
+
+QVector<int> PlaylistSorterTest::stableSortedRows(const QVector<quint32> &keys, int keyCount, bool ascending) // static
+{
+    QVector<int> rows(keyCount > 0 ? keys.count() / keyCount : 0);
+    std::iota(rows.begin(), rows.end(), 0);
+
+    std::stable_sort(rows.begin(), rows.end(), [&](int first, int second) {
+        const auto firstKeys = keys.constBegin() + first * keyCount;
+        const auto secondKeys = keys.constBegin() + second * keyCount;
+
+        return ascending
+            ? std::lexicographical_compare(firstKeys, firstKeys + keyCount, secondKeys, secondKeys + keyCount)
+            : std::lexicographical_compare(secondKeys, secondKeys + keyCount, firstKeys, firstKeys + keyCount);
+    });
+
+    return rows;
+}
+
+QTEST_GUILESS_MAIN(PlaylistSorterTest)
+
+// vim: set et sw=4 tw=0 sta:
+
+#include "playlistsortertest.moc"
@@ -0,0 +1,141 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stringshare.h"
+#include <QTest>
+
+// StringShare is a single table for the whole process, so every test uses
+// strings of its own and only looks at how the statistics change.
+
+class StringShareTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEmpty();
+    void testAcquire();
+    void testTryShare();
+    void testStatistics();
+    void testPurge();
+};
+
+void StringShareTest::testEmpty()
+{
+    QCOMPARE(StringShare::acquire(QString()), StringShare::EmptyId);
+    QCOMPARE(StringShare::acquire(QLatin1String("")), StringShare::EmptyId);
+    QVERIFY(StringShare::string(StringShare::EmptyId).isEmpty());
+    QVERIFY(StringShare::tryShare(QString()).isNull());
+
+    // Must be harmless
+    StringShare::retain(StringShare::EmptyId);
+    StringShare::release(StringShare::EmptyId);
+}
+
+void StringShareTest::testAcquire()
+{
+    const StringShare::Id first = StringShare::acquire(QString::fromLatin1("acquire-artist"));
+    const StringShare::Id second = StringShare::acquire(QString::fromLatin1("acquire-artist"));
+    const StringShare::Id other = StringShare::acquire(QString::fromLatin1("acquire-album"));
+
+    QVERIFY(first != StringShare::EmptyId);
+    QCOMPARE(second, first);
+    QVERIFY(other != first);
+
+    QCOMPARE(StringShare::string(first), QString::fromLatin1("acquire-artist"));
+    QCOMPARE(StringShare::string(other), QString::fromLatin1("acquire-album"));
+
+    // Equal strings end up sharing their data
+    QCOMPARE(StringShare::string(first).constData(), StringShare::string(second).constData());
+
+    StringShare::release(first);
+    StringShare::release(second);
+    StringShare::release(other);
+}
+
+void StringShareTest::testTryShare()
+{
+    const QString first = StringShare::tryShare(QString::fromLatin1("tryshare-genre"));
+    const QString second = StringShare::tryShare(QString::fromLatin1("tryshare-genre"));
+
+    QCOMPARE(first, QString::fromLatin1("tryshare-genre"));
+    QCOMPARE(second.constData(), first.constData());
+
+    // Strings handed out by tryShare() and acquire() are the same entry
+    const StringShare::Id id = StringShare::acquire(QString::fromLatin1("tryshare-genre"));
+    QCOMPARE(StringShare::string(id).constData(), first.constData());
+    StringShare::release(id);
+}
+
+void StringShareTest::testStatistics()
+{
+    const StringShare::Statistics before = StringShare::statistics();
+
+    const QString value = QString::fromLatin1("statistics-comment");
+    const StringShare::Id first = StringShare::acquire(value);
+    const StringShare::Id second = StringShare::acquire(QString::fromLatin1("statistics-comment"));
+
+    const StringShare::Statistics after = StringShare::statistics();
+
+    QCOMPARE(after.strings, before.strings + 1);
+    QCOMPARE(after.lookups, before.lookups + 2);
+
+    // Only the second, separately allocated copy saved anything
+    QCOMPARE(after.bytesSaved, before.bytesSaved + value.size() * qint64(sizeof(QChar)));
+    QVERIFY(after.dedupRatio() > 0.0);
+
+    StringShare::release(first);
+    StringShare::release(second);
+}
+
+void StringShareTest::testPurge()
+{
+    const StringShare::Id held = StringShare::acquire(QString::fromLatin1("purge-held"));
+    StringShare::retain(held);
+    StringShare::release(held);
+
+    const StringShare::Id dropped = StringShare::acquire(QString::fromLatin1("purge-dropped"));
+    StringShare::release(dropped);
+
+    const QString kept = StringShare::tryShare(QString::fromLatin1("purge-kept"));
+
+    // Enough strings to pass the purge threshold, none of which is used
+    // afterwards.  Adding them never purges by itself.
+    const int added = 3 * 4096;
+    for(int i = 0; i < added; ++i)
+        StringShare::tryShare(QString::fromLatin1("purge-%1").arg(i));
+
+    QVERIFY(StringShare::statistics().strings >= added);
+
+    StringShare::purge();
+    QVERIFY(StringShare::statistics().strings < added);
+
+    // Still referenced through its ID
+    QCOMPARE(StringShare::string(held), QString::fromLatin1("purge-held"));
+
+    // Unreferenced, so cleared or reused by now
+    QVERIFY(StringShare::string(dropped) != QString::fromLatin1("purge-dropped"));
+
+    // Still in use as a copy of the shared string
+    QCOMPARE(StringShare::tryShare(QString::fromLatin1("purge-kept")).constData(), kept.constData());
+
+    StringShare::release(held);
+}
+
+QTEST_GUILESS_MAIN(StringShareTest)
+
+// vim: set et sw=4 tw=0 sta:
+
+#include "stringsharetest.moc"
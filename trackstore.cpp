@@ -0,0 +1,252 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trackstore.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "juktag.h"
+
+TrackStore::TrackStore()
+{
+    std::fill(m_unrankedRows, m_unrankedRows + ColumnCount, 0);
+    std::fill(m_changeCounts, m_changeCounts + ColumnCount, 0);
+
+    m_collator.setNumericMode(true);
+    m_collator.setCaseSensitivity(Qt::CaseInsensitive);
+}
+
+bool TrackStore::hasSortKey(int column) // static
+{
+    switch(column) {
+    case PlaylistItem::CoverColumn:
+    case PlaylistItem::TrackNumberColumn:
+    case PlaylistItem::LengthColumn:
+    case PlaylistItem::BitrateColumn:
+        return false;
+    default:
+        return column >= 0 && column < ColumnCount;
+    }
+}
+
+int TrackStore::allocate()
+{
+    if(!m_freeRows.isEmpty())
+        return m_freeRows.takeLast();
+
+    const int row = m_seconds.count();
+
+    m_track.append(0);
+    m_year.append(0);
+    m_seconds.append(0);
+    m_bitrate.append(0);
+    m_bytes.append(0);
+
+    for(int column = 0; column < ColumnCount; ++column) {
+        if(hasSortKey(column)) {
+            m_sortKeys[column].append(StringShare::EmptyId);
+            m_sortRanks[column].append(NoRank);
+            ++m_unrankedRows[column];
+            updateSortRank(row, column);
+        }
+        m_widths[column].append(-1);
+    }
+
+    return row;
+}
+
+void TrackStore::release(int row)
+{
+    if(row < 0)
+        return;
+
+    // Released rows are cleared so that totals can simply add up the columns.
+
+    m_track[row] = 0;
+    m_year[row] = 0;
+    m_seconds[row] = 0;
+    m_bitrate[row] = 0;
+    m_bytes[row] = 0;
+
+    for(int column = 0; column < ColumnCount; ++column) {
+        if(hasSortKey(column)) {
+            StringShare::release(m_sortKeys[column][row]);
+            m_sortKeys[column][row] = StringShare::EmptyId;
+            m_unsharedSortKeys[column].remove(row);
+            updateSortRank(row, column);
+        }
+        m_widths[column][row] = -1;
+        ++m_changeCounts[column];
+    }
+
+    m_freeRows.append(row);
+}
+
+void TrackStore::setNumbers(int row, const Tag *tag)
+{
+    const auto update = [this, row](QVector<qint32> &values, int value, int column) {
+        if(values[row] != value) {
+            values[row] = value;
+            ++m_changeCounts[column];
+        }
+    };
+
+    update(m_track, tag->track(), PlaylistItem::TrackNumberColumn);
+    update(m_year, tag->year(), PlaylistItem::YearColumn);
+    update(m_seconds, tag->seconds(), PlaylistItem::LengthColumn);
+    update(m_bitrate, tag->bitrate(), PlaylistItem::BitrateColumn);
+}
+
+void TrackStore::setSortKey(int row, int column, const QString &key)
+{
+    if(sortKey(row, column) == key)
+        return;
+
+    StringShare::Id &stored = m_sortKeys[column][row];
+    StringShare::release(stored);
+    stored = StringShare::acquire(key);
+
+    // StringShare is full, so the key is kept here instead.
+    if(Q_UNLIKELY(stored == StringShare::EmptyId && !key.isEmpty()))
+        m_unsharedSortKeys[column].insert(row, key);
+    else
+        m_unsharedSortKeys[column].remove(row);
+
+    updateSortRank(row, column);
+    ++m_changeCounts[column];
+}
+
+bool TrackStore::setWidth(int row, int column, int width)
+{
+    qint32 &stored = m_widths[column][row];
+
+    if(stored == width)
+        return false;
+
+    stored = width;
+    return true;
+}
+
+int TrackStore::compareSortKeys(int first, int second, int column) const
+{
+    const quint32 firstRank = m_sortRanks[column][first];
+    const quint32 secondRank = m_sortRanks[column][second];
+
+    if(firstRank != NoRank && secondRank != NoRank)
+        return firstRank > secondRank ? 1 : (firstRank < secondRank ? -1 : 0);
+
+    return m_collator.compare(sortKey(first, column), sortKey(second, column));
+}
+
+const QString &TrackStore::unsharedSortKey(int row, int column) const
+{
+    static const QString empty;
+
+    const auto it = m_unsharedSortKeys[column].constFind(row);
+    return it != m_unsharedSortKeys[column].constEnd() ? it.value() : empty;
+}
+
+void TrackStore::updateSortRank(int row, int column) const
+{
+    quint32 &rank = m_sortRanks[column][row];
+    const auto it = m_keyRanks[column].constFind(m_sortKeys[column][row]);
+    quint32 newRank = it != m_keyRanks[column].constEnd() ? it.value() : NoRank;
+
+    // Unshared keys only get a rank from rankSortKeys().
+    if(Q_UNLIKELY(m_unsharedSortKeys[column].contains(row)))
+        newRank = NoRank;
+
+    if(rank == NoRank && newRank != NoRank)
+        --m_unrankedRows[column];
+    else if(rank != NoRank && newRank == NoRank)
+        ++m_unrankedRows[column];
+
+    rank = newRank;
+}
+
+void TrackStore::rankSortKeys(int column) const
+{
+    QVector<StringShare::Id> keys = m_sortKeys[column];
+    keys.append(StringShare::EmptyId); // For rows allocated later
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    // QCollatorSortKey has no default constructor, hence std::vector.
+    std::vector<QCollatorSortKey> collationKeys;
+    collationKeys.reserve(keys.size());
+
+    for(const StringShare::Id key : qAsConst(keys))
+        collationKeys.push_back(m_collator.sortKey(StringShare::string(key)));
+
+    // Keys that could not be interned are ranked along with the others,
+    // each on its own.
+    const QHash<int, QString> &unshared = m_unsharedSortKeys[column];
+    QVector<int> unsharedRows;
+    unsharedRows.reserve(unshared.count());
+
+    for(auto it = unshared.constBegin(); it != unshared.constEnd(); ++it) {
+        unsharedRows.append(it.key());
+        collationKeys.push_back(m_collator.sortKey(it.value()));
+    }
+
+    std::vector<int> order(collationKeys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&collationKeys](int a, int b) {
+        return collationKeys[a].compare(collationKeys[b]) < 0;
+    });
+
+    // The ranked keys are held on to, an ID that is let go of could come back
+    // for a different string.
+
+    QHash<StringShare::Id, quint32> ranks;
+    ranks.reserve(keys.size());
+    QHash<int, quint32> unsharedRanks;
+
+    quint32 rank = 0;
+    for(size_t i = 0; i < order.size(); ++i) {
+        if(i > 0 && collationKeys[order[i]].compare(collationKeys[order[i - 1]]) != 0)
+            ++rank;
+
+        if(order[i] >= keys.size()) {
+            unsharedRanks.insert(unsharedRows[order[i] - keys.size()], rank);
+            continue;
+        }
+
+        ranks.insert(keys[order[i]], rank);
+        StringShare::retain(keys[order[i]]);
+    }
+
+    const QHash<StringShare::Id, quint32> &oldRanks = m_keyRanks[column];
+    for(auto it = oldRanks.constBegin(); it != oldRanks.constEnd(); ++it)
+        StringShare::release(it.key());
+
+    m_keyRanks[column] = ranks;
+
+    const QVector<StringShare::Id> &rowKeys = m_sortKeys[column];
+    QVector<quint32> &rowRanks = m_sortRanks[column];
+
+    for(int row = 0; row < rowKeys.count(); ++row)
+        rowRanks[row] = ranks.value(rowKeys[row]);
+
+    for(auto it = unsharedRanks.constBegin(); it != unsharedRanks.constEnd(); ++it)
+        rowRanks[it.key()] = it.value();
+
+    m_unrankedRows[column] = 0;
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2020 The JuK Authors
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_TRACKSTORE_H
+#define JUK_TRACKSTORE_H
+
+#include <QCollator>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "playlistitem.h"
+#include "stringshare.h"
+
+class Tag;
+
+/**
+ * Keeps the values that sorting, column sizing and totals need for every
+ * track of the collection in one array per column, addressed by a dense row
+ * number, instead of in each track's shared item data.  Comparing or adding
+ * up a column then walks contiguous memory rather than going through the
+ * FileHandle and Tag of each track.
+ *
+ * Rows are handed out by allocate() and reused after release().  Owned by the
+ * CollectionList; every CollectionListItem holds one row, shared with its
+ * PlaylistItems.
+ */
+class TrackStore
+{
+public:
+    static const int ColumnCount = PlaylistItem::FullPathColumn + 1;
+
+    TrackStore();
+
+    int allocate();
+    void release(int row);
+
+    /**
+     * The number of tracks in the store, not counting released rows.
+     */
+    int count() const { return m_seconds.count() - m_freeRows.count(); }
+
+    /**
+     * Copies the numeric values of @p tag into @p row.
+     */
+    void setNumbers(int row, const Tag *tag);
+
+    int track(int row) const { return m_track[row]; }
+    int year(int row) const { return m_year[row]; }
+    int seconds(int row) const { return m_seconds[row]; }
+    int bitrate(int row) const { return m_bitrate[row]; }
+
+    /**
+     * The size of the file of @p row in bytes, 0 if it is not known.
+     */
+    qint64 bytes(int row) const { return m_bytes[row]; }
+    void setBytes(int row, qint64 bytes) { m_bytes[row] = qMax<qint64>(0, bytes); }
+
+    /**
+     * The lowercased text of @p column used for sorting.  Only columns that
+     * sort by text have a key, see hasSortKey().  The keys are interned, so
+     * each column only holds the StringShare IDs, apart from the few keys
+     * StringShare had no room for.
+     */
+    const QString &sortKey(int row, int column) const
+    {
+        const StringShare::Id id = m_sortKeys[column][row];
+        if(Q_UNLIKELY(id == StringShare::EmptyId && !m_unsharedSortKeys[column].isEmpty()))
+            return unsharedSortKey(row, column);
+        return StringShare::string(id);
+    }
+    void setSortKey(int row, int column, const QString &key);
+    static bool hasSortKey(int column);
+
+    /**
+     * The position of the sort key of @p row among all sort keys of
+     * @p column, in natural (locale aware, numeric, case insensitive) order.
+     * Rows with equal keys have the same rank, so comparing two rows is
+     * comparing two integers.
+     *
+     * The distinct keys of a column are collated again if some row has a
+     * key that was not there when they were last ranked, which is only worth
+     * it when sorting all rows.  See compareSortKeys() for everything else.
+     */
+    quint32 sortRank(int row, int column) const
+    {
+        if(Q_UNLIKELY(m_unrankedRows[column] > 0))
+            rankSortKeys(column);
+        return m_sortRanks[column][row];
+    }
+
+    /**
+     * Ranks the keys of @p column if needed, ahead of a full sort.
+     */
+    void prepareSortRanks(int column) const
+    {
+        if(m_unrankedRows[column] > 0)
+            rankSortKeys(column);
+    }
+
+    /**
+     * Compares the sort keys of two rows in natural order.  Uses the ranks
+     * where both keys have one and the collator otherwise, so that inserting
+     * a track with a new key into a sorted list never collates the whole
+     * column.
+     */
+    int compareSortKeys(int first, int second, int column) const;
+
+    /**
+     * The width of the text of @p column for the "weighted" column width
+     * mode, or -1 if it has not been measured.  setWidth() returns true if
+     * the width changed.
+     */
+    int width(int row, int column) const { return m_widths[column][row]; }
+    bool setWidth(int row, int column, int width);
+
+    /**
+     * Goes up whenever a value that rows are sorted by in @p column changes,
+     * so that a sort running in the background can tell that its keys are
+     * stale.  Counted per column, as the length and bitrate keep changing
+     * while they are read after a folder scan.
+     */
+    quint64 changeCount(int column) const { return m_changeCounts[column]; }
+
+private:
+    const QString &unsharedSortKey(int row, int column) const;
+    void updateSortRank(int row, int column) const;
+    void rankSortKeys(int column) const;
+
+    static const quint32 NoRank = 0xffffffffu;
+
+    QVector<qint32> m_track;
+    QVector<qint32> m_year;
+    QVector<qint32> m_seconds;
+    QVector<qint32> m_bitrate;
+    QVector<qint64> m_bytes;
+    QVector<StringShare::Id> m_sortKeys[ColumnCount];
+    QHash<int, QString> m_unsharedSortKeys[ColumnCount]; ///< By row, for EmptyId
+    mutable QVector<quint32> m_sortRanks[ColumnCount];
+    mutable QHash<StringShare::Id, quint32> m_keyRanks[ColumnCount];
+    mutable int m_unrankedRows[ColumnCount]; ///< Rows with NoRank
+    QCollator m_collator;
+    QVector<qint32> m_widths[ColumnCount];
+    QVector<int> m_freeRows;
+    quint64 m_changeCounts[ColumnCount];
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
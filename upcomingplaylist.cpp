@@ -22,6 +22,7 @@
 #include "playlistitem.h"
 #include "playlistcollection.h"
 #include "tracksequencemanager.h"
+#include "cache.h"
 #include "collectionlist.h"
 #include "actioncollection.h"
 #include "juk_debug.h"
@@ -249,32 +250,27 @@ void UpcomingPlaylist::UpcomingSequenceIterator::prepareToPlay(Playlist *)
         setCurrent(m_playlist->firstChild());
 }
 
-QDataStream &operator<<(QDataStream &s, const UpcomingPlaylist &p)
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const UpcomingPlaylist &p)
 {
     PlaylistItemList l = const_cast<UpcomingPlaylist *>(&p)->items();
 
     s << qint32(l.count());
 
     foreach(const PlaylistItem *playlistItem, l)
-        s << playlistItem->file().absFilePath();
+        s.writeTrack(playlistItem->file());
 
     return s;
 }
 
-QDataStream &operator>>(QDataStream &s, UpcomingPlaylist &p)
+PlaylistDataStream &operator>>(PlaylistDataStream &s, UpcomingPlaylist &p)
 {
-    QString fileName;
     PlaylistItem *newItem = 0;
     qint32 count;
 
     s >> count;
 
     for(qint32 i = 0; i < count; ++i) {
-        s >> fileName;
-        if(fileName.isEmpty())
-            throw BICStreamException();
-
-        newItem = p.createItem(FileHandle(fileName), newItem);
+        newItem = p.createItem(s.readTrack(), newItem);
     }
 
     return s;
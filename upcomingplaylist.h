@@ -205,8 +205,8 @@ private:
     UpcomingPlaylist *m_playlist;
 };
 
-QDataStream &operator<<(QDataStream &s, const UpcomingPlaylist &p);
-QDataStream &operator>>(QDataStream &s, UpcomingPlaylist &p);
+PlaylistDataStream &operator<<(PlaylistDataStream &s, const UpcomingPlaylist &p);
+PlaylistDataStream &operator>>(PlaylistDataStream &s, UpcomingPlaylist &p);
 
 #endif /* UPCOMINGPLAYLIST_H */
 